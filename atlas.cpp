@@ -54,6 +54,11 @@ int CAtlas::getVersion() const
     return m_atlasVersion;
 }
 
+QString CAtlas::environment() const
+{
+    return m_environment;
+}
+
 CAtlas::CAtlas(QObject *parent)
     : QObject(parent)
 {
@@ -65,6 +70,16 @@ CAtlas::~CAtlas()
         uninit();
 }
 
+CAtlas::AtlasDirection CAtlas::directionFromString(const QString &str)
+{
+    const QString dir = str.trimmed().toUpper();
+    if (dir.startsWith(QSL("JE")))
+        return Atlas_JE;
+    if (dir.startsWith(QSL("EJ")))
+        return Atlas_EJ;
+    return Atlas_Auto;
+}
+
 int CAtlas::getTransDirection() const
 {
     return m_atlasTransDirection;
@@ -178,6 +193,36 @@ QString CAtlas::translate(AtlasDirection transDirection, const QString &str)
     return res;
 }
 
+QStringList CAtlas::translateBatch(AtlasDirection transDirection, const QStringList &strs)
+{
+    QStringList res;
+    if (strs.isEmpty()) return res;
+
+    if (strs.count() > 1) {
+        // Segments never contain line breaks, so ATLAS output can be split back by lines.
+        const QString s = translate(transDirection,strs.join(QSL("\r\n")));
+        if (!s.startsWith(QSL("ERR"))) {
+            res = s.trimmed().split(QChar('\n'));
+            for (auto &line : res)
+                line = line.trimmed();
+            if (res.count() == strs.count())
+                return res;
+        }
+        res.clear();
+    }
+
+    // Line count mismatch, translate one by one.
+    res.reserve(strs.count());
+    for (const auto &str : strs) {
+        const QString s = translate(transDirection,str);
+        if (s.startsWith(QSL("ERR")))
+            return QStringList();
+        res.append(s.trimmed());
+    }
+
+    return res;
+}
+
 QStringList CAtlas::getEnvironments()
 {
     QStringList res;
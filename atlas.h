@@ -36,6 +36,8 @@ public:
     explicit CAtlas(QObject *parent = nullptr);
     ~CAtlas() override;
 
+    static AtlasDirection directionFromString(const QString &str);
+
     // returns 0 if not initialized.
     int getTransDirection() const;
 
@@ -46,8 +48,12 @@ public:
     bool isLoaded() const;
     bool isDLLsLoaded() const;
     int getVersion() const;
+    QString environment() const;
 
     QString translate(AtlasDirection transDirection, const QString &str);
+    // Translates several lines with one engine call if possible.
+    // Returns empty list on failure.
+    QStringList translateBatch(AtlasDirection transDirection, const QStringList &strs);
     QStringList getEnvironments();
 
     bool haveJapanese(const QString &str);
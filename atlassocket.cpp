@@ -1,8 +1,91 @@
 #include "atlassocket.h"
+#include "protocol.h"
 
-CAtlasSocket::CAtlasSocket(QObject *parent)
-    : QSslSocket(parent)
+CAtlasSocket::CAtlasSocket(QSslSocket *socket, QObject *parent)
+    : QObject(parent),
+      m_device(socket),
+      m_sslSocket(socket),
+      m_closed(new std::atomic<bool>(false))
 {
+    socket->setParent(this);
+    const QSharedPointer<std::atomic<bool> > closed = m_closed;
+    connect(socket,&QAbstractSocket::disconnected,this,[closed]{
+        *closed = true;
+    });
+    connect(socket,&QAbstractSocket::disconnected,this,&CAtlasSocket::disconnected);
+    connect(socket,&QIODevice::readyRead,this,&CAtlasSocket::readyRead);
+}
+
+CAtlasSocket::CAtlasSocket(QLocalSocket *socket, QObject *parent)
+    : QObject(parent),
+      m_device(socket),
+      m_localSocket(socket),
+      m_closed(new std::atomic<bool>(false))
+{
+    socket->setParent(this);
+    const QSharedPointer<std::atomic<bool> > closed = m_closed;
+    connect(socket,&QLocalSocket::disconnected,this,[closed]{
+        *closed = true;
+    });
+    connect(socket,&QLocalSocket::disconnected,this,&CAtlasSocket::disconnected);
+    connect(socket,&QIODevice::readyRead,this,&CAtlasSocket::readyRead);
+}
+
+QIODevice *CAtlasSocket::device() const
+{
+    return m_device;
+}
+
+QSslSocket *CAtlasSocket::sslSocket() const
+{
+    return m_sslSocket;
+}
+
+bool CAtlasSocket::isReady() const
+{
+    if (m_sslSocket)
+        return m_sslSocket->isEncrypted();
+    return !m_localSocket.isNull();
+}
+
+bool CAtlasSocket::isOpen() const
+{
+    return (m_device && m_device->isOpen());
+}
+
+bool CAtlasSocket::canReadLine() const
+{
+    return (m_device && m_device->canReadLine());
+}
+
+qint64 CAtlasSocket::bytesAvailable() const
+{
+    return (m_device ? m_device->bytesAvailable() : 0);
+}
+
+QByteArray CAtlasSocket::readLine()
+{
+    return (m_device ? m_device->readLine() : QByteArray());
+}
+
+qint64 CAtlasSocket::write(const QByteArray &data)
+{
+    return (m_device ? m_device->write(data) : -1);
+}
+
+void CAtlasSocket::flush()
+{
+    if (m_sslSocket) {
+        m_sslSocket->flush();
+    } else if (m_localSocket) {
+        m_localSocket->flush();
+    }
+}
+
+void CAtlasSocket::close()
+{
+    if (m_device)
+        m_device->close();
 }
 
 bool CAtlasSocket::authenticated() const
@@ -24,3 +107,97 @@ void CAtlasSocket::setDirection(CAtlas::AtlasDirection direction)
 {
     m_direction = direction;
 }
+
+bool CAtlasSocket::busy() const
+{
+    return m_busy;
+}
+
+void CAtlasSocket::setBusy(bool busy)
+{
+    m_busy = busy;
+}
+
+int CAtlasSocket::pendingRequests() const
+{
+    return m_pendingRequests;
+}
+
+void CAtlasSocket::addPendingRequests(int delta)
+{
+    m_pendingRequests += delta;
+}
+
+int CAtlasSocket::protocolVersion() const
+{
+    return m_protocolVersion;
+}
+
+void CAtlasSocket::setProtocolVersion(int version)
+{
+    m_protocolVersion = version;
+}
+
+bool CAtlasSocket::compression() const
+{
+    return !m_compressor.isNull();
+}
+
+void CAtlasSocket::enableCompression()
+{
+    m_compressor.reset(new CDeflateStream(CDeflateStream::Mode_Compress));
+    m_decompressor.reset(new CDeflateStream(CDeflateStream::Mode_Decompress));
+}
+
+bool CAtlasSocket::compress(const QByteArray &data, QByteArray &result)
+{
+    return (m_compressor && m_compressor->process(data,result,0));
+}
+
+bool CAtlasSocket::decompress(const QByteArray &data, QByteArray &result)
+{
+    return (m_decompressor && m_decompressor->process(data,result,CDefaults::protocolMaxFrameSize));
+}
+
+CDeflateStream *CAtlasSocket::decompressor() const
+{
+    return m_decompressor.data();
+}
+
+void CAtlasSocket::takeCompressionCounters(qint64 &rawBytes, qint64 &packedBytes, qint64 &nsecs)
+{
+    if (m_compressor)
+        m_compressor->takeCounters(rawBytes,packedBytes,nsecs);
+    if (m_decompressor)
+        m_decompressor->takeCounters(rawBytes,packedBytes,nsecs);
+}
+
+bool CAtlasSocket::hashReplies() const
+{
+    return m_hashReplies;
+}
+
+void CAtlasSocket::setHashReplies(bool enabled)
+{
+    m_hashReplies = enabled;
+}
+
+bool CAtlasSocket::replicationPeer() const
+{
+    return m_replicationPeer;
+}
+
+void CAtlasSocket::setReplicationPeer(bool peer)
+{
+    m_replicationPeer = peer;
+}
+
+CDocumentSession &CAtlasSocket::documents()
+{
+    return m_documents;
+}
+
+QSharedPointer<std::atomic<bool> > CAtlasSocket::closedFlag() const
+{
+    return m_closed;
+}
@@ -1,14 +1,37 @@
 #ifndef CATLASSOCKET_H
 #define CATLASSOCKET_H
 
+#include <QObject>
+#include <QPointer>
 #include <QSslSocket>
+#include <QLocalSocket>
+#include <QSharedPointer>
+#include <atomic>
 #include "atlas.h"
+#include "document.h"
+#include "deflate.h"
 
-class CAtlasSocket : public QSslSocket
+// Client connection state on top of TLS socket or local socket (named pipe),
+// both transports speak the same protocol.
+class CAtlasSocket : public QObject
 {
     Q_OBJECT
 public:
-    explicit CAtlasSocket(QObject *parent = nullptr);
+    // Takes ownership of transport socket.
+    CAtlasSocket(QSslSocket *socket, QObject *parent = nullptr);
+    CAtlasSocket(QLocalSocket *socket, QObject *parent = nullptr);
+
+    QIODevice *device() const;
+    QSslSocket *sslSocket() const;
+    // TLS handshake is finished, local sockets are always ready.
+    bool isReady() const;
+    bool isOpen() const;
+    bool canReadLine() const;
+    qint64 bytesAvailable() const;
+    QByteArray readLine();
+    qint64 write(const QByteArray &data);
+    void flush();
+    void close();
 
     bool authenticated() const;
     void setAuthenticated(bool authenticated);
@@ -16,9 +39,59 @@ public:
     CAtlas::AtlasDirection direction() const;
     void setDirection(CAtlas::AtlasDirection direction);
 
+    // Request is processed in background, next commands wait in buffer.
+    bool busy() const;
+    void setBusy(bool busy);
+
+    // Tagged (ID:) requests running in background, answered out of order.
+    int pendingRequests() const;
+    void addPendingRequests(int delta);
+
+    // 1 for text lines, 2 for binary frames negotiated at INIT.
+    int protocolVersion() const;
+    void setProtocolVersion(int version);
+
+    // Payload compression negotiated at INIT, both streams live as long as connection.
+    bool compression() const;
+    void enableCompression();
+    bool compress(const QByteArray &data, QByteArray &result);
+    bool decompress(const QByteArray &data, QByteArray &result);
+    CDeflateStream *decompressor() const;
+    void takeCompressionCounters(qint64 &rawBytes, qint64 &packedBytes, qint64 &nsecs);
+
+    // Client uses TRH: requests, results are sent with input hash.
+    bool hashReplies() const;
+    void setHashReplies(bool enabled);
+
+    // Authenticated with replication token, may send REPL: batches.
+    bool replicationPeer() const;
+    void setReplicationPeer(bool peer);
+
+    // Document mode state (DOC:/TRD: commands).
+    CDocumentSession &documents();
+
+    // Set on disconnect, safe to check from worker threads after socket is gone.
+    QSharedPointer<std::atomic<bool> > closedFlag() const;
+
+Q_SIGNALS:
+    void readyRead();
+    void disconnected();
+
 private:
+    QPointer<QIODevice> m_device;
+    QPointer<QSslSocket> m_sslSocket;
+    QPointer<QLocalSocket> m_localSocket;
     bool m_authenticated { false };
+    bool m_busy { false };
+    bool m_hashReplies { false };
+    bool m_replicationPeer { false };
+    int m_pendingRequests { 0 };
+    int m_protocolVersion { 1 };
     CAtlas::AtlasDirection m_direction { CAtlas::Atlas_JE };
+    QSharedPointer<std::atomic<bool> > m_closed;
+    CDocumentSession m_documents;
+    QScopedPointer<CDeflateStream> m_compressor;
+    QScopedPointer<CDeflateStream> m_decompressor;
 
 };
 
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui widgets network
+QT       += core gui widgets network concurrent
 
 TARGET = atlastcpsvc-ng
 TEMPLATE = app
@@ -15,14 +15,57 @@ SOURCES += main.cpp\
     atlas.cpp \
     service.cpp \
     server.cpp \
-    atlassocket.cpp
+    atlassocket.cpp \
+    stats.cpp \
+    canonicalizer.cpp \
+    segmenter.cpp \
+    frequencysketch.cpp \
+    deflate.cpp \
+    resultcache.cpp \
+    sharedcache.cpp \
+    persistentcache.cpp \
+    bundle.cpp \
+    templater.cpp \
+    markup.cpp \
+    glossary.cpp \
+    bulk.cpp \
+    warmup.cpp \
+    replicator.cpp \
+    cachearchive.cpp \
+    document.cpp \
+    failurecache.cpp \
+    protocol.cpp \
+    httpserver.cpp \
+    translator.cpp
 
 HEADERS  += mainwindow.h \
     atlas.h \
     qsl.h \
     service.h \
     server.h \
-    atlassocket.h
+    atlassocket.h \
+    stats.h \
+    canonicalizer.h \
+    segmenter.h \
+    frequencysketch.h \
+    deflate.h \
+    resultcache.h \
+    sharedcache.h \
+    persistentcache.h \
+    bundle.h \
+    hashutils.h \
+    templater.h \
+    markup.h \
+    glossary.h \
+    bulk.h \
+    warmup.h \
+    replicator.h \
+    cachearchive.h \
+    document.h \
+    failurecache.h \
+    protocol.h \
+    httpserver.h \
+    translator.h
 
 CONFIG += warn_on \
     exceptions \
@@ -0,0 +1,454 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextCodec>
+#include <QUrl>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include "bulk.h"
+#include "qsl.h"
+
+namespace {
+// Bulk jobs and batches share own threads, so they do not take global pool
+// threads from interactive translations.
+class CBulkThreadPool : public QThreadPool
+{
+public:
+    CBulkThreadPool()
+    {
+        setMaxThreadCount(CDefaults::bulkMaxThreads);
+    }
+};
+Q_GLOBAL_STATIC(CBulkThreadPool,bulkThreadPool)
+
+template<typename T, typename Function>
+void runBulkJobs(const QVector<T> &jobs, Function function)
+{
+    QVector<QFuture<void> > futures;
+    futures.reserve(jobs.count());
+    for (const T &job : jobs)
+        futures.append(QtConcurrent::run(bulkThreadPool(),[&function,&job]{ function(job); }));
+    for (QFuture<void> &future : futures)
+        future.waitForFinished();
+}
+}
+
+CBulkTranslator::CBulkTranslator(CTranslator *translator, CStatistics *stats)
+    : m_translator(translator),
+      m_stats(stats)
+{
+}
+
+CBulkTranslator::Format CBulkTranslator::formatFromName(const QString &name)
+{
+    const QString fmt = name.toLower();
+    if (fmt.endsWith(QSL("srt")))
+        return Format_SRT;
+    if (fmt.endsWith(QSL("ass")) || fmt.endsWith(QSL("ssa")))
+        return Format_ASS;
+    return Format_Plain;
+}
+
+QString CBulkTranslator::errorString() const
+{
+    return m_errorString;
+}
+
+void CBulkTranslator::setCancelCheck(const CTranslator::CancelCheck &canceled)
+{
+    m_canceled = canceled;
+}
+
+bool CBulkTranslator::canceled() const
+{
+    return (m_canceled && m_canceled());
+}
+
+void CBulkTranslator::appendText(QVector<CPiece> &pieces, const QString &text)
+{
+    if (text.isEmpty()) return;
+
+    const bool translatable = std::any_of(text.constBegin(),text.constEnd(),[](QChar c){
+        return c.isLetterOrNumber();
+    });
+    pieces.append({ text, translatable });
+}
+
+void CBulkTranslator::appendPieces(QVector<CPiece> &pieces, const QString &text, bool assTags)
+{
+    // Override blocks {...}, HTML-like tags <...> and ASS escapes \N, \n, \h are kept as is.
+    int start = 0;
+    int pos = 0;
+    while (pos < text.length()) {
+        const QChar c = text.at(pos);
+        int end = -1;
+        if (c == QChar('{')) {
+            end = text.indexOf(QChar('}'),pos);
+        } else if (c == QChar('<') && !assTags) {
+            end = text.indexOf(QChar('>'),pos);
+        } else if (c == QChar('\\') && assTags && pos + 1 < text.length()) {
+            const QChar e = text.at(pos + 1);
+            if (e == QChar('N') || e == QChar('n') || e == QChar('h'))
+                end = pos + 1;
+        }
+
+        if (end < 0) {
+            pos++;
+            continue;
+        }
+
+        appendText(pieces,text.mid(start,pos - start));
+        pieces.append({ text.mid(pos,end - pos + 1), false });
+        start = pos = end + 1;
+    }
+    appendText(pieces,text.mid(start));
+}
+
+QVector<CBulkTranslator::CPiece> CBulkTranslator::parse(const QString &content, Format format)
+{
+    const int assDefaultFields = 10;
+
+    QVector<CPiece> res;
+    const QStringList lines = content.split(QChar('\n'));
+
+    bool srtText = false;
+    bool assEvents = false;
+    int assFields = assDefaultFields;
+    for (int i = 0; i < lines.count(); i++) {
+        QString line = lines.at(i);
+        QString eol;
+        if (line.endsWith(QChar('\r'))) {
+            line.chop(1);
+            eol = QSL("\r");
+        }
+        if (i + 1 < lines.count())
+            eol.append(QChar('\n'));
+
+        switch (format) {
+            case Format_Plain:
+                appendText(res,line);
+                break;
+
+            case Format_SRT:
+                if (line.trimmed().isEmpty()) {
+                    srtText = false;
+                    res.append({ line, false });
+                } else if (line.contains(QSL("-->"))) {
+                    srtText = true;
+                    res.append({ line, false });
+                } else if (srtText) {
+                    appendPieces(res,line,false);
+                } else {
+                    res.append({ line, false }); // cue number
+                }
+                break;
+
+            case Format_ASS: {
+                const QString trimmed = line.trimmed();
+                if (trimmed.startsWith(QChar('['))) {
+                    assEvents = (trimmed.compare(QSL("[Events]"),Qt::CaseInsensitive) == 0);
+                    res.append({ line, false });
+                    break;
+                }
+                if (assEvents && trimmed.startsWith(QSL("Format:"))) {
+                    assFields = trimmed.count(QChar(',')) + 1;
+                    res.append({ line, false });
+                    break;
+                }
+                if (!assEvents || !trimmed.startsWith(QSL("Dialogue:"))) {
+                    res.append({ line, false });
+                    break;
+                }
+
+                // Text is the last field and may contain commas itself.
+                int pos = -1;
+                for (int f = 0; f < assFields - 1; f++) {
+                    pos = line.indexOf(QChar(','),pos + 1);
+                    if (pos < 0) break;
+                }
+                if (pos < 0) {
+                    res.append({ line, false });
+                    break;
+                }
+                res.append({ line.left(pos + 1), false });
+                appendPieces(res,line.mid(pos + 1),true);
+                break;
+            }
+        }
+
+        if (!eol.isEmpty())
+            res.append({ eol, false });
+    }
+
+    return res;
+}
+
+QHash<QString,QString> CBulkTranslator::loadCheckpoint(const QString &fileName)
+{
+    QHash<QString,QString> res;
+
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly)) return res;
+
+    while (!f.atEnd()) {
+        const QByteArray line = f.readLine().trimmed();
+        const int sep = line.indexOf('\t');
+        if (sep < 0) continue;
+        res.insert(QUrl::fromPercentEncoding(line.left(sep)),
+                   QUrl::fromPercentEncoding(line.mid(sep + 1)));
+    }
+
+    return res;
+}
+
+bool CBulkTranslator::translate(CAtlas::AtlasDirection direction, const QString &content, Format format,
+                                QString &result, const QString &checkpointFile)
+{
+    if (m_translator.isNull()) {
+        m_errorString = QSL("Translator is not initialized");
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QVector<CPiece> pieces = parse(content,format);
+
+    // Global line deduplication.
+    QStringList unique;
+    QHash<QString,int> uniqueIndex;
+    int lines = 0;
+    for (const auto &piece : pieces) {
+        if (!piece.translatable) continue;
+        lines++;
+        const QString text = piece.text.trimmed();
+        if (!uniqueIndex.contains(text)) {
+            uniqueIndex.insert(text,unique.count());
+            unique.append(text);
+        }
+    }
+
+    QHash<QString,QString> done;
+    QFile checkpoint;
+    if (!checkpointFile.isEmpty()) {
+        done = loadCheckpoint(checkpointFile);
+        checkpoint.setFileName(checkpointFile);
+        if (!checkpoint.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            m_errorString = QSL("Unable to open checkpoint file %1").arg(checkpointFile);
+            return false;
+        }
+    }
+
+    QStringList todo;
+    for (const auto &text : qAsConst(unique)) {
+        if (!done.contains(text))
+            todo.append(text);
+    }
+
+    qInfo() << "Bulk translation:" << lines << "lines," << unique.count() << "unique,"
+            << (unique.count() - todo.count()) << "restored from checkpoint";
+
+    QVector<QStringList> batches;
+    for (int i = 0; i < todo.count(); i += CDefaults::bulkBatchSize)
+        batches.append(todo.mid(i,CDefaults::bulkBatchSize));
+
+    // Engine calls are serialized inside CAtlas, parallel batches overlap
+    // segmentation and memory lookups of one batch with engine work of another.
+    QMutex doneMutex;
+    std::atomic<int> failures { 0 };
+    QPointer<CTranslator> translator = m_translator;
+    runBulkJobs(batches,[&](const QStringList &batch){
+        if (failures > 0 || canceled()) return;
+
+        QStringList translated = translator->translate(direction,batch.join(QChar('\n')),
+                                                       CTranslator::Flag_None,m_canceled).split(QChar('\n'));
+        if (translated.count() != batch.count()) {
+            translated.clear();
+            for (const auto &text : batch)
+                translated.append(translator->translate(direction,text,CTranslator::Flag_None,m_canceled));
+        }
+
+        QMutexLocker locker(&doneMutex);
+        for (int i = 0; i < batch.count(); i++) {
+            const QString &res = translated.at(i);
+            if (res.startsWith(QSL("ERR"))) {
+                failures++;
+                continue;
+            }
+            done.insert(batch.at(i),res.trimmed());
+            if (checkpoint.isOpen()) {
+                checkpoint.write(QUrl::toPercentEncoding(batch.at(i)));
+                checkpoint.write("\t");
+                checkpoint.write(QUrl::toPercentEncoding(res.trimmed()));
+                checkpoint.write("\n");
+            }
+        }
+        if (checkpoint.isOpen())
+            checkpoint.flush();
+    });
+
+    if (canceled()) {
+        m_errorString = QSL("Bulk translation canceled");
+        return false;
+    }
+    if (failures > 0) {
+        m_errorString = QSL("%1 lines failed to translate").arg(failures.load());
+        return false;
+    }
+
+    result.clear();
+    result.reserve(content.length());
+    for (const auto &piece : pieces) {
+        if (!piece.translatable) {
+            result.append(piece.text);
+            continue;
+        }
+
+        // Keep surrounding whitespace of original line.
+        const QString &text = piece.text;
+        int start = 0;
+        while (start < text.length() && text.at(start).isSpace())
+            start++;
+        int end = text.length();
+        while (end > start && text.at(end - 1).isSpace())
+            end--;
+
+        result.append(text.left(start));
+        result.append(done.value(text.trimmed()));
+        result.append(text.mid(end));
+    }
+
+    if (m_stats) {
+        m_stats->add(QSL("bulk.jobs"));
+        m_stats->add(QSL("bulk.lines"),lines);
+        m_stats->add(QSL("bulk.uniqueLines"),unique.count());
+    }
+
+    qInfo() << "Bulk translation finished in" << timer.elapsed() << "ms";
+    return true;
+}
+
+bool CBulkTranslator::translateItems(const QVector<CAtlas::AtlasDirection> &directions, const QStringList &items,
+                                     QStringList &results, CTranslator::TranslateFlags flags)
+{
+    results.clear();
+    if (m_translator.isNull()) {
+        m_errorString = QSL("Translator is not initialized");
+        return false;
+    }
+
+    // Identical items with the same direction are translated once.
+    struct CChunk {
+        CAtlas::AtlasDirection direction;
+        QStringList texts;
+    };
+    QSet<QPair<int,QString> > seen;
+    QHash<int,QStringList> unique;
+    QVector<CChunk> chunks;
+    for (int i = 0; i < items.count(); i++) {
+        const auto key = qMakePair(static_cast<int>(directions.value(i,CAtlas::Atlas_Auto)),items.at(i));
+        if (seen.contains(key)) continue;
+        seen.insert(key);
+
+        // Multi-line items can't be split back from joined result.
+        if (items.at(i).contains(QChar('\n'))) {
+            chunks.append({ static_cast<CAtlas::AtlasDirection>(key.first), { items.at(i) } });
+        } else {
+            unique[key.first].append(items.at(i));
+        }
+    }
+    for (auto it = unique.constBegin(), end = unique.constEnd(); it != end; ++it) {
+        for (int i = 0; i < it.value().count(); i += CDefaults::bulkBatchSize)
+            chunks.append({ static_cast<CAtlas::AtlasDirection>(it.key()), it.value().mid(i,CDefaults::bulkBatchSize) });
+    }
+
+    // Same scheduling as bulk jobs: each chunk is one translator call, so its cache
+    // misses go to the engine as one batch.
+    QMutex doneMutex;
+    QHash<QPair<int,QString>,QString> done;
+    QPointer<CTranslator> translator = m_translator;
+    runBulkJobs(chunks,[&](const CChunk &chunk){
+        if (canceled()) return;
+
+        QStringList translated;
+        if (chunk.texts.count() > 1) {
+            translated = translator->translate(chunk.direction,chunk.texts.join(QChar('\n')),
+                                               flags,m_canceled).split(QChar('\n'));
+        }
+        if (translated.count() != chunk.texts.count()) {
+            translated.clear();
+            for (const auto &text : chunk.texts)
+                translated.append(translator->translate(chunk.direction,text,flags,m_canceled));
+        }
+
+        QMutexLocker locker(&doneMutex);
+        for (int i = 0; i < chunk.texts.count(); i++) {
+            if (!translated.at(i).startsWith(QSL("ERR")))
+                done.insert(qMakePair(static_cast<int>(chunk.direction),chunk.texts.at(i)),translated.at(i).trimmed());
+        }
+    });
+
+    int failures = 0;
+    results.reserve(items.count());
+    for (int i = 0; i < items.count(); i++) {
+        const auto it = done.constFind(qMakePair(static_cast<int>(directions.value(i,CAtlas::Atlas_Auto)),items.at(i)));
+        if (it == done.constEnd()) {
+            results.append(QString());
+            failures++;
+        } else {
+            results.append(it.value());
+        }
+    }
+
+    if (m_stats) {
+        m_stats->add(QSL("batch.requests"));
+        m_stats->add(QSL("batch.items"),items.count());
+        m_stats->add(QSL("batch.uniqueItems"),seen.count());
+        m_stats->add(QSL("batch.failures"),failures);
+    }
+
+    if (failures > 0) {
+        m_errorString = QSL("%1 items failed to translate").arg(failures);
+        return false;
+    }
+    return true;
+}
+
+bool CBulkTranslator::translateFile(CAtlas::AtlasDirection direction, const QString &input, const QString &output)
+{
+    QFile f(input);
+    if (!f.open(QIODevice::ReadOnly)) {
+        m_errorString = QSL("Unable to open input file %1").arg(input);
+        return false;
+    }
+    const QByteArray data = f.readAll();
+    f.close();
+
+    QTextCodec *codec = QTextCodec::codecForUtfText(data,QTextCodec::codecForName("UTF-8"));
+    QString content = codec->toUnicode(data);
+    if (content.startsWith(QChar(0xfeff)))
+        content.remove(0,1);
+
+    const QString checkpointFile = QSL("%1.ckpt").arg(output);
+    QString result;
+    if (!translate(direction,content,formatFromName(QFileInfo(input).suffix()),result,checkpointFile))
+        return false;
+
+    QSaveFile out(output);
+    if (!out.open(QIODevice::WriteOnly) ||
+            out.write(result.toUtf8()) < 0 ||
+            !out.commit()) {
+        m_errorString = QSL("Unable to write output file %1").arg(output);
+        return false;
+    }
+
+    QFile::remove(checkpointFile);
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef CBULKTRANSLATOR_H
+#define CBULKTRANSLATOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QPointer>
+#include "atlas.h"
+#include "stats.h"
+#include "translator.h"
+
+namespace CDefaults {
+const int bulkBatchSize = 64;
+const int bulkMaxThreads = 4;
+const int batchMaxItems = 1000;
+const int batchMaxBytes = 1024 * 1024;
+}
+
+class CBulkTranslator
+{
+public:
+    enum Format {
+        Format_Plain = 0,
+        Format_SRT = 1,
+        Format_ASS = 2
+    };
+
+    CBulkTranslator(CTranslator *translator, CStatistics *stats);
+
+    static Format formatFromName(const QString &name);
+
+    // Translates whole document, unique lines go through engine in parallel batches.
+    // Checkpoint file (if set) keeps finished lines, so interrupted job can be resumed.
+    bool translate(CAtlas::AtlasDirection direction, const QString &content, Format format,
+                   QString &result, const QString &checkpointFile = QString());
+    bool translateFile(CAtlas::AtlasDirection direction, const QString &input, const QString &output);
+    // Translates independent items (TRB: command), identical ones once. Failed items get null
+    // result, returns false if any item failed.
+    bool translateItems(const QVector<CAtlas::AtlasDirection> &directions, const QStringList &items,
+                        QStringList &results, CTranslator::TranslateFlags flags = CTranslator::Flag_None);
+
+    // Job is stopped before next engine call when check returns true.
+    void setCancelCheck(const CTranslator::CancelCheck &canceled);
+
+    QString errorString() const;
+
+private:
+    Q_DISABLE_COPY(CBulkTranslator)
+
+    struct CPiece {
+        QString text;
+        bool translatable { false };
+    };
+
+    QPointer<CTranslator> m_translator;
+    QPointer<CStatistics> m_stats;
+    QString m_errorString;
+    CTranslator::CancelCheck m_canceled;
+
+    bool canceled() const;
+
+    static void appendPieces(QVector<CPiece> &pieces, const QString &text, bool assTags);
+    static void appendText(QVector<CPiece> &pieces, const QString &text);
+    static QVector<CPiece> parse(const QString &content, Format format);
+    static QHash<QString,QString> loadCheckpoint(const QString &fileName);
+};
+
+#endif // CBULKTRANSLATOR_H
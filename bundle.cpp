@@ -0,0 +1,296 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QDebug>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include "bundle.h"
+#include "canonicalizer.h"
+#include "hashutils.h"
+#include "qsl.h"
+
+namespace {
+const quint32 bundleMagic = 0x4e425441; // ATBN
+const quint32 bundleVersion = 1;
+const quint32 keysPerBucket = 3;
+const quint32 maxDisplacement = 1U << 24;
+const quint32 maxSeedAttempts = 16;
+const quint32 displacementMix = 0x9e3779b1U;
+}
+
+CBundle::CBundle() = default;
+
+CBundle::~CBundle()
+{
+    close();
+}
+
+quint32 CBundle::slotIndex(quint64 hash, quint32 displacement, quint32 count)
+{
+    return (static_cast<quint32>(hash) ^ (displacement * displacementMix)) % count;
+}
+
+bool CBundle::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+    if (m_file.size() < static_cast<qint64>(sizeof(CHeader))) {
+        close();
+        return false;
+    }
+
+    m_data = m_file.map(0,m_file.size());
+    if (m_data == nullptr) {
+        close();
+        return false;
+    }
+
+    m_header = reinterpret_cast<const CHeader *>(m_data);
+    const qint64 expected = static_cast<qint64>(sizeof(CHeader)) +
+                            static_cast<qint64>(m_header->bucketCount) * sizeof(quint32) +
+                            static_cast<qint64>(m_header->count) * sizeof(CSlot) +
+                            m_header->blobSize;
+    if (m_header->magic != bundleMagic || m_header->version != bundleVersion ||
+            (m_header->count > 0 && m_header->bucketCount == 0) || m_file.size() != expected) {
+        qWarning() << "Invalid translation bundle" << fileName;
+        close();
+        return false;
+    }
+
+    m_displacements = reinterpret_cast<const quint32 *>(m_data + sizeof(CHeader));
+    m_slots = reinterpret_cast<const CSlot *>(m_displacements + m_header->bucketCount);
+    m_blob = reinterpret_cast<const char *>(m_slots + m_header->count);
+
+    // Lookups trust slot table, so truncated or corrupted records are refused here.
+    const bool validSlots = std::all_of(m_slots,m_slots + m_header->count,[this](const CSlot &slot){
+        return static_cast<quint64>(slot.offset) + slot.keySize + slot.valueSize <= m_header->blobSize;
+    });
+    if (!validSlots) {
+        qWarning() << "Invalid translation bundle" << fileName;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void CBundle::close()
+{
+    if (m_data)
+        m_file.unmap(const_cast<uchar *>(m_data));
+    m_file.close();
+    m_data = nullptr;
+    m_header = nullptr;
+    m_displacements = nullptr;
+    m_slots = nullptr;
+    m_blob = nullptr;
+}
+
+CAtlas::AtlasDirection CBundle::direction() const
+{
+    if (m_header == nullptr)
+        return CAtlas::Atlas_Auto;
+    return static_cast<CAtlas::AtlasDirection>(m_header->direction);
+}
+
+int CBundle::count() const
+{
+    if (m_header == nullptr)
+        return 0;
+    return static_cast<int>(m_header->count);
+}
+
+bool CBundle::lookup(const QByteArray &key, QString &value) const
+{
+    if (m_header == nullptr || m_header->count == 0) return false;
+
+    const quint64 hash = fnvHash64(key.constData(),key.size(),m_header->seed);
+    const quint32 bucket = static_cast<quint32>(hash >> 32) % m_header->bucketCount;
+    const CSlot &slot = m_slots[slotIndex(hash,m_displacements[bucket],m_header->count)];
+
+    if (slot.keySize != static_cast<quint32>(key.size()) ||
+            std::memcmp(m_blob + slot.offset,key.constData(),key.size()) != 0)
+        return false;
+
+    value = QString::fromUtf8(m_blob + slot.offset + slot.keySize,static_cast<int>(slot.valueSize));
+    return true;
+}
+
+bool CBundle::compile(const QString &input, const QString &output,
+                      CAtlas::AtlasDirection direction, QString *errorString)
+{
+    auto fail = [errorString](const QString &msg){
+        if (errorString)
+            *errorString = msg;
+        return false;
+    };
+
+    QFile f(input);
+    if (!f.open(QIODevice::ReadOnly))
+        return fail(QSL("Unable to open %1").arg(input));
+
+    CCanonicalizer canonicalizer;
+    canonicalizer.loadSettings();
+
+    // Last translation wins for duplicated sources.
+    QVector<QByteArray> keys;
+    QVector<QByteArray> values;
+    QHash<QByteArray,int> keyIndex;
+    while (!f.atEnd()) {
+        QByteArray line = f.readLine();
+        while (line.endsWith('\n') || line.endsWith('\r'))
+            line.chop(1);
+        const int sep = line.indexOf('\t');
+        if (sep <= 0) continue;
+
+        QString source = QString::fromUtf8(line.left(sep)).trimmed();
+        canonicalizer.canonicalize(source);
+        const QByteArray key = source.trimmed().toUtf8();
+        const QByteArray value = QString::fromUtf8(line.mid(sep + 1)).trimmed().toUtf8();
+        if (key.isEmpty()) continue;
+
+        const auto it = keyIndex.constFind(key);
+        if (it != keyIndex.constEnd()) {
+            values[it.value()] = value;
+        } else {
+            keyIndex.insert(key,keys.count());
+            keys.append(key);
+            values.append(value);
+        }
+    }
+    f.close();
+
+    const quint32 count = static_cast<quint32>(keys.count());
+    const quint32 bucketCount = (count + keysPerBucket - 1) / keysPerBucket;
+
+    // Hash and displace: biggest buckets first, each bucket gets first
+    // displacement which puts all its keys into free slots.
+    QVector<quint32> displacements(static_cast<int>(bucketCount),0);
+    QVector<int> slotOwner(static_cast<int>(count),-1);
+    quint32 seed = 0;
+    bool built = (count == 0);
+    for (quint32 attempt = 0; attempt < maxSeedAttempts && !built; attempt++) {
+        seed = attempt;
+        QVector<quint64> hashes(keys.count());
+        QVector<QVector<int> > buckets(static_cast<int>(bucketCount));
+        for (int i = 0; i < keys.count(); i++) {
+            hashes[i] = fnvHash64(keys.at(i).constData(),keys.at(i).size(),seed);
+            buckets[static_cast<int>(static_cast<quint32>(hashes.at(i) >> 32) % bucketCount)].append(i);
+        }
+
+        QVector<int> order(buckets.count());
+        std::iota(order.begin(),order.end(),0);
+        std::stable_sort(order.begin(),order.end(),[&buckets](int a, int b){
+            return buckets.at(a).count() > buckets.at(b).count();
+        });
+
+        slotOwner.fill(-1);
+        built = true;
+        QVector<quint32> candidate;
+        for (const int b : qAsConst(order)) {
+            const QVector<int> &bucket = buckets.at(b);
+            if (bucket.isEmpty()) break;
+
+            bool placed = false;
+            for (quint32 d = 0; d < maxDisplacement && !placed; d++) {
+                candidate.clear();
+                placed = true;
+                for (const int key : bucket) {
+                    const quint32 slot = slotIndex(hashes.at(key),d,count);
+                    if (slotOwner.at(static_cast<int>(slot)) >= 0 || candidate.contains(slot)) {
+                        placed = false;
+                        break;
+                    }
+                    candidate.append(slot);
+                }
+                if (placed) {
+                    displacements[b] = d;
+                    for (int i = 0; i < bucket.count(); i++)
+                        slotOwner[static_cast<int>(candidate.at(i))] = bucket.at(i);
+                }
+            }
+            if (!placed) {
+                built = false;
+                break;
+            }
+        }
+    }
+    if (!built)
+        return fail(QSL("Unable to build perfect hash for %1 entries").arg(count));
+
+    CHeader header {};
+    header.magic = bundleMagic;
+    header.version = bundleVersion;
+    header.direction = static_cast<quint32>(direction);
+    header.count = count;
+    header.bucketCount = bucketCount;
+    header.seed = seed;
+
+    QVector<CSlot> table(static_cast<int>(count));
+    QByteArray blob;
+    for (int i = 0; i < slotOwner.count(); i++) {
+        const int key = slotOwner.at(i);
+        table[i].offset = static_cast<quint32>(blob.size());
+        table[i].keySize = static_cast<quint32>(keys.at(key).size());
+        table[i].valueSize = static_cast<quint32>(values.at(key).size());
+        blob.append(keys.at(key));
+        blob.append(values.at(key));
+    }
+    header.blobSize = static_cast<quint32>(blob.size());
+
+    QSaveFile out(output);
+    if (!out.open(QIODevice::WriteOnly))
+        return fail(QSL("Unable to create %1").arg(output));
+    out.write(reinterpret_cast<const char *>(&header),sizeof(header));
+    out.write(reinterpret_cast<const char *>(displacements.constData()),
+              static_cast<qint64>(displacements.count()) * sizeof(quint32));
+    out.write(reinterpret_cast<const char *>(table.constData()),
+              static_cast<qint64>(table.count()) * sizeof(CSlot));
+    out.write(blob);
+    if (!out.commit())
+        return fail(QSL("Unable to write %1").arg(output));
+
+    return true;
+}
+
+CBundleSet::CBundleSet(QObject *parent)
+    : QObject(parent)
+{
+}
+
+CBundleSet::~CBundleSet() = default;
+
+int CBundleSet::load(const QString &directory)
+{
+    m_bundles.clear();
+
+    const QDir dir(directory);
+    const QFileInfoList files = dir.entryInfoList({ QSL("*.atb") },QDir::Files | QDir::Readable,QDir::Name);
+    for (const auto &fi : files) {
+        QSharedPointer<CBundle> bundle(new CBundle());
+        if (!bundle->open(fi.filePath())) continue;
+
+        qInfo() << "Translation bundle loaded:" << fi.fileName() << bundle->count() << "entries";
+        m_bundles.append(bundle);
+    }
+
+    return m_bundles.count();
+}
+
+bool CBundleSet::isEmpty() const
+{
+    return m_bundles.isEmpty();
+}
+
+bool CBundleSet::lookup(CAtlas::AtlasDirection direction, const QString &key, QString &value) const
+{
+    if (m_bundles.isEmpty()) return false;
+
+    const QByteArray k = key.toUtf8();
+    return std::any_of(m_bundles.constBegin(),m_bundles.constEnd(),[direction,&k,&value](const QSharedPointer<CBundle> &bundle){
+        return (bundle->direction() == direction) && bundle->lookup(k,value);
+    });
+}
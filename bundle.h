@@ -0,0 +1,78 @@
+#ifndef CBUNDLE_H
+#define CBUNDLE_H
+
+#include <QObject>
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include <QSharedPointer>
+#include "atlas.h"
+
+// Immutable (source -> translation) table compiled for known game scripts.
+// File is mapped read-only, so it is shared between processes. Lookup is one
+// hash over the key, minimal perfect hash slot and one memcmp.
+class CBundle
+{
+public:
+    CBundle();
+    ~CBundle();
+
+    bool open(const QString &fileName);
+    void close();
+
+    CAtlas::AtlasDirection direction() const;
+    int count() const;
+    bool lookup(const QByteArray &key, QString &value) const;
+
+    // Input: UTF-8 lines "source<TAB>translation". Sources are canonicalized with
+    // configured rules, the same way translator input is before lookup.
+    static bool compile(const QString &input, const QString &output,
+                        CAtlas::AtlasDirection direction, QString *errorString = nullptr);
+
+private:
+    Q_DISABLE_COPY(CBundle)
+
+    struct CHeader {
+        quint32 magic;
+        quint32 version;
+        quint32 direction;
+        quint32 count;
+        quint32 bucketCount;
+        quint32 seed;
+        quint32 blobSize;
+        quint32 reserved;
+    };
+    struct CSlot {
+        quint32 offset; // key bytes, followed by value bytes
+        quint32 keySize;
+        quint32 valueSize;
+    };
+
+    QFile m_file;
+    const uchar *m_data { nullptr };
+    const CHeader *m_header { nullptr };
+    const quint32 *m_displacements { nullptr };
+    const CSlot *m_slots { nullptr };
+    const char *m_blob { nullptr };
+
+    static quint32 slotIndex(quint64 hash, quint32 displacement, quint32 count);
+};
+
+class CBundleSet : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CBundleSet)
+public:
+    explicit CBundleSet(QObject *parent = nullptr);
+    ~CBundleSet() override;
+
+    // Maps all *.atb files from directory.
+    int load(const QString &directory);
+    bool isEmpty() const;
+    bool lookup(CAtlas::AtlasDirection direction, const QString &key, QString &value) const;
+
+private:
+    QVector<QSharedPointer<CBundle> > m_bundles;
+};
+
+#endif // CBUNDLE_H
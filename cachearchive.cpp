@@ -0,0 +1,325 @@
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QHash>
+#include <QtEndian>
+#include <memory>
+#include <vector>
+#include "cachearchive.h"
+#include "hashutils.h"
+#include "qsl.h"
+
+namespace {
+const quint32 archiveMagic = 0x41435441; // ATCA
+const quint32 archiveVersion = 1;
+const quint32 trailerMark = 0xffffffff;
+const int headerSize = 24;
+const int recordHeaderSize = 12;
+const int trailerSize = recordHeaderSize + 8;
+const qint64 partitionBytes = 64 * 1024 * 1024;
+const int maxPartitions = 256;
+
+void setError(QString *errorString, const QString &message)
+{
+    if (errorString)
+        *errorString = message;
+}
+}
+
+bool CCacheArchiveWriter::open(const QString &fileName)
+{
+    m_count = 0;
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly)) return false;
+
+    uchar header[headerSize] {};
+    qToLittleEndian<quint32>(archiveMagic,header);
+    qToLittleEndian<quint32>(archiveVersion,header + 4);
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(),header + 8);
+    return (m_file.write(reinterpret_cast<const char *>(header),headerSize) == headerSize);
+}
+
+bool CCacheArchiveWriter::write(const QByteArray &key, const QByteArray &value)
+{
+    uchar header[recordHeaderSize] {};
+    qToLittleEndian<quint32>(static_cast<quint32>(key.size()),header);
+    qToLittleEndian<quint32>(static_cast<quint32>(value.size()),header + 4);
+    const quint16 crc = qChecksum(key.constData(),static_cast<uint>(key.size())) ^
+                        qChecksum(value.constData(),static_cast<uint>(value.size()));
+    qToLittleEndian<quint16>(crc,header + 8);
+
+    if (m_file.write(reinterpret_cast<const char *>(header),recordHeaderSize) != recordHeaderSize ||
+            m_file.write(key) != key.size() || m_file.write(value) != value.size())
+        return false;
+
+    m_count++;
+    return true;
+}
+
+bool CCacheArchiveWriter::commit()
+{
+    uchar trailer[trailerSize] {};
+    qToLittleEndian<quint32>(trailerMark,trailer);
+    qToLittleEndian<qint64>(m_count,trailer + recordHeaderSize);
+    if (m_file.write(reinterpret_cast<const char *>(trailer),trailerSize) != trailerSize) {
+        m_file.cancelWriting();
+        return false;
+    }
+    return m_file.commit();
+}
+
+qint64 CCacheArchiveWriter::count() const
+{
+    return m_count;
+}
+
+QString CCacheArchiveWriter::errorString() const
+{
+    return m_file.errorString();
+}
+
+bool CCacheArchiveReader::open(const QString &fileName)
+{
+    m_count = 0;
+    m_finished = false;
+    m_error.clear();
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_error = m_file.errorString();
+        return false;
+    }
+
+    uchar header[headerSize] {};
+    if (m_file.read(reinterpret_cast<char *>(header),headerSize) != headerSize ||
+            qFromLittleEndian<quint32>(header) != archiveMagic) {
+        m_error = QSL("%1 is not a cache archive").arg(fileName);
+        return false;
+    }
+    if (qFromLittleEndian<quint32>(header + 4) != archiveVersion) {
+        m_error = QSL("Unsupported cache archive version %1").arg(qFromLittleEndian<quint32>(header + 4));
+        return false;
+    }
+    m_created = qFromLittleEndian<qint64>(header + 8);
+    return true;
+}
+
+bool CCacheArchiveReader::next(QByteArray &key, QByteArray &value)
+{
+    if (m_finished || !m_error.isEmpty() || !m_file.isOpen()) return false;
+
+    uchar header[recordHeaderSize] {};
+    if (m_file.read(reinterpret_cast<char *>(header),recordHeaderSize) != recordHeaderSize) {
+        m_error = QSL("Cache archive is truncated");
+        return false;
+    }
+
+    const quint32 keySize = qFromLittleEndian<quint32>(header);
+    if (keySize == trailerMark) {
+        uchar trailer[8] {};
+        m_finished = true;
+        if (m_file.read(reinterpret_cast<char *>(trailer),8) != 8 ||
+                qFromLittleEndian<qint64>(trailer) != m_count)
+            m_error = QSL("Cache archive record count mismatch");
+        return false;
+    }
+
+    const quint32 valueSize = qFromLittleEndian<quint32>(header + 4);
+    if (static_cast<qint64>(keySize) + valueSize > m_file.size() - m_file.pos()) {
+        m_error = QSL("Cache archive is truncated");
+        return false;
+    }
+
+    key = m_file.read(keySize);
+    value = m_file.read(valueSize);
+    const quint16 crc = qChecksum(key.constData(),static_cast<uint>(key.size())) ^
+                        qChecksum(value.constData(),static_cast<uint>(value.size()));
+    if (key.size() != static_cast<int>(keySize) || value.size() != static_cast<int>(valueSize) ||
+            crc != qFromLittleEndian<quint16>(header + 8)) {
+        m_error = QSL("Cache archive record %1 is corrupted").arg(m_count);
+        return false;
+    }
+
+    m_count++;
+    return true;
+}
+
+bool CCacheArchiveReader::hasError() const
+{
+    return !m_error.isEmpty();
+}
+
+QString CCacheArchiveReader::errorString() const
+{
+    return m_error;
+}
+
+qint64 CCacheArchiveReader::count() const
+{
+    return m_count;
+}
+
+qint64 CCacheArchiveReader::created() const
+{
+    return m_created;
+}
+
+qint64 CCacheArchiveReader::size() const
+{
+    return m_file.size();
+}
+
+bool CCacheFilter::matches(const QByteArray &key) const
+{
+    // Key prefix: direction|version|environment|
+    const int dirEnd = key.indexOf('|');
+    const int versionEnd = key.indexOf('|',dirEnd + 1);
+    const int envEnd = key.indexOf('|',versionEnd + 1);
+    if (dirEnd < 0 || versionEnd < 0 || envEnd < 0) return false;
+
+    if (direction != CAtlas::Atlas_Auto && key.left(dirEnd).toInt() != static_cast<int>(direction))
+        return false;
+    if (version >= 0 && key.mid(dirEnd + 1,versionEnd - dirEnd - 1).toInt() != version)
+        return false;
+    if (!environment.isEmpty() &&
+            QString::fromUtf8(key.mid(versionEnd + 1,envEnd - versionEnd - 1)) != environment)
+        return false;
+
+    return true;
+}
+
+bool CCacheArchive::filter(const QString &input, const QString &output, const CCacheFilter &filter,
+                           qint64 *written, QString *errorString)
+{
+    CCacheArchiveReader reader;
+    if (!reader.open(input)) {
+        setError(errorString,reader.errorString());
+        return false;
+    }
+
+    CCacheArchiveWriter writer;
+    if (!writer.open(output)) {
+        setError(errorString,writer.errorString());
+        return false;
+    }
+
+    QByteArray key;
+    QByteArray value;
+    while (reader.next(key,value)) {
+        if (filter.matches(key) && !writer.write(key,value)) {
+            setError(errorString,writer.errorString());
+            return false;
+        }
+    }
+    if (reader.hasError()) {
+        setError(errorString,reader.errorString());
+        return false;
+    }
+
+    if (written)
+        *written = writer.count();
+    if (!writer.commit()) {
+        setError(errorString,writer.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool CCacheArchive::merge(const QStringList &inputs, const QString &output, ConflictRule rule,
+                          qint64 *written, QString *errorString)
+{
+    qint64 totalSize = 0;
+    for (const QString &input : inputs)
+        totalSize += QFileInfo(input).size();
+    const int partitions = static_cast<int>(qBound<qint64>(1,totalSize / partitionBytes + 1,maxPartitions));
+
+    QTemporaryDir tempDir(QFileInfo(output).absoluteDir().filePath(QSL("merge-XXXXXX")));
+    if (!tempDir.isValid()) {
+        setError(errorString,QSL("Unable to create temporary directory"));
+        return false;
+    }
+
+    // Pass 1: spread entries to partitions by key hash, keeping input order.
+    std::vector<std::unique_ptr<CCacheArchiveWriter> > parts;
+    for (int i = 0; i < partitions; i++) {
+        parts.emplace_back(new CCacheArchiveWriter());
+        if (!parts.back()->open(tempDir.filePath(QSL("part%1").arg(i)))) {
+            setError(errorString,parts.back()->errorString());
+            return false;
+        }
+    }
+
+    QByteArray key;
+    QByteArray value;
+    for (const QString &input : inputs) {
+        CCacheArchiveReader reader;
+        if (!reader.open(input)) {
+            setError(errorString,reader.errorString());
+            return false;
+        }
+        while (reader.next(key,value)) {
+            const quint64 hash = fnvHash64(key.constData(),key.size());
+            if (!parts.at(hash % static_cast<quint64>(partitions))->write(key,value)) {
+                setError(errorString,QSL("Unable to write temporary partition"));
+                return false;
+            }
+        }
+        if (reader.hasError()) {
+            setError(errorString,QSL("%1: %2").arg(input,reader.errorString()));
+            return false;
+        }
+    }
+    for (auto &part : parts) {
+        if (!part->commit()) {
+            setError(errorString,part->errorString());
+            return false;
+        }
+    }
+    parts.clear();
+
+    // Pass 2: each partition fits in memory, resolve duplicates there.
+    CCacheArchiveWriter writer;
+    if (!writer.open(output)) {
+        setError(errorString,writer.errorString());
+        return false;
+    }
+
+    for (int i = 0; i < partitions; i++) {
+        CCacheArchiveReader reader;
+        if (!reader.open(tempDir.filePath(QSL("part%1").arg(i)))) {
+            setError(errorString,reader.errorString());
+            return false;
+        }
+
+        QHash<QByteArray,QByteArray> entries;
+        QVector<QByteArray> order;
+        while (reader.next(key,value)) {
+            auto it = entries.find(key);
+            if (it == entries.end()) {
+                entries.insert(key,value);
+                order.append(key);
+            } else if (rule == Conflict_KeepLast) {
+                it.value() = value;
+            }
+        }
+        if (reader.hasError()) {
+            setError(errorString,reader.errorString());
+            return false;
+        }
+
+        for (const QByteArray &k : qAsConst(order)) {
+            if (!writer.write(k,entries.value(k))) {
+                setError(errorString,writer.errorString());
+                return false;
+            }
+        }
+    }
+
+    if (written)
+        *written = writer.count();
+    if (!writer.commit()) {
+        setError(errorString,writer.errorString());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef CCACHEARCHIVE_H
+#define CCACHEARCHIVE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QSaveFile>
+#include <QString>
+#include <QStringList>
+#include "atlas.h"
+
+// Portable stream of cache entries for moving translations between nodes.
+// Header, then "key size, value size, checksum, key, value" records, then
+// trailer with record count, all little-endian. Keys are CResultCache keys
+// in UTF-8, so entries keep ATLAS version and environment they came from.
+class CCacheArchiveWriter
+{
+public:
+    CCacheArchiveWriter() = default;
+
+    bool open(const QString &fileName);
+    bool write(const QByteArray &key, const QByteArray &value);
+    // Writes trailer and atomically replaces target file.
+    bool commit();
+
+    qint64 count() const;
+    QString errorString() const;
+
+private:
+    Q_DISABLE_COPY(CCacheArchiveWriter)
+    QSaveFile m_file;
+    qint64 m_count { 0 };
+};
+
+class CCacheArchiveReader
+{
+public:
+    CCacheArchiveReader() = default;
+
+    bool open(const QString &fileName);
+    // Returns false at the end of archive or on error, check hasError().
+    bool next(QByteArray &key, QByteArray &value);
+
+    bool hasError() const;
+    QString errorString() const;
+    qint64 count() const;
+    qint64 created() const;
+    qint64 size() const;
+
+private:
+    Q_DISABLE_COPY(CCacheArchiveReader)
+    QFile m_file;
+    qint64 m_count { 0 };
+    qint64 m_created { 0 };
+    bool m_finished { false };
+    QString m_error;
+};
+
+// Entry filter for pruning archives, empty fields match anything.
+struct CCacheFilter {
+    CAtlas::AtlasDirection direction { CAtlas::Atlas_Auto };
+    int version { -1 };
+    QString environment;
+
+    bool matches(const QByteArray &key) const;
+};
+
+class CCacheArchive
+{
+public:
+    enum ConflictRule {
+        Conflict_KeepFirst,
+        Conflict_KeepLast
+    };
+
+    // Duplicate keys are resolved by rule, memory use is bounded by
+    // partitioning input through temporary files.
+    static bool merge(const QStringList &inputs, const QString &output, ConflictRule rule,
+                      qint64 *written = nullptr, QString *errorString = nullptr);
+    static bool filter(const QString &input, const QString &output, const CCacheFilter &filter,
+                       qint64 *written = nullptr, QString *errorString = nullptr);
+};
+
+#endif // CCACHEARCHIVE_H
@@ -0,0 +1,175 @@
+#include <QSettings>
+#include "canonicalizer.h"
+#include "qsl.h"
+
+CCanonicalizer::CCanonicalizer() = default;
+
+void CCanonicalizer::loadSettings()
+{
+    QSettings settings;
+    settings.beginGroup(QSL("Canonicalization"));
+    Rules rules = Rule_None;
+    if (settings.value(QSL("widthFolding"),true).toBool())
+        rules |= Rule_Width;
+    if (settings.value(QSL("whitespace"),true).toBool())
+        rules |= Rule_Whitespace;
+    if (settings.value(QSL("ellipsis"),true).toBool())
+        rules |= Rule_Ellipsis;
+    if (settings.value(QSL("brackets"),true).toBool())
+        rules |= Rule_Brackets;
+    settings.endGroup();
+
+    m_rules = rules;
+}
+
+CCanonicalizer::Rules CCanonicalizer::rules() const
+{
+    return m_rules;
+}
+
+void CCanonicalizer::setRules(Rules rules)
+{
+    m_rules = rules;
+}
+
+CCanonicalizer::Rules CCanonicalizer::canonicalize(QString &str) const
+{
+    Rules res = Rule_None;
+    if (m_rules.testFlag(Rule_Width) && foldWidth(str))
+        res |= Rule_Width;
+    if (m_rules.testFlag(Rule_Whitespace) && normalizeWhitespace(str))
+        res |= Rule_Whitespace;
+    if (m_rules.testFlag(Rule_Ellipsis) && normalizeEllipsis(str))
+        res |= Rule_Ellipsis;
+    return res;
+}
+
+bool CCanonicalizer::foldWidth(QString &str)
+{
+    // Full-width ASCII letters and digits to ASCII, half-width katakana to full-width.
+    // Punctuation is not folded, sentence segmentation depends on it.
+    bool changed = false;
+    QString res;
+    res.reserve(str.length());
+    int pos = 0;
+    while (pos < str.length()) {
+        const ushort c = str.at(pos).unicode();
+        if ((c >= 0xff10 && c <= 0xff19) || (c >= 0xff21 && c <= 0xff3a) || (c >= 0xff41 && c <= 0xff5a)) {
+            res.append(QChar(c - 0xfee0));
+            changed = true;
+            pos++;
+
+        } else if (c >= 0xff61 && c <= 0xff9f) {
+            int end = pos + 1;
+            while (end < str.length() && str.at(end).unicode() >= 0xff61 && str.at(end).unicode() <= 0xff9f)
+                end++;
+            res.append(str.mid(pos,end - pos).normalized(QString::NormalizationForm_KC));
+            changed = true;
+            pos = end;
+
+        } else {
+            res.append(str.at(pos));
+            pos++;
+        }
+    }
+
+    if (changed)
+        str = res;
+    return changed;
+}
+
+bool CCanonicalizer::normalizeWhitespace(QString &str)
+{
+    // Collapse horizontal whitespace, trim lines, keep line breaks.
+    QString res;
+    res.reserve(str.length());
+    bool pendingSpace = false;
+    for (const QChar c : qAsConst(str)) {
+        if (c == QChar('\n')) {
+            pendingSpace = false;
+            res.append(c);
+        } else if (c.isSpace()) {
+            pendingSpace = !res.isEmpty() && (res.at(res.length() - 1) != QChar('\n'));
+        } else {
+            if (pendingSpace)
+                res.append(QChar(' '));
+            pendingSpace = false;
+            res.append(c);
+        }
+    }
+
+    if (res == str) return false;
+
+    str = res;
+    return true;
+}
+
+bool CCanonicalizer::normalizeEllipsis(QString &str)
+{
+    // Runs of "・・", "...", "。。。", "……" and "‥" become single "…".
+    QString res;
+    res.reserve(str.length());
+    bool changed = false;
+    int pos = 0;
+    while (pos < str.length()) {
+        const ushort c = str.at(pos).unicode();
+        int minRun = 0;
+        switch (c) {
+            case 0x30fb: minRun = 2; break; // ・
+            case '.': minRun = 3; break;
+            case 0x3002: minRun = 3; break; // 。
+            case 0x2026: minRun = 1; break; // …
+            case 0x2025: minRun = 1; break; // ‥
+            default: break;
+        }
+
+        int end = pos + 1;
+        if (minRun > 0) {
+            while (end < str.length()) {
+                const ushort e = str.at(end).unicode();
+                if (e == c || ((c == 0x2026 || c == 0x2025) && (e == 0x2026 || e == 0x2025))) {
+                    end++;
+                } else {
+                    break;
+                }
+            }
+        }
+
+        if (minRun > 0 && (end - pos) >= minRun) {
+            res.append(QChar(0x2026));
+            if ((end - pos) != 1 || c != 0x2026)
+                changed = true;
+        } else {
+            res.append(str.midRef(pos,end - pos));
+        }
+        pos = end;
+    }
+
+    if (changed)
+        str = res;
+    return changed;
+}
+
+bool CCanonicalizer::stripWrapper(QString &str, QChar &open, QChar &close) const
+{
+    static const QString openers(QSL("「『（(“【"));
+    static const QString closers(QSL("」』）)”】"));
+
+    if (!m_rules.testFlag(Rule_Brackets)) return false;
+    if (str.length() < 3) return false;
+
+    const int idx = openers.indexOf(str.at(0));
+    if (idx < 0 || str.at(str.length() - 1) != closers.at(idx)) return false;
+
+    // Only single pair around whole text, like 「...」, not 「...」...「...」.
+    const QStringRef inner = str.midRef(1,str.length() - 2);
+    if (inner.contains(openers.at(idx)) || inner.contains(closers.at(idx))) return false;
+
+    const QString text = inner.toString().trimmed();
+    if (text.isEmpty()) return false;
+
+    open = openers.at(idx);
+    close = closers.at(idx);
+    str = text;
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef CCANONICALIZER_H
+#define CCANONICALIZER_H
+
+#include <QString>
+#include <QFlags>
+
+class CCanonicalizer
+{
+public:
+    enum Rule {
+        Rule_None = 0,
+        Rule_Width = 1,
+        Rule_Whitespace = 2,
+        Rule_Ellipsis = 4,
+        Rule_Brackets = 8
+    };
+    Q_DECLARE_FLAGS(Rules, Rule)
+
+    CCanonicalizer();
+
+    void loadSettings();
+    Rules rules() const;
+    void setRules(Rules rules);
+
+    // Width folding, whitespace and ellipsis normalization.
+    // Returns rules that actually changed the text.
+    Rules canonicalize(QString &str) const;
+    // Removes one pair of brackets wrapping whole text, to be restored after translation.
+    bool stripWrapper(QString &str, QChar &open, QChar &close) const;
+
+private:
+    Rules m_rules { Rule_Width | Rule_Whitespace | Rule_Ellipsis | Rule_Brackets };
+
+    static bool foldWidth(QString &str);
+    static bool normalizeWhitespace(QString &str);
+    static bool normalizeEllipsis(QString &str);
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(CCanonicalizer::Rules)
+
+#endif // CCANONICALIZER_H
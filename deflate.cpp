@@ -0,0 +1,174 @@
+#include <QElapsedTimer>
+#include <QtZlib/zlib.h>
+#include "deflate.h"
+
+namespace {
+const int rawWindowBits = -15;
+const int memoryLevel = 8;
+}
+
+bool CDeflate::compress(const QByteArray &data, const QByteArray &dictionary, QByteArray &result,
+                        int level)
+{
+    z_stream stream {};
+    if (deflateInit2(&stream,level,Z_DEFLATED,rawWindowBits,memoryLevel,Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    bool res = true;
+    if (!dictionary.isEmpty()) {
+        res = (deflateSetDictionary(&stream,reinterpret_cast<const Bytef *>(dictionary.constData()),
+                                    static_cast<uInt>(qMin(dictionary.size(),maxDictionarySize))) == Z_OK);
+    }
+
+    if (res) {
+        result.resize(static_cast<int>(deflateBound(&stream,static_cast<uLong>(data.size()))));
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+        stream.avail_in = static_cast<uInt>(data.size());
+        stream.next_out = reinterpret_cast<Bytef *>(result.data());
+        stream.avail_out = static_cast<uInt>(result.size());
+        res = (deflate(&stream,Z_FINISH) == Z_STREAM_END);
+        result.resize(static_cast<int>(stream.total_out));
+    }
+
+    deflateEnd(&stream);
+    return res;
+}
+
+bool CDeflate::decompress(const char *data, int size, const QByteArray &dictionary, int rawSize,
+                          QByteArray &result)
+{
+    z_stream stream {};
+    if (inflateInit2(&stream,rawWindowBits) != Z_OK)
+        return false;
+
+    bool res = true;
+    if (!dictionary.isEmpty()) {
+        res = (inflateSetDictionary(&stream,reinterpret_cast<const Bytef *>(dictionary.constData()),
+                                    static_cast<uInt>(qMin(dictionary.size(),maxDictionarySize))) == Z_OK);
+    }
+
+    if (res) {
+        result.resize(rawSize);
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        stream.avail_in = static_cast<uInt>(size);
+        stream.next_out = reinterpret_cast<Bytef *>(result.data());
+        stream.avail_out = static_cast<uInt>(rawSize);
+        res = (inflate(&stream,Z_FINISH) == Z_STREAM_END) &&
+              (stream.total_out == static_cast<uLong>(rawSize));
+    }
+
+    inflateEnd(&stream);
+    return res;
+}
+
+namespace {
+const char syncFlushTail[] = { '\x00', '\x00', '\xff', '\xff' };
+const int syncFlushTailSize = 4;
+const int streamChunkSize = 16 * 1024;
+}
+
+struct CDeflateStream::CState {
+    z_stream stream {};
+};
+
+CDeflateStream::CDeflateStream(Mode mode, int level)
+    : m_state(new CState()),
+      m_mode(mode)
+{
+    if (m_mode == Mode_Compress) {
+        m_valid = (deflateInit2(&m_state->stream,level,Z_DEFLATED,rawWindowBits,memoryLevel,
+                                Z_DEFAULT_STRATEGY) == Z_OK);
+    } else {
+        m_valid = (inflateInit2(&m_state->stream,rawWindowBits) == Z_OK);
+    }
+}
+
+CDeflateStream::~CDeflateStream()
+{
+    if (m_mode == Mode_Compress) {
+        deflateEnd(&m_state->stream);
+    } else {
+        inflateEnd(&m_state->stream);
+    }
+}
+
+bool CDeflateStream::isValid() const
+{
+    return m_valid;
+}
+
+bool CDeflateStream::process(const QByteArray &data, QByteArray &result, int maxSize)
+{
+    if (!m_valid) return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    if (m_mode == Mode_Compress) {
+        m_valid = compress(data,result);
+        m_rawBytes += data.size();
+        m_packedBytes += result.size();
+    } else {
+        m_valid = decompress(data,result,maxSize);
+        m_rawBytes += result.size();
+        m_packedBytes += data.size();
+    }
+    m_nsecs += timer.nsecsElapsed();
+    return m_valid;
+}
+
+void CDeflateStream::takeCounters(qint64 &rawBytes, qint64 &packedBytes, qint64 &nsecs)
+{
+    rawBytes += m_rawBytes;
+    packedBytes += m_packedBytes;
+    nsecs += m_nsecs;
+    m_rawBytes = 0;
+    m_packedBytes = 0;
+    m_nsecs = 0;
+}
+
+bool CDeflateStream::compress(const QByteArray &data, QByteArray &result)
+{
+    z_stream &stream = m_state->stream;
+    result.resize(static_cast<int>(deflateBound(&stream,static_cast<uLong>(data.size()))) + 16);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    int written = 0;
+    for (;;) {
+        stream.next_out = reinterpret_cast<Bytef *>(result.data() + written);
+        stream.avail_out = static_cast<uInt>(result.size() - written);
+        const int ret = deflate(&stream,Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) return false;
+        written = result.size() - static_cast<int>(stream.avail_out);
+        if (stream.avail_out > 0) break;
+        result.resize(result.size() + streamChunkSize);
+    }
+
+    result.resize(written);
+    if (result.endsWith(QByteArray::fromRawData(syncFlushTail,syncFlushTailSize)))
+        result.chop(syncFlushTailSize);
+    return true;
+}
+
+bool CDeflateStream::decompress(const QByteArray &data, QByteArray &result, int maxSize)
+{
+    z_stream &stream = m_state->stream;
+    const QByteArray input = data + QByteArray::fromRawData(syncFlushTail,syncFlushTailSize);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.constData()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    result.resize(qMin(maxSize,qMax(streamChunkSize,data.size() * 4)));
+    int written = 0;
+    for (;;) {
+        stream.next_out = reinterpret_cast<Bytef *>(result.data() + written);
+        stream.avail_out = static_cast<uInt>(result.size() - written);
+        const int ret = inflate(&stream,Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) return false;
+        written = result.size() - static_cast<int>(stream.avail_out);
+        if (stream.avail_in == 0 && stream.avail_out > 0) break;
+        // Output limit guards against decompression bombs.
+        if (result.size() >= maxSize) return false;
+        result.resize(qMin(maxSize,result.size() * 2));
+    }
+
+    result.resize(written);
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef CDEFLATE_H
+#define CDEFLATE_H
+
+#include <QByteArray>
+#include <QScopedPointer>
+
+// Raw deflate streams (no zlib header) with optional preset dictionary.
+// Short strings compress only with dictionary of typical content.
+class CDeflate
+{
+public:
+    static const int maxDictionarySize = 32 * 1024;
+
+    static bool compress(const QByteArray &data, const QByteArray &dictionary, QByteArray &result,
+                         int level = 6);
+    // Size of decompressed data must be known.
+    static bool decompress(const char *data, int size, const QByteArray &dictionary, int rawSize,
+                           QByteArray &result);
+};
+
+// Raw deflate stream kept for the whole connection. Each message is ended with
+// sync flush (trailing 00 00 ff ff is not sent), so it can be decoded on receive,
+// while later messages still refer to the window of earlier ones.
+// Messages must be decompressed in the order they were compressed.
+class CDeflateStream
+{
+public:
+    enum Mode {
+        Mode_Compress,
+        Mode_Decompress
+    };
+
+    explicit CDeflateStream(Mode mode, int level = 6);
+    ~CDeflateStream();
+
+    bool isValid() const;
+    // Stream is unusable after failure.
+    bool process(const QByteArray &data, QByteArray &result, int maxSize);
+
+    // Adds uncompressed and compressed bytes and CPU time since last call.
+    void takeCounters(qint64 &rawBytes, qint64 &packedBytes, qint64 &nsecs);
+
+private:
+    Q_DISABLE_COPY(CDeflateStream)
+    struct CState;
+    QScopedPointer<CState> m_state;
+    Mode m_mode;
+    bool m_valid { false };
+    qint64 m_rawBytes { 0 };
+    qint64 m_packedBytes { 0 };
+    qint64 m_nsecs { 0 };
+
+    bool compress(const QByteArray &data, QByteArray &result);
+    bool decompress(const QByteArray &data, QByteArray &result, int maxSize);
+};
+
+#endif // CDEFLATE_H
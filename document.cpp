@@ -0,0 +1,236 @@
+#include <QHash>
+#include "document.h"
+#include "segmenter.h"
+#include "bulk.h"
+
+CDocument::CDocument(const QString &id)
+    : m_id(id)
+{
+}
+
+QString CDocument::id() const
+{
+    return m_id;
+}
+
+int CDocument::revision() const
+{
+    return m_revision;
+}
+
+qint64 CDocument::bytes() const
+{
+    qint64 res = m_id.size();
+    for (const auto &sentence : m_sentences)
+        res += sentence.source.size() + sentence.translation.size();
+    for (const auto &output : m_outputs)
+        res += output.size();
+    for (const auto &output : m_deltaInserted)
+        res += output.size();
+    return res * static_cast<qint64>(sizeof(QChar));
+}
+
+void CDocument::clear()
+{
+    m_sentences.clear();
+    m_outputs.clear();
+    m_deltaInserted.clear();
+    m_deltaPrefix = 0;
+    m_deltaRemoved = 0;
+    m_hasDelta = false;
+    m_cleared = true;
+}
+
+bool CDocument::update(CTranslator *translator, CAtlas::AtlasDirection direction, const QString &text,
+                       const CTranslator::CancelCheck &canceled)
+{
+    if (translator == nullptr) return false;
+
+    // Translations of previous revision, reusable only with the same direction.
+    QHash<QString,QString> known;
+    if (direction == m_direction) {
+        for (const auto &sentence : qAsConst(m_sentences)) {
+            if (sentence.translatable)
+                known.insert(sentence.source,sentence.translation);
+        }
+    }
+
+    const QVector<CTextSegment> segments = CSegmenter::split(text);
+    QVector<CSentence> sentences;
+    sentences.reserve(segments.count());
+    QVector<int> changed;
+    QVector<CAtlas::AtlasDirection> directions;
+    QStringList items;
+    int reused = 0;
+    for (const auto &segment : segments) {
+        CSentence sentence;
+        sentence.source = segment.text;
+        sentence.translatable = segment.translatable;
+        if (!segment.translatable) {
+            sentence.translation = segment.text;
+            sentences.append(sentence);
+            continue;
+        }
+
+        sentence.direction = translator->resolveDirection(direction,segment.text);
+        const auto it = known.constFind(segment.text);
+        if (it != known.constEnd()) {
+            sentence.translation = it.value();
+            reused++;
+        } else {
+            changed.append(sentences.count());
+            directions.append(sentence.direction);
+            items.append(segment.text);
+        }
+        sentences.append(sentence);
+    }
+
+    // Changed sentences share engine calls, as TR: segments do.
+    if (!items.isEmpty()) {
+        CBulkTranslator bulk(translator,nullptr);
+        bulk.setCancelCheck(canceled);
+        QStringList results;
+        if (!bulk.translateItems(directions,items,results)) return false;
+        for (int i = 0; i < changed.count(); i++)
+            sentences[changed.at(i)].translation = results.at(i);
+    }
+    const int translated = changed.count();
+
+    // Same joining rule as CTranslator::translate: Japanese output sentences need spaces.
+    QStringList outputs;
+    outputs.reserve(sentences.count());
+    bool prevTranslated = false;
+    for (const auto &sentence : qAsConst(sentences)) {
+        QString output;
+        if (sentence.translatable) {
+            if (prevTranslated && sentence.direction == CAtlas::Atlas_JE)
+                output.append(QChar(' '));
+            prevTranslated = true;
+        } else {
+            prevTranslated = false;
+        }
+        output.append(sentence.translation);
+        outputs.append(output);
+    }
+
+    const int common = qMin(outputs.count(),m_outputs.count());
+    int prefix = 0;
+    while (prefix < common && outputs.at(prefix) == m_outputs.at(prefix))
+        prefix++;
+    int suffix = 0;
+    while (suffix < common - prefix &&
+           outputs.at(outputs.count() - suffix - 1) == m_outputs.at(m_outputs.count() - suffix - 1))
+        suffix++;
+
+    m_hasDelta = (m_revision > 0 && !m_cleared);
+    m_cleared = false;
+    m_deltaPrefix = prefix;
+    m_deltaRemoved = m_outputs.count() - prefix - suffix;
+    m_deltaInserted = outputs.mid(prefix,outputs.count() - prefix - suffix);
+
+    m_direction = direction;
+    m_sentences = sentences;
+    m_outputs = outputs;
+    m_reused = reused;
+    m_translated = translated;
+    m_revision++;
+    return true;
+}
+
+QString CDocument::result() const
+{
+    return m_outputs.join(QString());
+}
+
+int CDocument::reused() const
+{
+    return m_reused;
+}
+
+int CDocument::translated() const
+{
+    return m_translated;
+}
+
+bool CDocument::hasDelta() const
+{
+    return m_hasDelta;
+}
+
+int CDocument::deltaPrefix() const
+{
+    return m_deltaPrefix;
+}
+
+int CDocument::deltaRemoved() const
+{
+    return m_deltaRemoved;
+}
+
+QStringList CDocument::deltaInserted() const
+{
+    return m_deltaInserted;
+}
+
+QSharedPointer<CDocument> CDocumentSession::open(const QString &id)
+{
+    for (int i = 0; i < m_documents.count(); i++) {
+        if (m_documents.at(i)->id() == id) {
+            m_documents.move(i,0);
+            m_current = m_documents.first();
+            return m_current;
+        }
+    }
+
+    m_current = QSharedPointer<CDocument>::create(id);
+    m_documents.prepend(m_current);
+    return m_current;
+}
+
+void CDocumentSession::close()
+{
+    m_current.clear();
+}
+
+QSharedPointer<CDocument> CDocumentSession::current() const
+{
+    return m_current;
+}
+
+bool CDocumentSession::deltaReplies() const
+{
+    return m_deltaReplies;
+}
+
+void CDocumentSession::setDeltaReplies(bool enabled)
+{
+    m_deltaReplies = enabled;
+}
+
+void CDocumentSession::setMaxBytes(qint64 maxBytes)
+{
+    m_maxBytes = maxBytes;
+}
+
+int CDocumentSession::trim()
+{
+    qint64 total = 0;
+    for (const auto &document : qAsConst(m_documents))
+        total += document->bytes();
+
+    int res = 0;
+    while (!m_documents.isEmpty() &&
+           (total > m_maxBytes || m_documents.count() > CDefaults::documentSessionMaxDocuments)) {
+        QSharedPointer<CDocument> document = m_documents.takeLast();
+        total -= document->bytes();
+        res++;
+        if (document == m_current) {
+            // Current document keeps its ID, but next revision is translated in full.
+            document->clear();
+            m_documents.prepend(document);
+            total += document->bytes();
+            if (m_documents.count() == 1) break;
+        }
+    }
+    return res;
+}
@@ -0,0 +1,95 @@
+#ifndef CDOCUMENT_H
+#define CDOCUMENT_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QSharedPointer>
+#include "atlas.h"
+#include "translator.h"
+
+namespace CDefaults {
+const int documentSessionMaxBytes = 4 * 1024 * 1024;
+const int documentSessionMaxDocuments = 16;
+}
+
+// Document revised by editor client. Keeps segmented source and translation
+// of the last revision, so next revision translates only changed sentences.
+// Result is kept as per-segment output strings (with separating spaces),
+// delta between revisions is computed on them.
+class CDocument
+{
+public:
+    explicit CDocument(const QString &id);
+
+    QString id() const;
+    int revision() const;
+    qint64 bytes() const;
+    // Drops stored revision, next update translates everything.
+    void clear();
+
+    // Not thread-safe, connection runs one update at a time.
+    bool update(CTranslator *translator, CAtlas::AtlasDirection direction, const QString &text,
+                const CTranslator::CancelCheck &canceled = CTranslator::CancelCheck());
+
+    QString result() const;
+    int reused() const;
+    int translated() const;
+
+    // Last update changed outputs: [prefix, prefix + removed) replaced with inserted.
+    // Not available for first revision and after clear(), client needs full result then.
+    bool hasDelta() const;
+    int deltaPrefix() const;
+    int deltaRemoved() const;
+    QStringList deltaInserted() const;
+
+private:
+    struct CSentence {
+        QString source;
+        QString translation;
+        bool translatable { false };
+        CAtlas::AtlasDirection direction { CAtlas::Atlas_Auto };
+    };
+
+    QString m_id;
+    int m_revision { 0 };
+    CAtlas::AtlasDirection m_direction { CAtlas::Atlas_Auto };
+    QVector<CSentence> m_sentences;
+    QStringList m_outputs;
+    int m_reused { 0 };
+    int m_translated { 0 };
+    bool m_hasDelta { false };
+    bool m_cleared { false };
+    int m_deltaPrefix { 0 };
+    int m_deltaRemoved { 0 };
+    QStringList m_deltaInserted;
+};
+
+// Documents of one connection, least recently used ones are evicted over
+// memory and count limits.
+class CDocumentSession
+{
+public:
+    CDocumentSession() = default;
+
+    QSharedPointer<CDocument> open(const QString &id);
+    void close();
+    QSharedPointer<CDocument> current() const;
+
+    bool deltaReplies() const;
+    void setDeltaReplies(bool enabled);
+    void setMaxBytes(qint64 maxBytes);
+
+    // Returns number of evicted documents.
+    int trim();
+
+private:
+    Q_DISABLE_COPY(CDocumentSession)
+    QList<QSharedPointer<CDocument> > m_documents; // most recently used first
+    QSharedPointer<CDocument> m_current;
+    qint64 m_maxBytes { CDefaults::documentSessionMaxBytes };
+    bool m_deltaReplies { false };
+};
+
+#endif // CDOCUMENT_H
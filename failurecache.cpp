@@ -0,0 +1,145 @@
+#include <QMutexLocker>
+#include <QDebug>
+#include "failurecache.h"
+#include "hashutils.h"
+#include "qsl.h"
+
+CFailureCache::CFailureCache()
+{
+    m_clock.start();
+}
+
+void CFailureCache::configure(int ttlSecs, int quarantineCount, int quarantineLatencyMs)
+{
+    QMutexLocker locker(&m_mutex);
+    m_ttl = ttlSecs;
+    m_quarantineCount = quarantineCount;
+    m_quarantineLatency = quarantineLatencyMs;
+}
+
+quint64 CFailureCache::keyHash(const QString &key)
+{
+    const QByteArray k = key.toUtf8();
+    return fnvHash64(k.constData(),k.size());
+}
+
+CFailureCache::CEntry &CFailureCache::entry(const QString &key, const QString &text)
+{
+    if (m_entries.count() >= CDefaults::failureCacheMaxEntries)
+        prune();
+
+    CEntry &res = m_entries[keyHash(key)];
+    if (res.text.isEmpty())
+        res.text = text.left(CDefaults::failureTextPreview);
+    return res;
+}
+
+void CFailureCache::quarantineEntry(CEntry &entry, const char *reason)
+{
+    if (entry.quarantined) return;
+
+    entry.quarantined = true;
+    m_quarantined++;
+    qWarning() << "Input quarantined," << reason << ":" << entry.text;
+}
+
+void CFailureCache::prune()
+{
+    // Expired entries go first, then the oldest non-quarantined ones.
+    const qint64 now = m_clock.elapsed();
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (!it.value().quarantined && it.value().expires <= now) {
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    while (m_entries.count() >= CDefaults::failureCacheMaxEntries) {
+        auto oldest = m_entries.end();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (!it.value().quarantined && (oldest == m_entries.end() || it.value().expires < oldest.value().expires))
+                oldest = it;
+        }
+        if (oldest == m_entries.end()) break;
+        m_entries.erase(oldest);
+    }
+}
+
+bool CFailureCache::isBlocked(const QString &key)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_entries.isEmpty()) return false;
+
+    const auto it = m_entries.constFind(keyHash(key));
+    if (it == m_entries.constEnd()) return false;
+
+    return (it.value().quarantined || it.value().expires > m_clock.elapsed());
+}
+
+void CFailureCache::recordFailure(const QString &key, const QString &text)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_ttl <= 0 && m_quarantineCount <= 0) return;
+
+    CEntry &e = entry(key,text);
+    e.failures++;
+    e.expires = m_clock.elapsed() + static_cast<qint64>(m_ttl) * 1000;
+    if (m_quarantineCount > 0 && e.failures >= m_quarantineCount)
+        quarantineEntry(e,"repeated failures");
+}
+
+void CFailureCache::recordLatency(const QString &key, const QString &text, qint64 elapsedMs)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_quarantineLatency <= 0 || elapsedMs < m_quarantineLatency) return;
+
+    CEntry &e = entry(key,text);
+    e.latency = qMax(e.latency,elapsedMs);
+    quarantineEntry(e,"engine too slow");
+}
+
+QStringList CFailureCache::quarantine() const
+{
+    QMutexLocker locker(&m_mutex);
+    QStringList res;
+    for (auto it = m_entries.constBegin(), end = m_entries.constEnd(); it != end; ++it) {
+        if (!it.value().quarantined) continue;
+
+        QString text = it.value().text;
+        text.replace(QChar('\t'),QChar(' '));
+        text.replace(QChar('\n'),QChar(' '));
+        res.append(QSL("%1\t%2\t%3\t%4").arg(it.key(),16,16,QChar('0'))
+                   .arg(it.value().failures).arg(it.value().latency).arg(text));
+    }
+    res.sort();
+    return res;
+}
+
+bool CFailureCache::release(const QString &hash)
+{
+    bool ok = false;
+    const quint64 h = hash.toULongLong(&ok,16);
+    if (!ok) return false;
+
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_entries.find(h);
+    if (it == m_entries.end() || !it.value().quarantined) return false;
+
+    m_entries.erase(it);
+    m_quarantined--;
+    return true;
+}
+
+void CFailureCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+    m_quarantined = 0;
+}
+
+int CFailureCache::quarantined() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_quarantined;
+}
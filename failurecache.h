@@ -0,0 +1,65 @@
+#ifndef CFAILURECACHE_H
+#define CFAILURECACHE_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+
+namespace CDefaults {
+const int failureCacheTtl = 60; // seconds
+const int failureQuarantineCount = 3;
+const int failureQuarantineLatency = 10000; // ms
+const int failureCacheMaxEntries = 10000;
+const int failureTextPreview = 200;
+}
+
+// Remembers inputs the engine failed on, so client retries are refused
+// without engine calls for a while. Inputs failing repeatedly or taking
+// too long are quarantined until released by administrator.
+class CFailureCache
+{
+public:
+    CFailureCache();
+
+    void configure(int ttlSecs, int quarantineCount, int quarantineLatencyMs);
+
+    // Thread-safe. Key is result cache key of input.
+    bool isBlocked(const QString &key);
+    void recordFailure(const QString &key, const QString &text);
+    void recordLatency(const QString &key, const QString &text, qint64 elapsedMs);
+
+    // "hash<TAB>failures<TAB>latency ms<TAB>text" lines.
+    QStringList quarantine() const;
+    bool release(const QString &hash);
+    void clear();
+
+    int quarantined() const;
+
+private:
+    Q_DISABLE_COPY(CFailureCache)
+
+    struct CEntry {
+        QString text;
+        int failures { 0 };
+        qint64 latency { 0 };
+        qint64 expires { 0 };
+        bool quarantined { false };
+    };
+
+    mutable QMutex m_mutex;
+    QHash<quint64,CEntry> m_entries;
+    QElapsedTimer m_clock;
+    int m_ttl { CDefaults::failureCacheTtl };
+    int m_quarantineCount { CDefaults::failureQuarantineCount };
+    int m_quarantineLatency { CDefaults::failureQuarantineLatency };
+    int m_quarantined { 0 };
+
+    static quint64 keyHash(const QString &key);
+    CEntry &entry(const QString &key, const QString &text);
+    void quarantineEntry(CEntry &entry, const char *reason);
+    void prune();
+};
+
+#endif // CFAILURECACHE_H
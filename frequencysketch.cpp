@@ -0,0 +1,82 @@
+#include "frequencysketch.h"
+
+namespace {
+const quint64 rowSeeds[] = { 0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                             0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL };
+const int sampleFactor = 10;
+const int counterMax = 15;
+
+quint64 mix(quint64 x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+}
+
+void CFrequencySketch::resize(int expectedEntries)
+{
+    // Each 64-bit word keeps 16 counters.
+    int words = 1;
+    while (words * 4 < expectedEntries && words < (1 << 24))
+        words <<= 1;
+
+    m_table.fill(0,words);
+    m_mask = static_cast<quint64>(words - 1);
+    m_samplePeriod = qMax(expectedEntries,16) * sampleFactor;
+    m_additions = 0;
+}
+
+void CFrequencySketch::clear()
+{
+    m_table.fill(0);
+    m_additions = 0;
+}
+
+int CFrequencySketch::counterIndex(quint64 hash, int row, int &shift) const
+{
+    const quint64 h = mix(hash + rowSeeds[row]);
+    shift = static_cast<int>((h >> 60) & 15) * 4;
+    return static_cast<int>(h & m_mask);
+}
+
+void CFrequencySketch::increment(quint64 hash)
+{
+    if (m_table.isEmpty()) return;
+
+    bool added = false;
+    for (int row = 0; row < depth; row++) {
+        int shift = 0;
+        const int idx = counterIndex(hash,row,shift);
+        if (((m_table.at(idx) >> shift) & 15) < counterMax) {
+            m_table[idx] += (1ULL << shift);
+            added = true;
+        }
+    }
+
+    if (added && ++m_additions >= m_samplePeriod)
+        age();
+}
+
+int CFrequencySketch::frequency(quint64 hash) const
+{
+    if (m_table.isEmpty()) return 0;
+
+    int res = counterMax;
+    for (int row = 0; row < depth; row++) {
+        int shift = 0;
+        const int idx = counterIndex(hash,row,shift);
+        res = qMin(res,static_cast<int>((m_table.at(idx) >> shift) & 15));
+    }
+    return res;
+}
+
+void CFrequencySketch::age()
+{
+    for (quint64 &word : m_table)
+        word = (word >> 1) & 0x7777777777777777ULL;
+    m_additions /= 2;
+}
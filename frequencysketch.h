@@ -0,0 +1,32 @@
+#ifndef CFREQUENCYSKETCH_H
+#define CFREQUENCYSKETCH_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Count-min sketch of 4-bit counters, for cache admission decisions.
+// All counters are halved after sample period, so old popularity fades out.
+class CFrequencySketch
+{
+public:
+    CFrequencySketch() = default;
+
+    void resize(int expectedEntries);
+    void clear();
+
+    void increment(quint64 hash);
+    int frequency(quint64 hash) const;
+
+private:
+    static const int depth = 4;
+
+    QVector<quint64> m_table;
+    quint64 m_mask { 0 };
+    int m_additions { 0 };
+    int m_samplePeriod { 0 };
+
+    int counterIndex(quint64 hash, int row, int &shift) const;
+    void age();
+};
+
+#endif // CFREQUENCYSKETCH_H
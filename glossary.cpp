@@ -0,0 +1,196 @@
+#include <QFile>
+#include <QTextStream>
+#include <QQueue>
+#include <QDebug>
+#include <algorithm>
+#include <vector>
+#include "glossary.h"
+#include "qsl.h"
+
+CGlossary::CGlossary()
+{
+    m_nodes.append(CNode());
+}
+
+bool CGlossary::load(const QString &fileName)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly)) return false;
+
+    QStringList terms;
+    QStringList replacements;
+    QTextStream fs(&f);
+    fs.setCodec("UTF-8");
+    while (!fs.atEnd()) {
+        const QString line = fs.readLine();
+        if (line.startsWith(QChar('#'))) continue;
+
+        const int sep = line.indexOf(QChar('\t'));
+        const QString term = line.left(sep).trimmed();
+        if (term.isEmpty()) continue;
+
+        terms.append(term);
+        if (sep >= 0) {
+            replacements.append(line.mid(sep + 1).trimmed());
+        } else {
+            replacements.append(QString());
+        }
+    }
+
+    build(terms,replacements);
+    return true;
+}
+
+void CGlossary::build(const QStringList &terms, const QStringList &replacements)
+{
+    m_terms = terms;
+    m_replacements = replacements;
+    m_nodes.clear();
+    m_edges.clear();
+
+    // Trie with per-node child lists, flattened into sorted edge ranges afterwards.
+    std::vector<std::vector<std::pair<ushort,int> > > children(1);
+    std::vector<int> entries(1,-1);
+    std::vector<int> depths(1,0);
+    for (int i = 0; i < terms.count(); i++) {
+        int node = 0;
+        for (const QChar c : terms.at(i)) {
+            auto &list = children[node];
+            auto it = std::find_if(list.begin(),list.end(),[c](const std::pair<ushort,int> &edge){
+                return edge.first == c.unicode();
+            });
+            if (it != list.end()) {
+                node = it->second;
+            } else {
+                const int next = static_cast<int>(children.size());
+                list.emplace_back(c.unicode(),next);
+                children.emplace_back();
+                entries.push_back(-1);
+                depths.push_back(depths[node] + 1);
+                node = next;
+            }
+        }
+        if (node != 0 && entries[node] < 0)
+            entries[node] = i;
+    }
+
+    m_nodes.resize(static_cast<int>(children.size()));
+    for (int i = 0; i < m_nodes.count(); i++) {
+        auto &list = children[i];
+        std::sort(list.begin(),list.end());
+        CNode &node = m_nodes[i];
+        node.firstEdge = m_edges.count();
+        node.edgeCount = static_cast<int>(list.size());
+        node.entry = entries[i];
+        node.depth = depths[i];
+        for (const auto &edge : list)
+            m_edges.append({ edge.first, edge.second });
+        list.clear();
+        list.shrink_to_fit();
+    }
+
+    // Failure and dictionary links, breadth first.
+    QQueue<int> queue;
+    queue.enqueue(0);
+    while (!queue.isEmpty()) {
+        const int node = queue.dequeue();
+        const CNode parent = m_nodes.at(node);
+        for (int e = parent.firstEdge; e < parent.firstEdge + parent.edgeCount; e++) {
+            const CEdge edge = m_edges.at(e);
+            int fail = 0;
+            if (node != 0) {
+                int f = parent.fail;
+                while (true) {
+                    const int next = child(f,edge.c);
+                    if (next >= 0) {
+                        fail = next;
+                        break;
+                    }
+                    if (f == 0) break;
+                    f = m_nodes.at(f).fail;
+                }
+            }
+            CNode &target = m_nodes[edge.target];
+            target.fail = fail;
+            target.dictLink = (m_nodes.at(fail).entry >= 0) ? fail : m_nodes.at(fail).dictLink;
+            queue.enqueue(edge.target);
+        }
+    }
+}
+
+int CGlossary::child(int node, ushort c) const
+{
+    const CNode &n = m_nodes.at(node);
+    const auto begin = m_edges.constBegin() + n.firstEdge;
+    const auto end = begin + n.edgeCount;
+    const auto it = std::lower_bound(begin,end,c,[](const CEdge &edge, ushort value){
+        return edge.c < value;
+    });
+    if (it != end && it->c == c)
+        return it->target;
+    return -1;
+}
+
+int CGlossary::count() const
+{
+    return m_terms.count();
+}
+
+QString CGlossary::term(int entry) const
+{
+    return m_terms.value(entry);
+}
+
+QString CGlossary::replacement(int entry) const
+{
+    return m_replacements.value(entry);
+}
+
+QVector<CGlossaryMatch> CGlossary::match(const QString &str) const
+{
+    QVector<CGlossaryMatch> res;
+    if (m_terms.isEmpty()) return res;
+
+    // Longest entry starting at each position.
+    QVector<int> longest;
+    int state = 0;
+    for (int i = 0; i < str.length(); i++) {
+        const ushort c = str.at(i).unicode();
+        int next = child(state,c);
+        while (next < 0 && state != 0) {
+            state = m_nodes.at(state).fail;
+            next = child(state,c);
+        }
+        state = (next < 0) ? 0 : next;
+
+        // Every term ending here, not only the longest: with {"xa","abc","bc"}
+        // and "xabc", "bc" must be recorded at 2 for "xa" + "bc" result.
+        const CNode &node = m_nodes.at(state);
+        int terminal = (node.entry >= 0) ? state : node.dictLink;
+        while (terminal >= 0) {
+            const CNode &term = m_nodes.at(terminal);
+            if (longest.isEmpty())
+                longest.fill(-1,str.length());
+            const int start = i - term.depth + 1;
+            if (longest.at(start) < 0 || m_terms.at(longest.at(start)).length() < term.depth)
+                longest[start] = term.entry;
+            terminal = term.dictLink;
+        }
+    }
+
+    if (longest.isEmpty()) return res;
+
+    int pos = 0;
+    while (pos < longest.count()) {
+        const int entry = longest.at(pos);
+        if (entry < 0) {
+            pos++;
+            continue;
+        }
+        const int len = m_terms.at(entry).length();
+        res.append({ pos, len, entry });
+        pos += len;
+    }
+
+    return res;
+}
@@ -0,0 +1,54 @@
+#ifndef CGLOSSARY_H
+#define CGLOSSARY_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+struct CGlossaryMatch {
+    int start { 0 };
+    int length { 0 };
+    int entry { -1 };
+};
+
+// Immutable Aho-Corasick automaton over glossary terms.
+class CGlossary
+{
+public:
+    CGlossary();
+
+    // File format: UTF-8 lines "term<TAB>replacement", '#' for comments.
+    // Term without replacement is protected from translation.
+    bool load(const QString &fileName);
+    void build(const QStringList &terms, const QStringList &replacements);
+
+    int count() const;
+    QString term(int entry) const;
+    QString replacement(int entry) const;
+
+    // Leftmost-longest non-overlapping matches in one pass over str.
+    QVector<CGlossaryMatch> match(const QString &str) const;
+
+private:
+    struct CNode {
+        int firstEdge { 0 };
+        int edgeCount { 0 };
+        int fail { 0 };
+        int entry { -1 };
+        int dictLink { -1 }; // nearest terminal node by fail links
+        int depth { 0 };
+    };
+    struct CEdge {
+        ushort c { 0 };
+        int target { 0 };
+    };
+
+    QVector<CNode> m_nodes;
+    QVector<CEdge> m_edges;
+    QStringList m_terms;
+    QStringList m_replacements;
+
+    int child(int node, ushort c) const;
+};
+
+#endif // CGLOSSARY_H
@@ -0,0 +1,21 @@
+#ifndef HASHUTILS_H
+#define HASHUTILS_H
+
+#include <QtGlobal>
+
+// Stable 64-bit FNV-1a, for on-disk and shared memory structures
+// (qHash is seeded per process).
+inline quint64 fnvHash64(const char *data, int size, quint64 seed = 0)
+{
+    const quint64 offsetBasis = 14695981039346656037ULL;
+    const quint64 prime = 1099511628211ULL;
+
+    quint64 res = offsetBasis ^ seed;
+    for (int i = 0; i < size; i++) {
+        res ^= static_cast<quint8>(data[i]);
+        res *= prime;
+    }
+    return res;
+}
+
+#endif // HASHUTILS_H
@@ -0,0 +1,385 @@
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonParseError>
+#include "httpserver.h"
+#include "qsl.h"
+
+CHttpServer::CHttpServer(CTranslator *translator, CStatistics *stats, QObject *parent)
+    : QTcpServer(parent),
+      m_translator(translator),
+      m_stats(stats)
+{
+    connect(this, &QTcpServer::newConnection, this, &CHttpServer::acceptConnections);
+}
+
+CHttpServer::~CHttpServer()
+{
+    if (isListening())
+        close();
+}
+
+void CHttpServer::setTokens(const QStringList &tokens)
+{
+    m_tokens = tokens;
+}
+
+void CHttpServer::setBatchLimits(int maxItems, int maxBytes)
+{
+    m_batchMaxItems = maxItems;
+    m_batchMaxBytes = maxBytes;
+}
+
+void CHttpServer::setDisabled(bool disabled)
+{
+    m_disabled = disabled;
+}
+
+void CHttpServer::acceptConnections()
+{
+    while (hasPendingConnections()) {
+        QTcpSocket *socket = nextPendingConnection();
+        if (socket == nullptr) return;
+        if (m_disabled) {
+            socket->close();
+            socket->deleteLater();
+            continue;
+        }
+
+        CConnection connection;
+        connection.closed.reset(new std::atomic<bool>(false));
+        m_connections.insert(socket,connection);
+
+        connect(socket, &QTcpSocket::disconnected, this, &CHttpServer::discardClient);
+        connect(socket, &QTcpSocket::readyRead, this, &CHttpServer::readClient);
+    }
+}
+
+void CHttpServer::readClient()
+{
+    auto *socket = qobject_cast<QTcpSocket *>(sender());
+    if (socket)
+        processClient(socket);
+}
+
+void CHttpServer::discardClient()
+{
+    auto *socket = qobject_cast<QTcpSocket *>(sender());
+    if (socket == nullptr) return;
+
+    const auto it = m_connections.constFind(socket);
+    if (it != m_connections.constEnd()) {
+        *(it.value().closed) = true;
+        m_connections.erase(it);
+    }
+    socket->deleteLater();
+}
+
+void CHttpServer::processClient(QTcpSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) return;
+    CConnection &connection = it.value();
+
+    if (m_disabled) {
+        socket->close();
+        return;
+    }
+
+    connection.buffer.append(socket->readAll());
+
+    // Pipelined requests are parsed while responses are pending, up to the limit.
+    while (!connection.closing && connection.responses.count() < CDefaults::httpMaxPipelined) {
+        const int headerEnd = connection.buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            if (connection.buffer.size() > CDefaults::httpMaxHeaderSize) {
+                auto response = QSharedPointer<CResponse>::create();
+                setError(*response,431,QSL("HEADER_TOO_LARGE"));
+                response->close = true;
+                connection.responses.append(response);
+                connection.closing = true;
+            }
+            break;
+        }
+
+        CRequest request;
+        int contentLength = 0;
+        int status = 0;
+        if (!parseHeader(connection.buffer.left(headerEnd),request,contentLength,status)) {
+            // Framing of following requests is unknown, connection is closed after the error.
+            auto response = QSharedPointer<CResponse>::create();
+            setError(*response,status,QSL("BAD_REQUEST"));
+            response->close = true;
+            connection.responses.append(response);
+            connection.closing = true;
+            break;
+        }
+
+        const int requestSize = headerEnd + 4 + contentLength;
+        if (connection.buffer.size() < requestSize) break;
+
+        request.body = connection.buffer.mid(headerEnd + 4,contentLength);
+        connection.buffer.remove(0,requestSize);
+        handleRequest(socket,connection,request);
+    }
+
+    flushResponses(socket,connection);
+}
+
+bool CHttpServer::parseHeader(const QByteArray &header, CRequest &request, int &contentLength, int &status) const
+{
+    const QList<QByteArray> lines = header.split('\n');
+    const QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+    status = 400;
+    if (requestLine.count() != 3 || !requestLine.at(2).startsWith("HTTP/1.")) return false;
+
+    request.method = requestLine.at(0);
+    request.path = requestLine.at(1);
+    request.keepAlive = (requestLine.at(2) != "HTTP/1.0");
+    contentLength = 0;
+
+    for (int i = 1; i < lines.count(); i++) {
+        const QByteArray &line = lines.at(i);
+        const int sep = line.indexOf(':');
+        if (sep <= 0) return false;
+
+        const QByteArray name = line.left(sep).trimmed().toLower();
+        const QByteArray value = line.mid(sep + 1).trimmed();
+        if (name == "content-length") {
+            bool ok = false;
+            contentLength = value.toInt(&ok);
+            if (!ok || contentLength < 0) return false;
+            if (contentLength > CDefaults::httpMaxBodySize) {
+                status = 413;
+                return false;
+            }
+        } else if (name == "transfer-encoding") {
+            status = 501;
+            return false;
+        } else if (name == "connection") {
+            const QByteArray option = value.toLower();
+            if (option == "close") {
+                request.keepAlive = false;
+            } else if (option == "keep-alive") {
+                request.keepAlive = true;
+            }
+        } else if (name == "authorization" && value.startsWith("Bearer ")) {
+            request.token = QString::fromLatin1(value.mid(7).trimmed());
+        }
+    }
+    return true;
+}
+
+void CHttpServer::handleRequest(QTcpSocket *socket, CConnection &connection, const CRequest &request)
+{
+    static const QByteArray pathTranslate("/translate");
+    static const QByteArray pathBatch("/translate/batch");
+
+    if (m_stats)
+        m_stats->add(QSL("http.requests"));
+
+    auto response = QSharedPointer<CResponse>::create();
+    response->close = !request.keepAlive;
+    connection.responses.append(response);
+    if (response->close)
+        connection.closing = true;
+
+    if (!m_tokens.contains(request.token)) {
+        setError(*response,401,QSL("NOT_AUTHORIZED"));
+        return;
+    }
+    if (request.path != pathTranslate && request.path != pathBatch) {
+        setError(*response,404,QSL("NOT_FOUND"));
+        return;
+    }
+    if (request.method != "POST") {
+        setError(*response,405,QSL("METHOD_NOT_ALLOWED"));
+        return;
+    }
+
+    QJsonParseError error {};
+    const QJsonDocument document = QJsonDocument::fromJson(request.body,&error);
+    if (error.error != QJsonParseError::NoError || !document.isObject()) {
+        setError(*response,400,QSL("BAD_REQUEST"));
+        return;
+    }
+
+    const QJsonObject json = document.object();
+    const CAtlas::AtlasDirection direction = json.contains(QSL("direction"))
+                                             ? CAtlas::directionFromString(json.value(QSL("direction")).toString())
+                                             : CAtlas::Atlas_JE;
+
+    if (request.path == pathBatch) {
+        startBatch(socket,connection,response,direction,json,request.body.size());
+        return;
+    }
+
+    const QString text = json.value(QSL("text")).toString().trimmed();
+    if (text.isEmpty()) {
+        setError(*response,400,QSL("NULL_STR_DECODED"));
+        return;
+    }
+    const CTranslator::TranslateFlags flags = json.value(QSL("cache")).toBool(true)
+                                              ? CTranslator::Flag_None : CTranslator::Flag_NoCache;
+    startTranslation(socket,connection,response,direction,text,flags);
+}
+
+void CHttpServer::startTranslation(QTcpSocket *socket, CConnection &connection,
+                                   const QSharedPointer<CResponse> &response, CAtlas::AtlasDirection direction,
+                                   const QString &text, CTranslator::TranslateFlags flags)
+{
+    const QPointer<QTcpSocket> client(socket);
+    const QPointer<CTranslator> translator(m_translator);
+    const QSharedPointer<std::atomic<bool> > closed = connection.closed;
+
+    auto *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this,watcher,client,response](){
+        const QString res = watcher->result();
+        watcher->deleteLater();
+
+        if (res.startsWith(QSL("ERR"))) {
+            setError(*response,500,QSL("TRANS_FAILED"));
+        } else {
+            setResponse(*response,200,QJsonObject({ { QSL("result"), res } }));
+        }
+        if (client)
+            completeResponse(client);
+    });
+
+    watcher->setFuture(QtConcurrent::run([translator,closed,direction,text,flags](){
+        if (translator.isNull()) return QSL("ERR");
+        return translator->translate(direction,text,flags,[closed]{
+            return closed->load();
+        });
+    }));
+}
+
+void CHttpServer::startBatch(QTcpSocket *socket, CConnection &connection, const QSharedPointer<CResponse> &response,
+                             CAtlas::AtlasDirection direction, const QJsonObject &json, int size)
+{
+    const QJsonArray array = json.value(QSL("items")).toArray();
+    if (size > m_batchMaxBytes || array.count() > m_batchMaxItems) {
+        setError(*response,413,QSL("BATCH_TOO_LARGE"));
+        return;
+    }
+    const CTranslator::TranslateFlags flags = json.value(QSL("cache")).toBool(true)
+                                              ? CTranslator::Flag_None : CTranslator::Flag_NoCache;
+
+    // Items are plain strings or {"text": ..., "direction": ...} objects.
+    QVector<CAtlas::AtlasDirection> directions;
+    QStringList items;
+    QVector<int> itemIndex(array.count(),-1);
+    directions.reserve(array.count());
+    items.reserve(array.count());
+    for (int i = 0; i < array.count(); i++) {
+        const QJsonValue value = array.at(i);
+        const QJsonObject item = value.toObject();
+        const QString text = (value.isString() ? value.toString() : item.value(QSL("text")).toString()).trimmed();
+        if (text.isEmpty()) continue;
+
+        itemIndex[i] = items.count();
+        directions.append(item.contains(QSL("direction"))
+                          ? CAtlas::directionFromString(item.value(QSL("direction")).toString()) : direction);
+        items.append(text);
+    }
+
+    const QPointer<QTcpSocket> client(socket);
+    const QPointer<CTranslator> translator(m_translator);
+    const QPointer<CStatistics> stats(m_stats);
+    const QSharedPointer<std::atomic<bool> > closed = connection.closed;
+
+    auto *watcher = new QFutureWatcher<QStringList>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this,watcher,client,response,itemIndex](){
+        const QStringList results = watcher->result();
+        watcher->deleteLater();
+
+        QJsonArray replies;
+        for (const int idx : itemIndex) {
+            if (idx < 0) {
+                replies.append(QJsonObject({ { QSL("error"), QSL("NULL_STR_DECODED") } }));
+            } else if (results.value(idx).isNull()) {
+                replies.append(QJsonObject({ { QSL("error"), QSL("TRANS_FAILED") } }));
+            } else {
+                replies.append(QJsonObject({ { QSL("result"), results.at(idx) } }));
+            }
+        }
+        setResponse(*response,200,QJsonObject({ { QSL("results"), replies } }));
+        if (client)
+            completeResponse(client);
+    });
+
+    watcher->setFuture(QtConcurrent::run([translator,stats,closed,directions,items,flags](){
+        QStringList results;
+        if (translator) {
+            CBulkTranslator bulk(translator,stats);
+            bulk.setCancelCheck([closed]{ return closed->load(); });
+            bulk.translateItems(directions,items,results,flags);
+        }
+        return results;
+    }));
+}
+
+void CHttpServer::completeResponse(QTcpSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) return;
+
+    flushResponses(socket,it.value());
+    // Closing connection may be gone now. Otherwise continue with requests waiting for pipeline slot.
+    it = m_connections.find(socket);
+    if (it != m_connections.end() && !it.value().closing &&
+            (!it.value().buffer.isEmpty() || socket->bytesAvailable() > 0))
+        processClient(socket);
+}
+
+void CHttpServer::flushResponses(QTcpSocket *socket, CConnection &connection)
+{
+    while (!connection.responses.isEmpty() && connection.responses.first()->ready) {
+        const QSharedPointer<CResponse> response = connection.responses.takeFirst();
+
+        QByteArray header = "HTTP/1.1 " + QByteArray::number(response->status) + ' ' + statusText(response->status);
+        header.append("\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: ");
+        header.append(QByteArray::number(response->body.size()));
+        header.append(response->close ? "\r\nConnection: close\r\n\r\n" : "\r\nConnection: keep-alive\r\n\r\n");
+        socket->write(header);
+        socket->write(response->body);
+
+        if (response->close) {
+            connection.responses.clear();
+            connection.buffer.clear();
+            socket->disconnectFromHost();
+            return;
+        }
+    }
+    socket->flush();
+}
+
+void CHttpServer::setResponse(CResponse &response, int status, const QJsonObject &body)
+{
+    response.status = status;
+    response.body = QJsonDocument(body).toJson(QJsonDocument::Compact);
+    response.ready = true;
+}
+
+void CHttpServer::setError(CResponse &response, int status, const QString &code)
+{
+    setResponse(response,status,QJsonObject({ { QSL("error"), code } }));
+}
+
+QByteArray CHttpServer::statusText(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        default: break;
+    }
+    return "Unknown";
+}
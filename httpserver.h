@@ -0,0 +1,101 @@
+#ifndef CHTTPSERVER_H
+#define CHTTPSERVER_H
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QJsonObject>
+#include <atomic>
+#include "atlas.h"
+#include "translator.h"
+#include "stats.h"
+#include "bulk.h"
+
+namespace CDefaults {
+const int httpPort = 18080;
+// Tokens travel in cleartext, so listener is local unless configured otherwise.
+const QHostAddress::SpecialAddress httpHost = QHostAddress::LocalHost;
+const int httpMaxHeaderSize = 16 * 1024;
+const int httpMaxBodySize = 16 * 1024 * 1024;
+const int httpMaxPipelined = 64;
+}
+
+// Plain HTTP/1.1 JSON endpoint for tools not speaking the line protocol.
+// Connections are kept alive, pipelined requests run concurrently and are
+// answered in request order. Translations go through the same translator
+// (caches, coalescing, failure cache) as TLS clients.
+//   POST /translate        {"text": "...", "direction": "JE|EJ|AUTO", "cache": true}
+//                          -> {"result": "..."}
+//   POST /translate/batch  {"direction": "...", "items": ["...", {"text": "...", "direction": "..."}]}
+//                          -> {"results": [{"result": "..."}, {"error": "TRANS_FAILED"}, ...]}
+// Client token is sent as "Authorization: Bearer <token>", errors are {"error": "<code>"}.
+class CHttpServer : public QTcpServer
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CHttpServer)
+public:
+    CHttpServer(CTranslator *translator, CStatistics *stats, QObject *parent = nullptr);
+    ~CHttpServer() override;
+
+    void setTokens(const QStringList &tokens);
+    void setBatchLimits(int maxItems, int maxBytes);
+    void setDisabled(bool disabled);
+
+private:
+    struct CRequest {
+        QByteArray method;
+        QByteArray path;
+        QByteArray body;
+        QString token;
+        bool keepAlive { true };
+    };
+
+    struct CResponse {
+        int status { 0 };
+        QByteArray body;
+        bool ready { false };
+        bool close { false };
+    };
+
+    struct CConnection {
+        QByteArray buffer;
+        QList<QSharedPointer<CResponse> > responses;
+        QSharedPointer<std::atomic<bool> > closed;
+        bool closing { false };
+    };
+
+    QPointer<CTranslator> m_translator;
+    QPointer<CStatistics> m_stats;
+    QHash<QTcpSocket *,CConnection> m_connections;
+    QStringList m_tokens;
+    int m_batchMaxItems { CDefaults::batchMaxItems };
+    int m_batchMaxBytes { CDefaults::batchMaxBytes };
+    bool m_disabled { false };
+
+    void processClient(QTcpSocket *socket);
+    bool parseHeader(const QByteArray &header, CRequest &request, int &contentLength, int &status) const;
+    void handleRequest(QTcpSocket *socket, CConnection &connection, const CRequest &request);
+    void startTranslation(QTcpSocket *socket, CConnection &connection, const QSharedPointer<CResponse> &response,
+                          CAtlas::AtlasDirection direction, const QString &text, CTranslator::TranslateFlags flags);
+    void startBatch(QTcpSocket *socket, CConnection &connection, const QSharedPointer<CResponse> &response,
+                    CAtlas::AtlasDirection direction, const QJsonObject &json, int size);
+    void completeResponse(QTcpSocket *socket);
+    void flushResponses(QTcpSocket *socket, CConnection &connection);
+
+    static void setResponse(CResponse &response, int status, const QJsonObject &body);
+    static void setError(CResponse &response, int status, const QString &code);
+    static QByteArray statusText(int status);
+
+private Q_SLOTS:
+    void acceptConnections();
+    void readClient();
+    void discardClient();
+
+};
+
+#endif // CHTTPSERVER_H
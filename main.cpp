@@ -19,6 +19,11 @@ int main(int argc, char *argv[])
 
     CService service(argc, argv);
 
+    if ((argc > 1) && CService::isToolCommand(QString::fromLocal8Bit(argv[1]))) {
+        QCoreApplication app(argc, argv);
+        return service.execTool(&app);
+    }
+
     if (CService::testProcessToken(CService::Process_IsInteractive) && (argc <= 1)) {
 
         QApplication app(argc, argv);
@@ -0,0 +1,173 @@
+#include <QHash>
+#include "markup.h"
+#include "qsl.h"
+
+int CMarkup::findTagEnd(const QString &html, int start)
+{
+    QChar quote;
+    for (int i = start + 1; i < html.length(); i++) {
+        const QChar c = html.at(i);
+        if (!quote.isNull()) {
+            if (c == quote)
+                quote = QChar();
+        } else if (c == QChar('"') || c == QChar('\'')) {
+            quote = c;
+        } else if (c == QChar('>')) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QString CMarkup::tagName(const QString &tag)
+{
+    int pos = 1;
+    if (pos < tag.length() && tag.at(pos) == QChar('/'))
+        pos++;
+    int end = pos;
+    while (end < tag.length() && tag.at(end).isLetterOrNumber())
+        end++;
+    return tag.mid(pos,end - pos).toLower();
+}
+
+void CMarkup::appendText(QVector<CMarkupToken> &tokens, const QString &text)
+{
+    if (text.isEmpty()) return;
+
+    if (!tokens.isEmpty() && tokens.last().isText) {
+        tokens.last().text.append(text);
+    } else {
+        tokens.append({ text, true });
+    }
+}
+
+QVector<CMarkupToken> CMarkup::parse(const QString &html)
+{
+    static const QString commentStart(QSL("<!--"));
+    static const QString commentEnd(QSL("-->"));
+
+    QVector<CMarkupToken> res;
+
+    const int len = html.length();
+    int pos = 0;
+    while (pos < len) {
+        if (html.at(pos) != QChar('<')) {
+            int end = html.indexOf(QChar('<'),pos);
+            if (end < 0)
+                end = len;
+            appendText(res,decodeEntities(html.mid(pos,end - pos)));
+            pos = end;
+            continue;
+        }
+
+        if (html.midRef(pos,commentStart.length()) == commentStart) {
+            int end = html.indexOf(commentEnd,pos);
+            end = (end < 0) ? len : end + commentEnd.length();
+            res.append({ html.mid(pos,end - pos), false });
+            pos = end;
+            continue;
+        }
+
+        const int tagEnd = findTagEnd(html,pos);
+        if (tagEnd < 0) {
+            appendText(res,decodeEntities(html.mid(pos)));
+            break;
+        }
+
+        const QString tag = html.mid(pos,tagEnd - pos + 1);
+        const QString name = tagName(tag);
+        const bool closing = tag.startsWith(QSL("</"));
+        pos = tagEnd + 1;
+
+        if (name == QSL("rt") || name == QSL("rp")) {
+            // Drop reading with its content.
+            if (!closing) {
+                const int end = html.indexOf(QSL("</%1").arg(name),pos,Qt::CaseInsensitive);
+                if (end >= 0) {
+                    const int closeEnd = findTagEnd(html,end);
+                    pos = (closeEnd < 0) ? len : closeEnd + 1;
+                }
+            }
+            continue;
+        }
+
+        if (name == QSL("ruby") || name == QSL("rb"))
+            continue;
+
+        res.append({ tag, false });
+
+        if (!closing && (name == QSL("script") || name == QSL("style"))) {
+            int end = html.indexOf(QSL("</%1").arg(name),pos,Qt::CaseInsensitive);
+            if (end < 0)
+                end = len;
+            res.append({ html.mid(pos,end - pos), false });
+            pos = end;
+        }
+    }
+
+    return res;
+}
+
+QString CMarkup::decodeEntities(const QString &str)
+{
+    static const QHash<QString,QChar> entities({
+        { QSL("amp"), QChar('&') },
+        { QSL("lt"), QChar('<') },
+        { QSL("gt"), QChar('>') },
+        { QSL("quot"), QChar('"') },
+        { QSL("apos"), QChar('\'') },
+        { QSL("nbsp"), QChar(0x00a0) }
+    });
+
+    if (!str.contains(QChar('&')))
+        return str;
+
+    QString res;
+    res.reserve(str.length());
+    int pos = 0;
+    while (pos < str.length()) {
+        // Entity terminator is searched only near '&', so text without ';' stays linear.
+        const int maxEntityLength = 10;
+        const QChar c = str.at(pos);
+        const int sep = (c == QChar('&')) ? str.midRef(pos,maxEntityLength + 1).indexOf(QChar(';')) : -1;
+        if (sep < 0) {
+            res.append(c);
+            pos++;
+            continue;
+        }
+        const int end = pos + sep;
+
+        const QString entity = str.mid(pos + 1,end - pos - 1);
+        bool ok = false;
+        uint code = 0;
+        if (entity.startsWith(QSL("#x"),Qt::CaseInsensitive)) {
+            const int hexBase = 16;
+            code = entity.midRef(2).toUInt(&ok,hexBase);
+        } else if (entity.startsWith(QChar('#'))) {
+            code = entity.midRef(1).toUInt(&ok);
+        } else if (entities.contains(entity)) {
+            res.append(entities.value(entity));
+            pos = end + 1;
+            continue;
+        }
+
+        if (ok && code > 0) {
+            res.append(QString::fromUcs4(&code,1));
+            pos = end + 1;
+        } else {
+            res.append(c);
+            pos++;
+        }
+    }
+    return res;
+}
+
+QString CMarkup::escape(const QString &str)
+{
+    QString res = str;
+    res.replace(QChar('&'),QSL("&amp;"));
+    res.replace(QChar('<'),QSL("&lt;"));
+    res.replace(QChar('>'),QSL("&gt;"));
+    res.replace(QChar(0x00a0),QSL("&nbsp;"));
+    return res;
+}
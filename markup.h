@@ -0,0 +1,28 @@
+#ifndef CMARKUP_H
+#define CMARKUP_H
+
+#include <QString>
+#include <QVector>
+
+struct CMarkupToken {
+    QString text; // decoded for text nodes, raw for tags
+    bool isText { false };
+};
+
+class CMarkup
+{
+public:
+    // Splits HTML fragment into tags and decoded text nodes.
+    // Ruby readings (<rt>, <rp>) are dropped and ruby base text is merged
+    // with surrounding text.
+    static QVector<CMarkupToken> parse(const QString &html);
+    static QString decodeEntities(const QString &str);
+    static QString escape(const QString &str);
+
+private:
+    static int findTagEnd(const QString &html, int start);
+    static QString tagName(const QString &tag);
+    static void appendText(QVector<CMarkupToken> &tokens, const QString &text);
+};
+
+#endif // CMARKUP_H
@@ -0,0 +1,550 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QtConcurrent>
+#include <QDebug>
+#include <cstring>
+#include "persistentcache.h"
+#include "hashutils.h"
+#include "qsl.h"
+
+namespace {
+const quint32 logMagic = 0x474c5441;    // ATLG
+const quint32 indexMagic = 0x58495441;  // ATIX
+const quint32 recordMagic = 0x43455241; // AREC
+const quint32 storeVersion = 1;
+const int recordAlignment = 8;
+const int averageRecordSize = 128;
+const quint32 minSlotCount = 1024;
+const int maxLoadPercent = 70;
+}
+
+CPersistentCache::CStore::~CStore()
+{
+    close();
+}
+
+bool CPersistentCache::CStore::mapFiles()
+{
+    m_logData = m_log.map(0,m_log.size());
+    m_indexData = m_index.map(0,m_index.size());
+    return (m_logData != nullptr) && (m_indexData != nullptr);
+}
+
+void CPersistentCache::CStore::close()
+{
+    if (m_logData)
+        m_log.unmap(m_logData);
+    if (m_indexData)
+        m_index.unmap(m_indexData);
+    m_logData = nullptr;
+    m_indexData = nullptr;
+    m_log.close();
+    m_index.close();
+}
+
+bool CPersistentCache::CStore::create(const QString &logName, const QString &indexName,
+                                      qint64 capacity, quint64 generation)
+{
+    close();
+    this->capacity = capacity;
+    const quint32 slotCount = slotCountForCapacity(capacity);
+
+    m_log.setFileName(logName);
+    m_index.setFileName(indexName);
+    if (!m_log.open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+            !m_index.open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+            !m_log.resize(capacity) ||
+            !m_index.resize(sizeof(CIndexHeader) + slotCount * sizeof(CIndexSlot)) ||
+            !mapFiles()) {
+        close();
+        return false;
+    }
+
+    CLogHeader *log = logHeader();
+    log->magic = logMagic;
+    log->version = storeVersion;
+    log->generation = generation;
+    log->used = sizeof(CLogHeader);
+    log->dead = 0;
+
+    CIndexHeader *index = indexHeader();
+    index->magic = indexMagic;
+    index->version = storeVersion;
+    index->generation = generation;
+    index->slotCount = slotCount;
+    index->count = 0;
+    index->reserved = 0;
+    std::memset(slotTable(),0,slotCount * sizeof(CIndexSlot));
+
+    return true;
+}
+
+bool CPersistentCache::CStore::openExisting(const QString &logName, const QString &indexName, qint64 capacity)
+{
+    close();
+    this->capacity = capacity;
+    const quint32 slotCount = slotCountForCapacity(capacity);
+    const qint64 indexSize = sizeof(CIndexHeader) + slotCount * sizeof(CIndexSlot);
+
+    m_log.setFileName(logName);
+    m_index.setFileName(indexName);
+    if (!m_log.open(QIODevice::ReadWrite)) return false;
+
+    CLogHeader log {};
+    if (m_log.read(reinterpret_cast<char *>(&log),sizeof(log)) != sizeof(log) ||
+            log.magic != logMagic || log.version != storeVersion ||
+            log.used < sizeof(CLogHeader) || log.used > static_cast<quint64>(capacity)) {
+        close();
+        return false;
+    }
+
+    // Index is rebuilt only after crash during compaction or size cap change.
+    bool needRebuild = false;
+    if (!m_index.open(QIODevice::ReadWrite)) {
+        close();
+        return false;
+    }
+    if (m_index.size() != indexSize) {
+        needRebuild = true;
+        if (!m_index.resize(indexSize)) {
+            close();
+            return false;
+        }
+    }
+
+    if ((m_log.size() != capacity && !m_log.resize(capacity)) || !mapFiles()) {
+        close();
+        return false;
+    }
+
+    const CIndexHeader *index = indexHeader();
+    if (index->magic != indexMagic || index->version != storeVersion ||
+            index->generation != log.generation || index->slotCount != slotCount)
+        needRebuild = true;
+
+    if (needRebuild) {
+        qWarning() << "Persistent cache index is inconsistent, rebuilding";
+        rebuildIndex();
+    }
+
+    return true;
+}
+
+CPersistentCache::CLogHeader *CPersistentCache::CStore::logHeader() const
+{
+    return reinterpret_cast<CLogHeader *>(m_logData);
+}
+
+CPersistentCache::CIndexHeader *CPersistentCache::CStore::indexHeader() const
+{
+    return reinterpret_cast<CIndexHeader *>(m_indexData);
+}
+
+CPersistentCache::CIndexSlot *CPersistentCache::CStore::slotTable() const
+{
+    return reinterpret_cast<CIndexSlot *>(m_indexData + sizeof(CIndexHeader));
+}
+
+const CPersistentCache::CRecordHeader *CPersistentCache::CStore::record(quint64 offset) const
+{
+    return reinterpret_cast<const CRecordHeader *>(m_logData + offset);
+}
+
+QByteArray CPersistentCache::CStore::recordKey(const CRecordHeader *rec) const
+{
+    const char *data = reinterpret_cast<const char *>(rec) + sizeof(CRecordHeader);
+    return QByteArray(data,static_cast<int>(rec->keySize));
+}
+
+QByteArray CPersistentCache::CStore::recordValue(const CRecordHeader *rec) const
+{
+    const char *data = reinterpret_cast<const char *>(rec) + sizeof(CRecordHeader) + rec->keySize;
+    return QByteArray(data,static_cast<int>(rec->valueSize));
+}
+
+bool CPersistentCache::CStore::validRecord(quint64 offset) const
+{
+    const quint64 used = logHeader()->used;
+    if (offset < sizeof(CLogHeader) || (offset % recordAlignment) != 0 ||
+            offset + sizeof(CRecordHeader) > used)
+        return false;
+
+    const CRecordHeader *rec = record(offset);
+    if (rec->magic != recordMagic) return false;
+    const quint64 dataSize = static_cast<quint64>(rec->keySize) + rec->valueSize;
+    if (offset + sizeof(CRecordHeader) + dataSize > used) return false;
+
+    const char *data = reinterpret_cast<const char *>(rec) + sizeof(CRecordHeader);
+    return (qChecksum(data,static_cast<uint>(dataSize)) == rec->crc);
+}
+
+int CPersistentCache::CStore::find(quint64 hash, const QByteArray &key) const
+{
+    const quint32 slotCount = indexHeader()->slotCount;
+    const quint32 mask = slotCount - 1;
+    const CIndexSlot *table = slotTable();
+
+    quint32 pos = static_cast<quint32>(hash) & mask;
+    for (quint32 i = 0; i < slotCount; i++) {
+        const CIndexSlot &slot = table[pos];
+        if (slot.hash == 0) return -1;
+
+        if (slot.hash == hash && validRecord(slot.offset)) {
+            const CRecordHeader *rec = record(slot.offset);
+            if (rec->keySize == static_cast<quint32>(key.size()) &&
+                    std::memcmp(reinterpret_cast<const char *>(rec) + sizeof(CRecordHeader),
+                                key.constData(),key.size()) == 0)
+                return static_cast<int>(pos);
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+bool CPersistentCache::CStore::isFull(int size) const
+{
+    const CIndexHeader *index = indexHeader();
+    return (logHeader()->used + size > static_cast<quint64>(capacity)) ||
+            ((index->count + 1) * 100 > index->slotCount * maxLoadPercent);
+}
+
+bool CPersistentCache::CStore::isLive(quint64 offset) const
+{
+    const CRecordHeader *rec = record(offset);
+    const int slot = find(rec->hash,recordKey(rec));
+    return (slot >= 0) && (slotTable()[slot].offset == offset);
+}
+
+bool CPersistentCache::CStore::append(quint64 hash, const QByteArray &key, const QByteArray &value)
+{
+    const int size = recordSize(static_cast<quint32>(key.size()),static_cast<quint32>(value.size()));
+    if (isFull(size)) return false;
+
+    CLogHeader *log = logHeader();
+    const quint64 offset = log->used;
+    uchar *dst = m_logData + offset;
+
+    // Record first, then index slot, then committed log size: after process crash
+    // the slot of unfinished record points beyond used size and is ignored.
+    // Mapping is never flushed explicitly, so records not yet written back by
+    // the OS are lost on power failure or system crash.
+    CRecordHeader rec {};
+    rec.magic = recordMagic;
+    rec.keySize = static_cast<quint32>(key.size());
+    rec.valueSize = static_cast<quint32>(value.size());
+    rec.hash = hash;
+    std::memcpy(dst + sizeof(CRecordHeader),key.constData(),key.size());
+    std::memcpy(dst + sizeof(CRecordHeader) + key.size(),value.constData(),value.size());
+    rec.crc = qChecksum(reinterpret_cast<const char *>(dst + sizeof(CRecordHeader)),
+                        static_cast<uint>(key.size() + value.size()));
+    std::memcpy(dst,&rec,sizeof(CRecordHeader));
+
+    CIndexSlot *table = slotTable();
+    const int existing = find(hash,key);
+    if (existing >= 0) {
+        const CRecordHeader *old = record(table[existing].offset);
+        log->dead += recordSize(old->keySize,old->valueSize);
+        table[existing].offset = offset;
+    } else {
+        CIndexHeader *index = indexHeader();
+        const quint32 mask = index->slotCount - 1;
+        quint32 pos = static_cast<quint32>(hash) & mask;
+        while (table[pos].hash != 0)
+            pos = (pos + 1) & mask;
+        table[pos].offset = offset;
+        table[pos].hash = hash;
+        index->count++;
+    }
+
+    log->used = offset + size;
+    return true;
+}
+
+void CPersistentCache::CStore::rebuildIndex()
+{
+    CLogHeader *log = logHeader();
+    CIndexHeader *index = indexHeader();
+    const quint32 slotCount = slotCountForCapacity(capacity);
+    index->magic = indexMagic;
+    index->version = storeVersion;
+    index->generation = log->generation;
+    index->slotCount = slotCount;
+    index->count = 0;
+    index->reserved = 0;
+    std::memset(slotTable(),0,slotCount * sizeof(CIndexSlot));
+
+    // Re-append every valid record in place, torn tail is cut off.
+    const quint64 used = log->used;
+    quint64 offset = sizeof(CLogHeader);
+    log->dead = 0;
+    while (offset < used && validRecord(offset)) {
+        const CRecordHeader *rec = record(offset);
+        const QByteArray key = recordKey(rec);
+        const QByteArray value = recordValue(rec);
+        log->used = offset;
+        if (!append(rec->hash,key,value)) break;
+        offset = log->used;
+    }
+    log->used = offset;
+}
+
+CPersistentCache::CPersistentCache(QObject *parent)
+    : QObject(parent)
+{
+}
+
+CPersistentCache::~CPersistentCache()
+{
+    m_compaction.waitForFinished();
+    close();
+}
+
+QString CPersistentCache::logFileName(const QString &suffix) const
+{
+    return QDir(m_directory).filePath(QSL("results.log%1").arg(suffix));
+}
+
+QString CPersistentCache::indexFileName(const QString &suffix) const
+{
+    return QDir(m_directory).filePath(QSL("results.idx%1").arg(suffix));
+}
+
+int CPersistentCache::recordSize(quint32 keySize, quint32 valueSize)
+{
+    const int size = static_cast<int>(sizeof(CRecordHeader) + keySize + valueSize);
+    return (size + recordAlignment - 1) / recordAlignment * recordAlignment;
+}
+
+quint32 CPersistentCache::slotCountForCapacity(qint64 capacity)
+{
+    quint32 res = minSlotCount;
+    while (static_cast<qint64>(res) * averageRecordSize < capacity)
+        res <<= 1;
+    return res;
+}
+
+bool CPersistentCache::open(const QString &directory, qint64 maxSize)
+{
+    m_compaction.waitForFinished();
+    QWriteLocker locker(&m_lock);
+
+    m_store.reset();
+    m_lockFile.reset();
+    m_directory = directory;
+    m_maxSize = maxSize / recordAlignment * recordAlignment;
+    if (!QDir().mkpath(m_directory)) {
+        qWarning() << "Unable to create persistent cache directory" << m_directory;
+        return false;
+    }
+
+    QScopedPointer<QLockFile> lockFile(new QLockFile(QDir(m_directory).filePath(QSL("results.lock"))));
+    lockFile->setStaleLockTime(0);
+    if (!lockFile->tryLock()) {
+        qWarning() << "Persistent cache" << m_directory << "is used by another process";
+        return false;
+    }
+
+    // Finish compaction interrupted between removing old files and renaming new ones.
+    const QString newLog = logFileName(QSL(".new"));
+    const QString newIndex = indexFileName(QSL(".new"));
+    if (!QFileInfo::exists(logFileName()) && QFileInfo::exists(newLog) && QFileInfo::exists(newIndex)) {
+        QFile::rename(newLog,logFileName());
+        QFile::rename(newIndex,indexFileName());
+    }
+    QFile::remove(newLog);
+    QFile::remove(newIndex);
+
+    QScopedPointer<CStore> store(new CStore());
+    if (!store->openExisting(logFileName(),indexFileName(),m_maxSize)) {
+        if (!store->create(logFileName(),indexFileName(),m_maxSize,1)) {
+            qWarning() << "Unable to create persistent cache in" << m_directory;
+            return false;
+        }
+    }
+
+    qInfo() << "Persistent cache opened:" << store->indexHeader()->count << "entries";
+    m_store.swap(store);
+    m_lockFile.swap(lockFile);
+    return true;
+}
+
+void CPersistentCache::close()
+{
+    m_compaction.waitForFinished();
+    QWriteLocker locker(&m_lock);
+    m_store.reset();
+    m_lockFile.reset();
+}
+
+bool CPersistentCache::isOpen() const
+{
+    QReadLocker locker(&m_lock);
+    return !m_store.isNull();
+}
+
+bool CPersistentCache::lookup(const QString &key, QString &value)
+{
+    const QByteArray k = key.toUtf8();
+    quint64 hash = fnvHash64(k.constData(),k.size());
+    if (hash == 0) hash = 1;
+
+    QReadLocker locker(&m_lock);
+    if (m_store.isNull()) return false;
+
+    const int slot = m_store->find(hash,k);
+    if (slot < 0) return false;
+
+    value = QString::fromUtf8(m_store->recordValue(m_store->record(m_store->slotTable()[slot].offset)));
+    return true;
+}
+
+bool CPersistentCache::insert(const QString &key, const QString &value)
+{
+    const QByteArray k = key.toUtf8();
+    const QByteArray v = value.toUtf8();
+    quint64 hash = fnvHash64(k.constData(),k.size());
+    if (hash == 0) hash = 1;
+
+    bool res = false;
+    bool needCompaction = false;
+    {
+        // Appends are skipped while compaction copies records, concurrent lookups only delay them.
+        if (m_compacting) return false;
+        QWriteLocker locker(&m_lock);
+        if (m_store.isNull()) return false;
+
+        res = m_store->append(hash,k,v);
+        if (!res) {
+            needCompaction = true;
+        } else {
+            const CLogHeader *log = m_store->logHeader();
+            needCompaction = (log->dead * 2 > log->used);
+        }
+    }
+
+    if (needCompaction)
+        compact();
+    return res;
+}
+
+void CPersistentCache::compact()
+{
+    if (m_compacting.exchange(true)) return;
+
+    m_compaction = QtConcurrent::run([this](){
+        compactNow();
+        m_compacting = false;
+    });
+}
+
+void CPersistentCache::waitForCompaction()
+{
+    m_compaction.waitForFinished();
+}
+
+void CPersistentCache::forEach(const std::function<bool (const QByteArray &, const QByteArray &)> &visitor) const
+{
+    QReadLocker locker(&m_lock);
+    if (m_store.isNull()) return;
+
+    const quint64 used = m_store->logHeader()->used;
+    quint64 offset = sizeof(CLogHeader);
+    while (offset < used && m_store->validRecord(offset)) {
+        const CRecordHeader *rec = m_store->record(offset);
+        if (m_store->isLive(offset)) {
+            if (!visitor(m_store->recordKey(rec),m_store->recordValue(rec))) break;
+        }
+        offset += recordSize(rec->keySize,rec->valueSize);
+    }
+}
+
+void CPersistentCache::compactNow()
+{
+    const QString newLog = logFileName(QSL(".new"));
+    const QString newIndex = indexFileName(QSL(".new"));
+    QScopedPointer<CStore> fresh(new CStore());
+    qint64 copied = 0;
+    quint64 tail = 0;
+
+    {
+        QReadLocker locker(&m_lock);
+        if (m_store.isNull()) return;
+
+        const CLogHeader *log = m_store->logHeader();
+        if (!fresh->create(newLog,newIndex,m_maxSize,log->generation + 1)) {
+            qWarning() << "Unable to create compacted persistent cache files";
+            return;
+        }
+
+        // Live data over half of size cap, or live entries over half of index load
+        // limit (small records): drop oldest records, so next inserts fit again.
+        const quint64 used = log->used;
+        const quint64 half = static_cast<quint64>(m_maxSize) / 2;
+        quint64 keepFrom = sizeof(CLogHeader);
+        if (used - log->dead > half)
+            keepFrom = used - half;
+        const quint32 maxKept = fresh->indexHeader()->slotCount / 100 * maxLoadPercent / 2;
+        const quint32 live = m_store->indexHeader()->count;
+        const quint32 skipLive = (live > maxKept) ? live - maxKept : 0;
+
+        quint32 liveSeen = 0;
+        quint64 offset = sizeof(CLogHeader);
+        while (offset < used && m_store->validRecord(offset)) {
+            const CRecordHeader *rec = m_store->record(offset);
+            if (m_store->isLive(offset)) {
+                liveSeen++;
+                if (offset >= keepFrom && liveSeen > skipLive) {
+                    if (!fresh->append(rec->hash,m_store->recordKey(rec),m_store->recordValue(rec))) break;
+                    copied++;
+                }
+            }
+            offset += recordSize(rec->keySize,rec->valueSize);
+        }
+        tail = used;
+    }
+
+    QWriteLocker locker(&m_lock);
+    if (m_store.isNull()) return;
+
+    // Records appended between read and write lock are copied too.
+    const quint64 used = m_store->logHeader()->used;
+    quint64 offset = tail;
+    while (offset < used && m_store->validRecord(offset)) {
+        const CRecordHeader *rec = m_store->record(offset);
+        if (m_store->isLive(offset)) {
+            if (!fresh->append(rec->hash,m_store->recordKey(rec),m_store->recordValue(rec))) break;
+            copied++;
+        }
+        offset += recordSize(rec->keySize,rec->valueSize);
+    }
+    fresh->close();
+
+    m_store.reset();
+    QFile::remove(logFileName());
+    QFile::remove(indexFileName());
+    QFile::rename(newLog,logFileName());
+    QFile::rename(newIndex,indexFileName());
+
+    QScopedPointer<CStore> store(new CStore());
+    if (store->openExisting(logFileName(),indexFileName(),m_maxSize) ||
+            store->create(logFileName(),indexFileName(),m_maxSize,1)) {
+        m_store.swap(store);
+    }
+    qInfo() << "Persistent cache compacted:" << copied << "records kept";
+}
+
+qint64 CPersistentCache::usedBytes() const
+{
+    QReadLocker locker(&m_lock);
+    if (m_store.isNull()) return 0;
+    return static_cast<qint64>(m_store->logHeader()->used);
+}
+
+qint64 CPersistentCache::count() const
+{
+    QReadLocker locker(&m_lock);
+    if (m_store.isNull()) return 0;
+    return m_store->indexHeader()->count;
+}
@@ -0,0 +1,128 @@
+#ifndef CPERSISTENTCACHE_H
+#define CPERSISTENTCACHE_H
+
+#include <QObject>
+#include <QFile>
+#include <QFuture>
+#include <QLockFile>
+#include <QReadWriteLock>
+#include <QScopedPointer>
+#include <atomic>
+#include <functional>
+
+namespace CDefaults {
+const int persistentCacheMaxSize = 128 * 1024 * 1024;
+}
+
+// Translation cache on disk: memory-mapped append-only record log with
+// open-addressing hash index file. Opening does not read the log, lookups
+// touch only probed index slots and one record. Directory is locked while
+// open, so service and offline tools never write the same store.
+class CPersistentCache : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CPersistentCache)
+public:
+    explicit CPersistentCache(QObject *parent = nullptr);
+    ~CPersistentCache() override;
+
+    bool open(const QString &directory, qint64 maxSize = CDefaults::persistentCacheMaxSize);
+    void close();
+    bool isOpen() const;
+
+    bool lookup(const QString &key, QString &value);
+    // Returns false if the record was not stored (store full or compacting).
+    // Waits for concurrent lookups.
+    bool insert(const QString &key, const QString &value);
+    // Rewrites live records to new files in background.
+    void compact();
+    void waitForCompaction();
+    // Calls visitor for each live record in log order, under read lock.
+    // Visitor returns false to stop.
+    void forEach(const std::function<bool(const QByteArray &, const QByteArray &)> &visitor) const;
+
+    qint64 usedBytes() const;
+    qint64 count() const;
+
+private:
+    struct CLogHeader {
+        quint32 magic;
+        quint32 version;
+        quint64 generation;
+        quint64 used;
+        quint64 dead;
+    };
+    struct CRecordHeader {
+        quint32 magic;
+        quint32 keySize;
+        quint32 valueSize;
+        quint16 crc;
+        quint16 reserved;
+        quint64 hash;
+    };
+    struct CIndexHeader {
+        quint32 magic;
+        quint32 version;
+        quint64 generation;
+        quint32 slotCount;
+        quint32 count;
+        quint64 reserved;
+    };
+    struct CIndexSlot {
+        quint64 hash;
+        quint64 offset;
+    };
+
+    class CStore
+    {
+    public:
+        CStore() = default;
+        ~CStore();
+        bool create(const QString &logName, const QString &indexName, qint64 capacity, quint64 generation);
+        bool openExisting(const QString &logName, const QString &indexName, qint64 capacity);
+        void close();
+
+        CLogHeader *logHeader() const;
+        CIndexHeader *indexHeader() const;
+        CIndexSlot *slotTable() const;
+        const CRecordHeader *record(quint64 offset) const;
+
+        // Returns slot number, or -1
+        int find(quint64 hash, const QByteArray &key) const;
+        bool append(quint64 hash, const QByteArray &key, const QByteArray &value);
+        bool isFull(int size) const;
+        bool isLive(quint64 offset) const;
+        QByteArray recordKey(const CRecordHeader *rec) const;
+        QByteArray recordValue(const CRecordHeader *rec) const;
+        bool validRecord(quint64 offset) const;
+        void rebuildIndex();
+
+        qint64 capacity { 0 };
+
+    private:
+        Q_DISABLE_COPY(CStore)
+        QFile m_log;
+        QFile m_index;
+        uchar *m_logData { nullptr };
+        uchar *m_indexData { nullptr };
+
+        bool mapFiles();
+    };
+
+    QString m_directory;
+    qint64 m_maxSize { CDefaults::persistentCacheMaxSize };
+    mutable QReadWriteLock m_lock;
+    QScopedPointer<CStore> m_store;
+    QScopedPointer<QLockFile> m_lockFile;
+    std::atomic<bool> m_compacting { false };
+    QFuture<void> m_compaction;
+
+    QString logFileName(const QString &suffix = QString()) const;
+    QString indexFileName(const QString &suffix = QString()) const;
+    void compactNow();
+
+    static int recordSize(quint32 keySize, quint32 valueSize);
+    static quint32 slotCountForCapacity(qint64 capacity);
+};
+
+#endif // CPERSISTENTCACHE_H
@@ -0,0 +1,194 @@
+#include <QUrl>
+#include <QtEndian>
+#include <algorithm>
+#include "protocol.h"
+#include "atlas.h"
+#include "qsl.h"
+
+namespace {
+struct CLineCommand {
+    const char *prefix;
+    int length;
+    CProtocol::Command command;
+};
+
+const CLineCommand lineCommands[] = {
+    { "INIT:", 5, CProtocol::Command_Init },
+    { "DIR:", 4, CProtocol::Command_Direction },
+    { "TR:", 3, CProtocol::Command_Translate },
+    { "TRN:", 4, CProtocol::Command_TranslateNoCache },
+    { "TRH:", 4, CProtocol::Command_TranslateHash },
+    { "TRM:", 4, CProtocol::Command_Markup },
+    { "TRB:", 4, CProtocol::Command_Batch },
+    { "TRD:", 4, CProtocol::Command_TranslateDocument },
+    { "BULK:", 5, CProtocol::Command_Bulk },
+    { "DOC:", 4, CProtocol::Command_Document },
+    { "STAT:", 5, CProtocol::Command_Statistics },
+    { "QRN:", 4, CProtocol::Command_Quarantine },
+    { "REPL:", 5, CProtocol::Command_Replicate },
+    { "FIN:", 4, CProtocol::Command_Finish },
+};
+
+void setError(QString *errorString, const QString &message)
+{
+    if (errorString)
+        *errorString = message;
+}
+}
+
+CProtocol::CRequest CProtocol::parseLine(const QByteArray &line)
+{
+    CRequest res;
+    QByteArray cmd = line.simplified();
+
+    // ID:<id>:<command>, tagged requests are answered out of order.
+    if (cmd.startsWith("ID:")) {
+        const int sep = cmd.indexOf(':',3);
+        const QString id = QString::fromLatin1(cmd.mid(3,sep - 3));
+        if (sep <= 3 || id.length() > CDefaults::protocolMaxIdLength ||
+                !std::all_of(id.constBegin(),id.constEnd(),[](QChar c){ return c.isLetterOrNumber() || c == QChar('-'); }))
+            return res;
+        res.id = id;
+        cmd.remove(0,sep + 1);
+    }
+
+    for (const auto &command : lineCommands) {
+        if (cmd.startsWith(command.prefix)) {
+            res.command = command.command;
+            res.argument = QString::fromLatin1(cmd.mid(command.length));
+            break;
+        }
+    }
+    return res;
+}
+
+bool CProtocol::readFrame(QIODevice *device, CRequest &request, QString *errorString,
+                          CDeflateStream *decompressor)
+{
+    if (device->bytesAvailable() < frameHeaderSize) return false;
+
+    uchar header[frameHeaderSize] {};
+    if (device->peek(reinterpret_cast<char *>(header),frameHeaderSize) != frameHeaderSize) return false;
+
+    const quint32 size = qFromLittleEndian<quint32>(header);
+    const quint16 metaSize = qFromLittleEndian<quint16>(header + 6);
+    if (size > static_cast<quint32>(CDefaults::protocolMaxFrameSize) || metaSize > size) {
+        setError(errorString,QSL("Invalid frame size %1").arg(size));
+        return false;
+    }
+    if (device->bytesAvailable() < frameHeaderSize + static_cast<qint64>(size)) return false;
+
+    device->skip(frameHeaderSize);
+    const QByteArray payload = device->read(size);
+    QByteArray body = QByteArray::fromRawData(payload.constData() + metaSize,payload.size() - metaSize);
+    if ((header[5] & Flag_Compressed) != 0) {
+        QByteArray raw;
+        if (decompressor == nullptr || !decompressor->process(body,raw,CDefaults::protocolMaxFrameSize)) {
+            setError(errorString,QSL("Unable to decompress frame"));
+            return false;
+        }
+        body = raw;
+    }
+
+    request = CRequest();
+    request.version = 2;
+    if (header[4] >= Command_Init && header[4] <= Command_Finish)
+        request.command = static_cast<Command>(header[4]);
+    switch (header[5] & Flag_DirectionMask) {
+        case 1: request.direction = CAtlas::Atlas_JE; break;
+        case 2: request.direction = CAtlas::Atlas_EJ; break;
+        case 3: request.direction = CAtlas::Atlas_Auto; break;
+        default: break;
+    }
+    request.id = QString::number(qFromLittleEndian<quint32>(header + 8));
+    request.argument = QString::fromUtf8(body);
+    return true;
+}
+
+QString CProtocol::decode(const CRequest &request, const QString &argument)
+{
+    if (request.version >= 2)
+        return argument;
+    return QUrl::fromPercentEncoding(argument.toLatin1());
+}
+
+QString CProtocol::encode(int version, const QString &text)
+{
+    if (version >= 2)
+        return text;
+    return QString::fromLatin1(QUrl::toPercentEncoding(text));
+}
+
+QByteArray CProtocol::line(Reply reply, const QString &id, const QString &text, const QString &extra)
+{
+    QByteArray res;
+    switch (reply) {
+        case Reply_Ok:
+            // OK[:capability], never tagged.
+            res = "OK";
+            if (!text.isEmpty()) {
+                res.append(':');
+                res.append(text.toLatin1());
+            }
+            res.append("\r\n");
+            return res;
+        case Reply_Error: res = "ERR:"; break;
+        case Reply_Delta: res = "DLT:"; break;
+        case Reply_Result:
+        case Reply_Batch: res = "RES:"; break;
+    }
+
+    if (!id.isEmpty()) {
+        res.append(id.toLatin1());
+        res.append(':');
+    }
+    if (reply == Reply_Result) {
+        res.append(QUrl::toPercentEncoding(text));
+    } else {
+        res.append(text.toLatin1());
+    }
+    if (!extra.isEmpty()) {
+        res.append(':');
+        res.append(extra.toLatin1());
+    }
+    res.append("\r\n");
+    return res;
+}
+
+bool CProtocol::writeFrame(QIODevice *device, Reply reply, quint32 id, const QByteArray &meta,
+                           const QByteArray &body, bool compressed)
+{
+    return writeFrameData(device,static_cast<quint8>(reply),compressed ? Flag_Compressed : 0,id,meta,body);
+}
+
+bool CProtocol::writeRequestFrame(QIODevice *device, Command command, quint32 id, int direction,
+                                  const QByteArray &body, bool compressed)
+{
+    quint8 flags = 0;
+    switch (direction) {
+        case CAtlas::Atlas_JE: flags = 1; break;
+        case CAtlas::Atlas_EJ: flags = 2; break;
+        case CAtlas::Atlas_Auto: flags = 3; break;
+        default: break;
+    }
+    if (compressed)
+        flags |= Flag_Compressed;
+    return writeFrameData(device,static_cast<quint8>(command),flags,id,QByteArray(),body);
+}
+
+bool CProtocol::writeFrameData(QIODevice *device, quint8 type, quint8 flags, quint32 id,
+                               const QByteArray &meta, const QByteArray &body)
+{
+    uchar header[frameHeaderSize] {};
+    qToLittleEndian<quint32>(static_cast<quint32>(meta.size() + body.size()),header);
+    header[4] = type;
+    header[5] = flags;
+    qToLittleEndian<quint16>(static_cast<quint16>(meta.size()),header + 6);
+    qToLittleEndian<quint32>(id,header + 8);
+
+    if (device->write(reinterpret_cast<const char *>(header),frameHeaderSize) != frameHeaderSize)
+        return false;
+    if (!meta.isEmpty() && device->write(meta) != meta.size())
+        return false;
+    return (body.isEmpty() || device->write(body) == body.size());
+}
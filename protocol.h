@@ -0,0 +1,93 @@
+#ifndef CPROTOCOL_H
+#define CPROTOCOL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QIODevice>
+#include "deflate.h"
+
+namespace CDefaults {
+const int protocolMaxFrameSize = 16 * 1024 * 1024;
+const int protocolMaxIdLength = 32;
+const int compressionThreshold = 512;
+}
+
+// Client protocol codecs. Version 1 is percent-encoded text lines, version 2
+// (negotiated with INIT:<token>:V2) is length-prefixed binary frames:
+//   u32 payload size, u8 type, u8 flags, u16 meta size, u32 request ID (little-endian),
+//   payload = meta ("key=value\n" lines) followed by raw UTF-8 body.
+// Request frame type is Command, flags bits 0-1 override direction (1 JE, 2 EJ, 3 AUTO),
+// bit 2 marks body compressed with connection deflate stream (INIT:<token>:DEFLATE).
+// Compressed text line is Z:<base64 of compressed line>.
+// Both versions are parsed to CRequest, so server dispatch does not depend on framing.
+class CProtocol
+{
+public:
+    enum Command {
+        Command_Unknown = 0,
+        Command_Init = 1,
+        Command_Direction = 2,
+        Command_Translate = 3,
+        Command_TranslateNoCache = 4,
+        Command_TranslateHash = 5,
+        Command_Markup = 6,
+        Command_Batch = 7,
+        Command_Bulk = 8,
+        Command_Document = 9,
+        Command_TranslateDocument = 10,
+        Command_Statistics = 11,
+        Command_Quarantine = 12,
+        Command_Replicate = 13,
+        Command_Finish = 14
+    };
+
+    enum Reply {
+        Reply_Ok = 0x80,
+        Reply_Result = 0x81,
+        Reply_Error = 0x82,
+        Reply_Delta = 0x83,
+        Reply_Batch = 0x84
+    };
+
+    enum FrameFlag {
+        Flag_DirectionMask = 0x03,
+        Flag_Compressed = 0x04
+    };
+
+    // Version 2 separators for TRB items and TRD delta outputs.
+    static const char recordSeparator = '\x1e';
+    static const char unitSeparator = '\x1f';
+    static const int frameHeaderSize = 12;
+
+    struct CRequest {
+        Command command { Command_Unknown };
+        int version { 1 };
+        QString id;
+        QString argument; // v1: still percent-encoded, v2: raw text
+        int direction { -1 };
+    };
+
+    static CRequest parseLine(const QByteArray &line);
+    // Returns false when full frame is not buffered yet, or on error (errorString is set then).
+    // Compressed frames are refused without decompressor.
+    static bool readFrame(QIODevice *device, CRequest &request, QString *errorString,
+                          CDeflateStream *decompressor = nullptr);
+
+    static QString decode(const CRequest &request, const QString &argument);
+    static QString encode(int version, const QString &text);
+
+    // Result and Error text is encoded here, Batch and Delta text is already in protocol format.
+    static QByteArray line(Reply reply, const QString &id, const QString &text,
+                           const QString &extra = QString());
+    // Header, meta and body are written separately, body is not copied.
+    static bool writeFrame(QIODevice *device, Reply reply, quint32 id, const QByteArray &meta,
+                           const QByteArray &body, bool compressed = false);
+    static bool writeRequestFrame(QIODevice *device, Command command, quint32 id, int direction,
+                                  const QByteArray &body, bool compressed = false);
+
+private:
+    static bool writeFrameData(QIODevice *device, quint8 type, quint8 flags, quint32 id,
+                               const QByteArray &meta, const QByteArray &body);
+};
+
+#endif // CPROTOCOL_H
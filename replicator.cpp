@@ -0,0 +1,293 @@
+#include <QMutexLocker>
+#include <QDebug>
+#include "replicator.h"
+#include "qsl.h"
+
+namespace {
+const int initialReconnectDelay = 1000;
+}
+
+CReplicator::CReplicator(CTranslator *translator, CStatistics *stats, QObject *parent)
+    : QObject(parent),
+      m_translator(translator),
+      m_stats(stats)
+{
+    m_clock.start();
+    m_flushTimer.setInterval(CDefaults::replicationFlushInterval);
+    connect(&m_flushTimer,&QTimer::timeout,this,&CReplicator::flush);
+}
+
+CReplicator::~CReplicator()
+{
+    stop();
+}
+
+void CReplicator::setCredentials(const QSslKey &privateKey, const QSslCertificate &certificate)
+{
+    m_privateKey = privateKey;
+    m_certificate = certificate;
+}
+
+void CReplicator::start(const QStringList &peers, const QString &token)
+{
+    stop();
+    m_token = token;
+
+    for (const QString &peer : peers) {
+        const int sep = peer.lastIndexOf(QChar(':'));
+        bool ok = false;
+        const quint16 port = peer.mid(sep + 1).toUShort(&ok);
+        if (sep <= 0 || !ok) {
+            qWarning() << "Invalid replication peer" << peer;
+            continue;
+        }
+
+        QSharedPointer<CPeer> p(new CPeer());
+        p->host = peer.left(sep);
+        p->port = port;
+        {
+            QMutexLocker locker(&m_queueMutex);
+            m_peers.append(p);
+        }
+        connectPeer(p.data());
+    }
+
+    if (!m_peers.isEmpty())
+        m_flushTimer.start();
+}
+
+void CReplicator::stop()
+{
+    m_flushTimer.stop();
+
+    QMutexLocker locker(&m_queueMutex);
+    for (const auto &p : qAsConst(m_peers)) {
+        if (p->socket) {
+            p->socket->disconnect(this);
+            p->socket->abort();
+            p->socket->deleteLater();
+        }
+    }
+    m_peers.clear();
+}
+
+void CReplicator::connectPeer(CPeer *peer)
+{
+    if (peer->socket) {
+        peer->socket->disconnect(this);
+        peer->socket->abort();
+        peer->socket->deleteLater();
+    }
+
+    auto *socket = new QSslSocket(this);
+    peer->socket = socket;
+    peer->state = Peer_Disconnected;
+    {
+        QMutexLocker locker(&m_queueMutex);
+        peer->inFlight = 0;
+    }
+
+    socket->setPrivateKey(m_privateKey);
+    socket->setLocalCertificate(m_certificate);
+    // Service certificate is usually self-signed, peer is checked by pinning after handshake.
+    socket->setPeerVerifyMode(QSslSocket::VerifyNone);
+
+    connect(socket,&QSslSocket::encrypted,this,[this,peer]{
+        peerEncrypted(peer);
+    });
+    connect(socket,&QSslSocket::readyRead,this,[this,peer]{
+        peerReadyRead(peer);
+    });
+    connect(socket,&QAbstractSocket::stateChanged,this,[this,peer](QAbstractSocket::SocketState state){
+        if (state == QAbstractSocket::UnconnectedState)
+            peerDisconnected(peer);
+    });
+
+    socket->connectToHostEncrypted(peer->host,peer->port);
+}
+
+void CReplicator::peerEncrypted(CPeer *peer)
+{
+    if (peer->socket->peerCertificate() != m_certificate) {
+        qWarning() << "Replication peer" << peer->host << "presented unknown certificate";
+        peer->socket->abort();
+        return;
+    }
+
+    peer->state = Peer_Authenticating;
+    peer->socket->write(QSL("INIT:%1\r\n").arg(m_token).toLatin1());
+}
+
+void CReplicator::peerReadyRead(CPeer *peer)
+{
+    while (peer->socket && peer->socket->canReadLine()) {
+        const QByteArray line = peer->socket->readLine().trimmed();
+        if (line.startsWith("ERR")) {
+            qWarning() << "Replication peer" << peer->host << "replied" << line;
+            peer->socket->abort();
+            return;
+        }
+
+        bool needResync = false;
+        if (peer->state == Peer_Authenticating) {
+            peer->state = Peer_Ready;
+            peer->reconnectDelay = initialReconnectDelay;
+            m_stats->add(QSL("repl.connects"));
+            qInfo() << "Replication peer connected:" << peer->host << peer->port;
+            QMutexLocker locker(&m_queueMutex);
+            needResync = peer->needResync;
+
+        } else if (peer->inFlight > 0) {
+            QMutexLocker locker(&m_queueMutex);
+            peer->queue.remove(0,peer->inFlight);
+            m_stats->add(QSL("repl.sent"),peer->inFlight);
+            peer->inFlight = 0;
+            // Entries were dropped on overflow, resync when connected peer caught up.
+            needResync = peer->needResync && (peer->queue.count() < CDefaults::replicationQueueSize / 2);
+        }
+
+        if (needResync)
+            resync(peer);
+
+        sendBatch(peer);
+    }
+}
+
+void CReplicator::peerDisconnected(CPeer *peer)
+{
+    if (peer->state != Peer_Disconnected)
+        qWarning() << "Replication peer disconnected:" << peer->host << peer->port;
+
+    // Unacknowledged batch stays in queue and is sent again.
+    peer->state = Peer_Disconnected;
+    {
+        QMutexLocker locker(&m_queueMutex);
+        peer->inFlight = 0;
+    }
+    m_stats->add(QSL("repl.disconnects"));
+
+    // Peer may be removed by stop() before timer fires.
+    QWeakPointer<CPeer> weakPeer;
+    for (const auto &p : qAsConst(m_peers)) {
+        if (p.data() == peer)
+            weakPeer = p;
+    }
+
+    const int delay = peer->reconnectDelay;
+    peer->reconnectDelay = qMin(peer->reconnectDelay * 2,CDefaults::replicationMaxReconnectDelay);
+    QTimer::singleShot(delay,this,[this,weakPeer]{
+        const QSharedPointer<CPeer> p = weakPeer.toStrongRef();
+        if (p && p->state == Peer_Disconnected)
+            connectPeer(p.data());
+    });
+}
+
+void CReplicator::resync(CPeer *peer)
+{
+    if (m_translator.isNull()) return;
+
+    // Peer missed some results, send the hot part of our cache before new ones.
+    const QVector<CResultCache::CHotEntry> hot = m_translator->hotEntries(CDefaults::replicationResyncEntries);
+    QVector<CEntry> entries;
+    entries.reserve(hot.count());
+    const qint64 now = m_clock.elapsed();
+    for (const auto &entry : hot)
+        entries.append({ entry.key, entry.value, now });
+
+    QMutexLocker locker(&m_queueMutex);
+    peer->queue = entries + peer->queue;
+    peer->needResync = false;
+    m_stats->add(QSL("repl.resyncs"));
+}
+
+QByteArray CReplicator::encodeBatch(const QVector<CEntry> &entries, int count)
+{
+    // key:value pairs separated by commas, both parts are percent-encoded.
+    QByteArray res;
+    for (int i = 0; i < count; i++) {
+        if (i > 0)
+            res.append(',');
+        res.append(entries.at(i).key.toUtf8().toPercentEncoding());
+        res.append(':');
+        res.append(entries.at(i).value.toUtf8().toPercentEncoding());
+    }
+    return res;
+}
+
+void CReplicator::sendBatch(CPeer *peer)
+{
+    if (peer->state != Peer_Ready || peer->inFlight > 0) return;
+
+    QByteArray payload;
+    {
+        QMutexLocker locker(&m_queueMutex);
+        if (peer->queue.isEmpty()) return;
+
+        peer->inFlight = qMin(peer->queue.count(),CDefaults::replicationBatchSize);
+        payload = encodeBatch(peer->queue,peer->inFlight);
+    }
+
+    peer->socket->write("REPL:");
+    peer->socket->write(payload);
+    peer->socket->write("\r\n");
+    m_stats->add(QSL("repl.batches"));
+}
+
+void CReplicator::enqueue(const QString &key, const QString &value)
+{
+    const qint64 now = m_clock.elapsed();
+
+    QMutexLocker locker(&m_queueMutex);
+    for (const auto &p : qAsConst(m_peers)) {
+        // Lag is bounded by queue size, dropped entries are covered by resync.
+        if (p->queue.count() >= CDefaults::replicationQueueSize && p->queue.count() > p->inFlight) {
+            p->queue.remove(p->inFlight);
+            p->needResync = true;
+            m_stats->add(QSL("repl.dropped"));
+        }
+        p->queue.append({ key, value, now });
+    }
+}
+
+void CReplicator::flush()
+{
+    int ready = 0;
+    for (const auto &p : qAsConst(m_peers)) {
+        sendBatch(p.data());
+        if (p->state == Peer_Ready)
+            ready++;
+    }
+
+    qint64 queued = 0;
+    qint64 lag = 0;
+    const qint64 now = m_clock.elapsed();
+    {
+        QMutexLocker locker(&m_queueMutex);
+        for (const auto &p : qAsConst(m_peers)) {
+            queued += p->queue.count();
+            if (!p->queue.isEmpty())
+                lag = qMax(lag,now - p->queue.first().queued);
+        }
+    }
+
+    m_stats->set(QSL("repl.peersReady"),ready);
+    m_stats->set(QSL("repl.queued"),queued);
+    m_stats->set(QSL("repl.lagMs"),lag);
+}
+
+int CReplicator::applyBatch(const QByteArray &payload)
+{
+    int res = 0;
+    for (const QByteArray &item : payload.split(',')) {
+        const int sep = item.indexOf(':');
+        if (sep <= 0) continue;
+
+        const QString key = QString::fromUtf8(QByteArray::fromPercentEncoding(item.left(sep)));
+        const QString value = QString::fromUtf8(QByteArray::fromPercentEncoding(item.mid(sep + 1)));
+        if (m_translator && m_translator->applyReplicated(key,value))
+            res++;
+    }
+
+    m_stats->add(QSL("repl.received"),res);
+    return res;
+}
@@ -0,0 +1,100 @@
+#ifndef CREPLICATOR_H
+#define CREPLICATOR_H
+
+#include <QObject>
+#include <QPointer>
+#include <QSslSocket>
+#include <QSslKey>
+#include <QSslCertificate>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QMutex>
+#include <QVector>
+#include <QSharedPointer>
+#include "translator.h"
+#include "stats.h"
+
+namespace CDefaults {
+const int replicationBatchSize = 256;
+const int replicationQueueSize = 50000;
+const int replicationFlushInterval = 200;
+const int replicationMaxReconnectDelay = 30000;
+const int replicationResyncEntries = 10000;
+}
+
+// Ships newly translated results to standby nodes. Each peer is connected
+// with service TLS credentials (peer must present the same certificate)
+// and authenticated with replication token (Server/replicationToken, the
+// same on all nodes), then receives REPL: batches. One
+// batch is in flight per peer, unacknowledged entries are resent after
+// reconnect. Queue is bounded, after overflow the peer is resynced from
+// hot cache entries once its backlog drains below half of the bound.
+class CReplicator : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CReplicator)
+public:
+    CReplicator(CTranslator *translator, CStatistics *stats, QObject *parent = nullptr);
+    ~CReplicator() override;
+
+    void setCredentials(const QSslKey &privateKey, const QSslCertificate &certificate);
+    // Peers in "host:port" form.
+    void start(const QStringList &peers, const QString &token);
+    void stop();
+
+    // Receiving side, returns number of accepted entries.
+    int applyBatch(const QByteArray &payload);
+
+public Q_SLOTS:
+    // Thread-safe.
+    void enqueue(const QString &key, const QString &value);
+
+private:
+    enum PeerState {
+        Peer_Disconnected,
+        Peer_Authenticating,
+        Peer_Ready
+    };
+
+    struct CEntry {
+        QString key;
+        QString value;
+        qint64 queued;
+    };
+
+    // Queue, inFlight and needResync are shared with enqueue() callers and
+    // guarded by m_queueMutex, other fields are used on main thread only.
+    struct CPeer {
+        QString host;
+        quint16 port { 0 };
+        QPointer<QSslSocket> socket;
+        PeerState state { Peer_Disconnected };
+        QVector<CEntry> queue;
+        int inFlight { 0 };
+        bool needResync { true };
+        int reconnectDelay { 1000 };
+    };
+
+    QPointer<CTranslator> m_translator;
+    QPointer<CStatistics> m_stats;
+    QSslKey m_privateKey;
+    QSslCertificate m_certificate;
+    QString m_token;
+    QTimer m_flushTimer;
+    QElapsedTimer m_clock;
+
+    QMutex m_queueMutex;
+    QVector<QSharedPointer<CPeer> > m_peers;
+
+    void connectPeer(CPeer *peer);
+    void peerEncrypted(CPeer *peer);
+    void peerReadyRead(CPeer *peer);
+    void peerDisconnected(CPeer *peer);
+    void resync(CPeer *peer);
+    void sendBatch(CPeer *peer);
+    void flush();
+
+    static QByteArray encodeBatch(const QVector<CEntry> &entries, int count);
+};
+
+#endif // CREPLICATOR_H
@@ -0,0 +1,556 @@
+#include <QMutexLocker>
+#include <QTextCodec>
+#include <cstring>
+#include <algorithm>
+#include "resultcache.h"
+#include "deflate.h"
+#include "qsl.h"
+
+namespace {
+const int averageEntryCost = 128;
+const int minIndexSize = 64;
+const int minArenaCompaction = 64 * 1024;
+// Dead arena space is kept under a quarter of arena, so memory stays within
+// about 4/3 of the budget between compactions.
+const int maxArenaDeadPercent = 25;
+const int maxPackedSize = 0xffff;
+
+QTextCodec *sjisCodec()
+{
+    static QTextCodec *codec = QTextCodec::codecForName("SJIS");
+    return codec;
+}
+}
+
+CResultCache::CResultCache(int maxBytes, Policy policy)
+{
+    setPolicy(policy);
+    setMaxBytes(maxBytes);
+}
+
+QString CResultCache::makeKey(CAtlas::AtlasDirection direction, const QString &environment,
+                              int version, const QString &text)
+{
+    return QSL("%1|%2|%3|%4").arg(static_cast<int>(direction)).arg(version).arg(environment,text);
+}
+
+CResultCache::Policy CResultCache::policyFromString(const QString &name)
+{
+    if (name.compare(QSL("lru"),Qt::CaseInsensitive) == 0)
+        return Policy_LRU;
+
+    return Policy_TinyLFU;
+}
+
+bool CResultCache::isLatin1(const QString &str)
+{
+    return std::all_of(str.constBegin(),str.constEnd(),[](QChar c){ return c.unicode() <= 0xff; });
+}
+
+QByteArray CResultCache::encodeKey(const QString &key, quint8 &encoding)
+{
+    // Keys are compared byte-wise on every lookup, so they skip SJIS conversion
+    // and its round-trip check, only values are packed tightly at insert.
+    if (isLatin1(key)) {
+        encoding = Encoding_Latin1;
+        return key.toLatin1();
+    }
+
+    encoding = Encoding_UTF8;
+    return key.toUtf8();
+}
+
+QByteArray CResultCache::encode(const QString &str, quint8 &encoding)
+{
+    if (isLatin1(str)) {
+        encoding = Encoding_Latin1;
+        return str.toLatin1();
+    }
+
+    // Japanese text takes 2 bytes per character in SJIS and 3 in UTF-8.
+    // SJIS mapping is not bijective for some symbols, so check round trip.
+    if (QTextCodec *codec = sjisCodec()) {
+        QTextCodec::ConverterState state(QTextCodec::IgnoreHeader | QTextCodec::ConvertInvalidToNull);
+        const QByteArray res = codec->fromUnicode(str.constData(),str.size(),&state);
+        if (state.invalidChars == 0 && decode(res.constData(),res.size(),Encoding_SJIS) == str) {
+            encoding = Encoding_SJIS;
+            return res;
+        }
+    }
+
+    encoding = Encoding_UTF8;
+    return str.toUtf8();
+}
+
+QString CResultCache::decode(const char *data, int size, quint8 encoding)
+{
+    switch (encoding & Encoding_Mask) {
+        case Encoding_Latin1:
+            return QString::fromLatin1(data,size);
+        case Encoding_SJIS: {
+            QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+            return sjisCodec()->toUnicode(data,size,&state);
+        }
+        default:
+            return QString::fromUtf8(data,size);
+    }
+}
+
+bool CResultCache::packValue(const QString &value, QByteArray &data, quint8 &encoding, int &rawSize)
+{
+    data = encode(value,encoding);
+    rawSize = data.size();
+    if (rawSize > maxPackedSize) return false;
+    if (!m_compression || rawSize < CDefaults::cacheCompressThreshold) return true;
+
+    // First long values become compression dictionary, it never changes later.
+    if (!m_dictionaryReady.load(std::memory_order_acquire)) {
+        QMutexLocker locker(&m_dictionaryMutex);
+        if (!m_dictionaryReady.load(std::memory_order_relaxed)) {
+            m_samples.append(data);
+            if (m_samples.size() >= CDeflate::maxDictionarySize) {
+                m_dictionary = m_samples.right(CDeflate::maxDictionarySize);
+                m_samples.clear();
+                m_dictionaryReady.store(true,std::memory_order_release);
+            }
+            return true;
+        }
+    }
+
+    QByteArray packed;
+    if (CDeflate::compress(data,m_dictionary,packed) && packed.size() < data.size()) {
+        data = packed;
+        encoding |= Encoding_Deflate;
+        m_compressed++;
+    }
+    return true;
+}
+
+bool CResultCache::unpackValue(const CShard &s, const CNode &node, QString &value) const
+{
+    const char *data = s.arena.constData() + node.offset + node.keySize;
+    const quint8 encoding = node.encodings >> 4;
+    if ((encoding & Encoding_Deflate) == 0) {
+        value = decode(data,node.valueSize,encoding);
+        return true;
+    }
+
+    QByteArray raw;
+    if (!CDeflate::decompress(data,node.valueSize,m_dictionary,node.rawValueSize,raw))
+        return false;
+
+    value = decode(raw.constData(),raw.size(),encoding);
+    return true;
+}
+
+int CResultCache::nodeCost(const CNode &node)
+{
+    // Index is kept under 75% load, so one node takes up to two slots.
+    return node.keySize + node.valueSize + static_cast<int>(sizeof(CNode) + 2 * sizeof(CSlot));
+}
+
+int CResultCache::slotPosition(const CShard &s, quint32 hash)
+{
+    // Low bits select shard.
+    return static_cast<int>(hash >> 4) & (s.index.size() - 1);
+}
+
+int CResultCache::findNode(const CShard &s, quint32 hash, const QByteArray &key, quint8 keyEncoding) const
+{
+    if (s.index.isEmpty()) return -1;
+
+    const int mask = s.index.size() - 1;
+    for (int pos = slotPosition(s,hash);; pos = (pos + 1) & mask) {
+        const CSlot &slot = s.index.at(pos);
+        if (slot.node < 0) return -1;
+        if (slot.hash != hash) continue;
+
+        const CNode &node = s.nodes.at(slot.node);
+        if ((node.encodings & 0x0f) == keyEncoding && node.keySize == key.size() &&
+                std::memcmp(s.arena.constData() + node.offset,key.constData(),
+                            static_cast<size_t>(key.size())) == 0)
+            return slot.node;
+    }
+}
+
+void CResultCache::insertSlot(CShard &s, quint32 hash, qint32 node)
+{
+    if ((s.count + 1) * 4 > s.index.size() * 3)
+        growIndex(s);
+
+    const int mask = s.index.size() - 1;
+    int pos = slotPosition(s,hash);
+    while (s.index.at(pos).node >= 0)
+        pos = (pos + 1) & mask;
+    s.index[pos] = { hash, node };
+}
+
+void CResultCache::removeSlot(CShard &s, int pos)
+{
+    // Backward shift deletion keeps probe sequences without tombstones.
+    const int mask = s.index.size() - 1;
+    int hole = pos;
+    for (int i = (pos + 1) & mask; s.index.at(i).node >= 0; i = (i + 1) & mask) {
+        const int home = slotPosition(s,s.index.at(i).hash);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            s.index[hole] = s.index.at(i);
+            hole = i;
+        }
+    }
+    s.index[hole].node = -1;
+}
+
+void CResultCache::growIndex(CShard &s)
+{
+    const QVector<CSlot> old = s.index;
+    s.index.fill({ 0, -1 },qMax(minIndexSize,old.size() * 2));
+
+    const int mask = s.index.size() - 1;
+    for (const CSlot &slot : old) {
+        if (slot.node < 0) continue;
+
+        int pos = slotPosition(s,slot.hash);
+        while (s.index.at(pos).node >= 0)
+            pos = (pos + 1) & mask;
+        s.index[pos] = slot;
+    }
+}
+
+void CResultCache::compactArena(CShard &s)
+{
+    if (s.arenaDead < minArenaCompaction ||
+            static_cast<qint64>(s.arenaDead) * 100 < static_cast<qint64>(s.arena.size()) * maxArenaDeadPercent)
+        return;
+
+    QByteArray arena;
+    arena.reserve(s.arena.size() - s.arenaDead);
+    for (int queue = 0; queue < Queue_Count; queue++) {
+        for (qint32 n = s.heads.at(queue); n >= 0; n = s.nodes.at(n).next) {
+            CNode &node = s.nodes[n];
+            const quint32 offset = static_cast<quint32>(arena.size());
+            arena.append(s.arena.constData() + node.offset,node.keySize + node.valueSize);
+            node.offset = offset;
+        }
+    }
+    s.arena = arena;
+    s.arenaDead = 0;
+}
+
+void CResultCache::link(CShard &s, qint32 node, Queue queue)
+{
+    CNode &n = s.nodes[node];
+    n.prev = -1;
+    n.next = s.heads.at(queue);
+    n.queue = static_cast<quint8>(queue);
+    if (n.next >= 0) {
+        s.nodes[n.next].prev = node;
+    } else {
+        s.tails[queue] = node;
+    }
+    s.heads[queue] = node;
+    s.queueBytes[queue] += nodeCost(n);
+}
+
+void CResultCache::unlink(CShard &s, qint32 node)
+{
+    CNode &n = s.nodes[node];
+    if (n.prev >= 0) {
+        s.nodes[n.prev].next = n.next;
+    } else {
+        s.heads[n.queue] = n.next;
+    }
+    if (n.next >= 0) {
+        s.nodes[n.next].prev = n.prev;
+    } else {
+        s.tails[n.queue] = n.prev;
+    }
+    s.queueBytes[n.queue] -= nodeCost(n);
+}
+
+void CResultCache::moveTo(CShard &s, qint32 node, Queue queue)
+{
+    unlink(s,node);
+    link(s,node,queue);
+}
+
+void CResultCache::remove(CShard &s, qint32 node)
+{
+    const int mask = s.index.size() - 1;
+    int pos = slotPosition(s,s.nodes.at(node).hash);
+    while (s.index.at(pos).node != node)
+        pos = (pos + 1) & mask;
+    removeSlot(s,pos);
+
+    unlink(s,node);
+    CNode &n = s.nodes[node];
+    s.arenaDead += n.keySize + n.valueSize;
+    n.queue = Queue_Count;
+    s.freeNodes.append(node);
+    s.count--;
+}
+
+void CResultCache::onAccess(CShard &s, qint32 node)
+{
+    const Queue queue = static_cast<Queue>(s.nodes.at(node).queue);
+    if (queue != Queue_Probation) {
+        moveTo(s,node,queue);
+        return;
+    }
+
+    moveTo(s,node,Queue_Protected);
+    // Protected segment overflow goes back to probation, not out of cache.
+    const qint64 windowMax = s.maxBytes * CDefaults::cacheWindowPercent / 100;
+    const qint64 protectedMax = (s.maxBytes - windowMax) * CDefaults::cacheProtectedPercent / 100;
+    while (s.queueBytes.at(Queue_Protected) > protectedMax && s.tails.at(Queue_Protected) != s.heads.at(Queue_Protected))
+        moveTo(s,s.tails.at(Queue_Protected),Queue_Probation);
+}
+
+void CResultCache::evict(CShard &s)
+{
+    auto totalBytes = [&s]{
+        return s.queueBytes.at(Queue_Window) + s.queueBytes.at(Queue_Probation) + s.queueBytes.at(Queue_Protected);
+    };
+
+    if (s.policy == Policy_LRU) {
+        while (totalBytes() > s.maxBytes && s.tails.at(Queue_Window) >= 0) {
+            remove(s,s.tails.at(Queue_Window));
+            m_evictions++;
+        }
+        compactArena(s);
+        return;
+    }
+
+    const qint64 windowMax = s.maxBytes * CDefaults::cacheWindowPercent / 100;
+    const qint64 mainMax = s.maxBytes - windowMax;
+
+    // Entries leaving the window are admitted to main segment only when
+    // they are used more often than the ones they would displace.
+    while (s.queueBytes.at(Queue_Window) > windowMax && s.tails.at(Queue_Window) >= 0) {
+        const qint32 candidate = s.tails.at(Queue_Window);
+        const int candidateCost = nodeCost(s.nodes.at(candidate));
+        const int candidateFreq = s.sketch.frequency(s.nodes.at(candidate).hash);
+
+        bool admitted = true;
+        while (s.queueBytes.at(Queue_Probation) + s.queueBytes.at(Queue_Protected) + candidateCost > mainMax) {
+            const Queue victimQueue = (s.tails.at(Queue_Probation) >= 0) ? Queue_Probation : Queue_Protected;
+            const qint32 victim = s.tails.at(victimQueue);
+            if (victim < 0 || candidateFreq <= s.sketch.frequency(s.nodes.at(victim).hash)) {
+                admitted = false;
+                break;
+            }
+            remove(s,victim);
+            m_evictions++;
+        }
+
+        if (admitted) {
+            moveTo(s,candidate,Queue_Probation);
+        } else {
+            remove(s,candidate);
+            m_rejections++;
+        }
+    }
+
+    // Cache size was reduced.
+    for (const Queue queue : { Queue_Probation, Queue_Protected, Queue_Window }) {
+        while (totalBytes() > s.maxBytes && s.tails.at(queue) >= 0) {
+            remove(s,s.tails.at(queue));
+            m_evictions++;
+        }
+    }
+
+    compactArena(s);
+}
+
+bool CResultCache::lookup(const QString &key, QString &value)
+{
+    quint8 keyEncoding = 0;
+    const QByteArray k = encodeKey(key,keyEncoding);
+    const quint32 hash = qHash(key);
+
+    CShard &s = m_shards[hash % CDefaults::cacheShards];
+    QMutexLocker locker(&s.mutex);
+    if (s.policy == Policy_TinyLFU)
+        s.sketch.increment(hash);
+
+    const int node = findNode(s,hash,k,keyEncoding);
+    if (node < 0 || !unpackValue(s,s.nodes.at(node),value)) {
+        m_misses++;
+        return false;
+    }
+
+    onAccess(s,node);
+    m_hits++;
+    return true;
+}
+
+void CResultCache::insert(const QString &key, const QString &value)
+{
+    quint8 keyEncoding = 0;
+    const QByteArray k = encodeKey(key,keyEncoding);
+    if (k.size() > maxPackedSize) return;
+
+    QByteArray v;
+    quint8 valueEncoding = 0;
+    int rawSize = 0;
+    if (!packValue(value,v,valueEncoding,rawSize) || v.size() > maxPackedSize) return;
+
+    const quint32 hash = qHash(key);
+    CShard &s = m_shards[hash % CDefaults::cacheShards];
+    QMutexLocker locker(&s.mutex);
+
+    // Updated entry keeps its queue, as if it was accessed.
+    Queue queue = Queue_Window;
+    const int existing = findNode(s,hash,k,keyEncoding);
+    if (existing >= 0) {
+        queue = static_cast<Queue>(s.nodes.at(existing).queue);
+        remove(s,existing);
+    }
+
+    CNode n {};
+    n.hash = hash;
+    n.offset = static_cast<quint32>(s.arena.size());
+    n.keySize = static_cast<quint16>(k.size());
+    n.valueSize = static_cast<quint16>(v.size());
+    n.rawValueSize = static_cast<quint16>(rawSize);
+    n.encodings = static_cast<quint8>(keyEncoding | (valueEncoding << 4));
+    if (nodeCost(n) > s.maxBytes) return;
+
+    qint32 node = -1;
+    if (s.freeNodes.isEmpty()) {
+        node = s.nodes.count();
+        s.nodes.append(n);
+    } else {
+        node = s.freeNodes.takeLast();
+        s.nodes[node] = n;
+    }
+    s.arena.append(k);
+    s.arena.append(v);
+    insertSlot(s,hash,node);
+    s.count++;
+    link(s,node,queue);
+    if (existing >= 0)
+        onAccess(s,node);
+
+    evict(s);
+}
+
+void CResultCache::clearShard(CShard &s)
+{
+    s.nodes.clear();
+    s.freeNodes.clear();
+    s.index.clear();
+    s.count = 0;
+    s.arena.clear();
+    s.arenaDead = 0;
+    s.heads.fill(-1);
+    s.tails.fill(-1);
+    s.queueBytes.fill(0);
+    s.sketch.clear();
+}
+
+void CResultCache::clear()
+{
+    for (auto &s : m_shards) {
+        QMutexLocker locker(&s.mutex);
+        clearShard(s);
+    }
+}
+
+void CResultCache::setMaxBytes(int maxBytes)
+{
+    for (auto &s : m_shards) {
+        QMutexLocker locker(&s.mutex);
+        s.maxBytes = maxBytes / CDefaults::cacheShards;
+        s.sketch.resize(static_cast<int>(s.maxBytes / averageEntryCost));
+        evict(s);
+    }
+}
+
+void CResultCache::setPolicy(Policy policy)
+{
+    for (auto &s : m_shards) {
+        QMutexLocker locker(&s.mutex);
+        if (s.policy == policy) continue;
+
+        clearShard(s);
+        s.policy = policy;
+    }
+}
+
+void CResultCache::setCompression(bool enabled)
+{
+    m_compression = enabled;
+}
+
+QVector<CResultCache::CHotEntry> CResultCache::hotEntries(int limit) const
+{
+    QVector<CHotEntry> res;
+    for (const auto &s : m_shards) {
+        QMutexLocker locker(&s.mutex);
+        for (const Queue queue : { Queue_Protected, Queue_Probation, Queue_Window }) {
+            for (qint32 n = s.heads.at(queue); n >= 0; n = s.nodes.at(n).next) {
+                const CNode &node = s.nodes.at(n);
+                CHotEntry entry;
+                if (!unpackValue(s,node,entry.value)) continue;
+
+                entry.key = decode(s.arena.constData() + node.offset,node.keySize,node.encodings & 0x0f);
+                entry.frequency = s.sketch.frequency(node.hash);
+                res.append(entry);
+            }
+        }
+    }
+
+    std::stable_sort(res.begin(),res.end(),[](const CHotEntry &a, const CHotEntry &b){
+        return a.frequency > b.frequency;
+    });
+    if (res.count() > limit)
+        res.resize(limit);
+    return res;
+}
+
+qint64 CResultCache::hits() const
+{
+    return m_hits;
+}
+
+qint64 CResultCache::misses() const
+{
+    return m_misses;
+}
+
+qint64 CResultCache::evictions() const
+{
+    return m_evictions;
+}
+
+qint64 CResultCache::rejections() const
+{
+    return m_rejections;
+}
+
+qint64 CResultCache::compressed() const
+{
+    return m_compressed;
+}
+
+qint64 CResultCache::bytes() const
+{
+    qint64 res = 0;
+    for (const auto &s : m_shards) {
+        QMutexLocker locker(&s.mutex);
+        for (const qint64 queueBytes : s.queueBytes)
+            res += queueBytes;
+        res += s.arenaDead;
+    }
+    return res;
+}
+
+qint64 CResultCache::count() const
+{
+    qint64 res = 0;
+    for (const auto &s : m_shards) {
+        QMutexLocker locker(&s.mutex);
+        res += s.count;
+    }
+    return res;
+}
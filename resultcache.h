@@ -0,0 +1,155 @@
+#ifndef CRESULTCACHE_H
+#define CRESULTCACHE_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <array>
+#include <atomic>
+#include "atlas.h"
+#include "frequencysketch.h"
+
+namespace CDefaults {
+const int cacheShards = 16;
+const int cacheMaxBytes = 32 * 1024 * 1024;
+const int cacheWindowPercent = 1;
+const int cacheProtectedPercent = 80;
+const int cacheCompressThreshold = 160;
+}
+
+// In-memory translation cache, sharded by key hash to keep lock contention
+// low with concurrent translations. Bounded by approximate memory size.
+// TinyLFU policy: new entries pass small LRU window, then compete for the
+// main segmented LRU by estimated access frequency, so one-time bulk
+// lookups do not flush frequently used entries.
+// Keys are packed to per-shard arena as Latin-1 or UTF-8, values as Latin-1,
+// SJIS or UTF-8, whichever fits, long values are optionally deflated with
+// dictionary trained on first stored values. Index is open addressing table with
+// inline hashes, queues are linked by node numbers.
+class CResultCache
+{
+public:
+    enum Policy {
+        Policy_LRU,
+        Policy_TinyLFU
+    };
+
+    struct CHotEntry {
+        QString key;
+        QString value;
+        int frequency;
+    };
+
+    explicit CResultCache(int maxBytes = CDefaults::cacheMaxBytes, Policy policy = Policy_TinyLFU);
+
+    static QString makeKey(CAtlas::AtlasDirection direction, const QString &environment,
+                           int version, const QString &text);
+    static Policy policyFromString(const QString &name);
+
+    bool lookup(const QString &key, QString &value);
+    void insert(const QString &key, const QString &value);
+    void clear();
+    void setMaxBytes(int maxBytes);
+    void setPolicy(Policy policy);
+    void setCompression(bool enabled);
+    // Most frequently used entries, recently used first among equal ones.
+    QVector<CHotEntry> hotEntries(int limit) const;
+
+    qint64 hits() const;
+    qint64 misses() const;
+    qint64 evictions() const;
+    qint64 rejections() const;
+    qint64 compressed() const;
+    qint64 bytes() const;
+    qint64 count() const;
+
+private:
+    Q_DISABLE_COPY(CResultCache)
+
+    enum Queue {
+        Queue_Window,
+        Queue_Probation,
+        Queue_Protected,
+        Queue_Count
+    };
+
+    enum Encoding {
+        Encoding_Latin1 = 0,
+        Encoding_SJIS = 1,
+        Encoding_UTF8 = 2,
+        Encoding_Mask = 3,
+        Encoding_Deflate = 4
+    };
+
+    struct CNode {
+        quint32 hash;
+        quint32 offset; // key bytes, followed by value bytes
+        qint32 prev;
+        qint32 next;
+        quint16 keySize;
+        quint16 valueSize;
+        quint16 rawValueSize; // before compression
+        quint8 encodings; // key in low, value in high nibble
+        quint8 queue;
+    };
+
+    struct CSlot {
+        quint32 hash;
+        qint32 node; // -1 for empty slot
+    };
+
+    struct CShard {
+        mutable QMutex mutex;
+        QVector<CNode> nodes;
+        QVector<qint32> freeNodes;
+        QVector<CSlot> index;
+        int count { 0 };
+        QByteArray arena;
+        int arenaDead { 0 };
+        std::array<qint32,Queue_Count> heads { { -1, -1, -1 } };
+        std::array<qint32,Queue_Count> tails { { -1, -1, -1 } };
+        std::array<qint64,Queue_Count> queueBytes {};
+        qint64 maxBytes { 0 };
+        Policy policy { Policy_TinyLFU };
+        CFrequencySketch sketch;
+    };
+
+    std::array<CShard,CDefaults::cacheShards> m_shards;
+    std::atomic<qint64> m_hits { 0 };
+    std::atomic<qint64> m_misses { 0 };
+    std::atomic<qint64> m_evictions { 0 };
+    std::atomic<qint64> m_rejections { 0 };
+    std::atomic<qint64> m_compressed { 0 };
+
+    std::atomic<bool> m_compression { false };
+    QMutex m_dictionaryMutex;
+    QByteArray m_samples;
+    QByteArray m_dictionary; // read-only after m_dictionaryReady is set
+    std::atomic<bool> m_dictionaryReady { false };
+
+    static bool isLatin1(const QString &str);
+    static QByteArray encodeKey(const QString &key, quint8 &encoding);
+    static QByteArray encode(const QString &str, quint8 &encoding);
+    static QString decode(const char *data, int size, quint8 encoding);
+    bool packValue(const QString &value, QByteArray &data, quint8 &encoding, int &rawSize);
+    bool unpackValue(const CShard &s, const CNode &node, QString &value) const;
+
+    static int nodeCost(const CNode &node);
+    static int slotPosition(const CShard &s, quint32 hash);
+    int findNode(const CShard &s, quint32 hash, const QByteArray &key, quint8 keyEncoding) const;
+    void insertSlot(CShard &s, quint32 hash, qint32 node);
+    void removeSlot(CShard &s, int pos);
+    void growIndex(CShard &s);
+    void compactArena(CShard &s);
+
+    void link(CShard &s, qint32 node, Queue queue);
+    void unlink(CShard &s, qint32 node);
+    void moveTo(CShard &s, qint32 node, Queue queue);
+    void remove(CShard &s, qint32 node);
+    void onAccess(CShard &s, qint32 node);
+    void evict(CShard &s);
+    void clearShard(CShard &s);
+};
+
+#endif // CRESULTCACHE_H
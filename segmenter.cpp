@@ -0,0 +1,76 @@
+#include <algorithm>
+#include "segmenter.h"
+
+bool CSegmenter::isTerminator(ushort c)
+{
+    switch (c) {
+        case 0x3002: // 。
+        case 0xff01: // ！
+        case 0xff1f: // ？
+        case 0x2026: // …
+        case 0x300d: // 」
+            return true;
+        default:
+            return false;
+    }
+}
+
+void CSegmenter::appendText(QVector<CTextSegment> &segments, const QString &str, int start, int end)
+{
+    if (start >= end) return;
+
+    const QChar *data = str.constData();
+    int textStart = start;
+    while (textStart < end && data[textStart].isSpace())
+        textStart++;
+    int textEnd = end;
+    while (textEnd > textStart && data[textEnd-1].isSpace())
+        textEnd--;
+
+    if (textStart > start)
+        segments.append({ str.mid(start,textStart-start), false });
+
+    if (textEnd > textStart) {
+        const bool translatable = std::any_of(data + textStart, data + textEnd, [](QChar c){
+            return c.isLetterOrNumber();
+        });
+        segments.append({ str.mid(textStart,textEnd-textStart), translatable });
+    }
+
+    if (end > textEnd)
+        segments.append({ str.mid(textEnd,end-textEnd), false });
+}
+
+QVector<CTextSegment> CSegmenter::split(const QString &str)
+{
+    QVector<CTextSegment> res;
+
+    const QChar *data = str.constData();
+    const int len = str.length();
+    int start = 0;
+    int pos = 0;
+    while (pos < len) {
+        const ushort c = data[pos].unicode();
+        if (c == '\n' || c == '\r') {
+            appendText(res,str,start,pos);
+            int end = pos + 1;
+            while (end < len && (data[end] == QChar('\n') || data[end] == QChar('\r')))
+                end++;
+            res.append({ str.mid(pos,end-pos), false });
+            start = pos = end;
+
+        } else if (isTerminator(c)) {
+            int end = pos + 1;
+            while (end < len && isTerminator(data[end].unicode()))
+                end++;
+            appendText(res,str,start,end);
+            start = pos = end;
+
+        } else {
+            pos++;
+        }
+    }
+    appendText(res,str,start,len);
+
+    return res;
+}
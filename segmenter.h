@@ -0,0 +1,25 @@
+#ifndef CSEGMENTER_H
+#define CSEGMENTER_H
+
+#include <QString>
+#include <QVector>
+
+struct CTextSegment {
+    QString text;
+    bool translatable { false };
+};
+
+class CSegmenter
+{
+public:
+    // Splits text at Japanese sentence boundaries and line breaks.
+    // Whitespace, line breaks and punctuation-only runs are returned as
+    // non-translatable segments, so joining all texts gives back the input.
+    static QVector<CTextSegment> split(const QString &str);
+    static bool isTerminator(ushort c);
+
+private:
+    static void appendText(QVector<CTextSegment> &segments, const QString &str, int start, int end);
+};
+
+#endif // CSEGMENTER_H
@@ -1,6 +1,9 @@
 #include <QSettings>
 #include <QTcpSocket>
 #include <QUrl>
+#include <QDir>
+#include <QFutureWatcher>
+#include <QtConcurrent>
 #include "qtservice.h"
 #include "server.h"
 #include "service.h"
@@ -8,21 +11,60 @@
 #include "qsl.h"
 #include <QDebug>
 
-CServer::CServer(QObject *parent)
+CServer::CServer(QObject *parent, bool toolMode)
     : QTcpServer(parent),
+    m_toolMode(toolMode),
     m_atlasHost(QHostAddress(CDefaults::atlHost)),
-    m_atlas(new CAtlas(this))
+    m_atlas(new CAtlas(this)),
+    m_stats(new CStatistics(this)),
+    m_translator(new CTranslator(m_atlas,m_stats,this)),
+    m_persistentCache(new CPersistentCache(this)),
+    m_bundles(new CBundleSet(this)),
+    m_sharedCache(new CSharedCache(this)),
+    m_warmup(new CWarmup(m_translator,m_stats,this)),
+    m_replicator(new CReplicator(m_translator,m_stats,this)),
+    m_http(new CHttpServer(m_translator,m_stats,this)),
+    m_local(new QLocalServer(this))
 {
     loadSettings();
+    if (m_toolMode) {
+        m_persistentCacheEnabled = false;
+        m_sharedCacheEnabled = false;
+        m_warmupEnabled = false;
+        m_httpEnabled = false;
+        m_localEnabled = false;
+        m_replicationPeers.clear();
+        m_cacheTrace.clear();
+    }
+    m_translator->setCachePolicy(m_cachePolicy);
+    m_translator->setCacheSize(m_cacheSize);
+    m_translator->setContentStoreSize(m_contentStoreSize);
+    m_translator->configureFailureCache(m_failureCacheTtl,m_failureQuarantineCount,m_failureQuarantineLatency);
+    m_translator->setCacheTrace(m_cacheTrace);
+    m_translator->setCacheCompression(m_cacheCompression);
+    if (m_persistentCacheEnabled && m_persistentCache->open(m_persistentCacheDir,m_persistentCacheSize))
+        m_translator->setPersistentCache(m_persistentCache);
+    if (m_sharedCacheEnabled && m_sharedCache->open(m_sharedCacheName,m_sharedCacheSize))
+        m_translator->setSharedCache(m_sharedCache);
+    m_bundles->load(m_bundlesDir);
+    m_translator->setBundles(m_bundles);
     connect(this, &QTcpServer::newConnection, this, &CServer::acceptConnections);
+    connect(m_local, &QLocalServer::newConnection, this, &CServer::acceptLocalConnections);
+    connect(m_translator, &CTranslator::resultStored, m_replicator, &CReplicator::enqueue,
+            Qt::DirectConnection);
 
     if (!m_atlas->init(CAtlas::Atlas_JE, m_atlasEnv))
         qCritical() << "Unable to load ATLAS engine";
+
+    m_translator->loadSettings();
+    m_stats->addRatio(QSL("compression.ratio"),QSL("compression.wireBytes"),QSL("compression.rawBytes"));
 }
 
 CServer::~CServer()
 {
     closeSocket();
+    m_warmup->cancel();
+    saveCacheSnapshot();
 }
 
 bool CServer::start()
@@ -41,17 +83,52 @@ bool CServer::start()
     }
 
     listen(m_atlasHost, m_atlasPort);
+    if (m_httpEnabled) {
+        m_http->setTokens(m_clientTokens);
+        m_http->setBatchLimits(m_batchMaxItems,m_batchMaxBytes);
+        if (!m_http->listen(m_httpHost, m_httpPort)) {
+            qWarning() << "Unable to open HTTP port" << m_httpPort << m_http->errorString();
+        } else if (!m_httpHost.isLoopback()) {
+            qWarning() << "HTTP port is open on" << m_httpHost.toString()
+                       << "- client tokens are sent without encryption";
+        }
+    }
+    if (m_localEnabled) {
+        // Clients run under other accounts than the service.
+        m_local->setSocketOptions(QLocalServer::WorldAccessOption);
+        if (!m_local->listen(m_localName))
+            qWarning() << "Unable to open local socket" << m_localName << m_local->errorString();
+    }
+
+    m_started = true;
+    if (m_warmupEnabled)
+        m_warmup->start(m_warmupSnapshot,m_warmupAccessLog,m_warmupEntries);
+    if (!m_replicationPeers.isEmpty()) {
+        m_replicator->setCredentials(m_privateKey,m_serverCert);
+        m_replicator->start(m_replicationPeers,m_replicationToken);
+    }
     return true;
 }
 
 void CServer::pause()
 {
     m_disabled = true;
+    m_http->setDisabled(true);
+    saveCacheSnapshot();
+}
+
+void CServer::saveCacheSnapshot()
+{
+    // Tool modes do not run the server and should not overwrite snapshot.
+    if (!m_started || !m_warmupEnabled) return;
+
+    m_warmup->saveSnapshot(m_warmupSnapshot,m_warmupEntries);
 }
 
 void CServer::resume()
 {
     m_disabled = false;
+    m_http->setDisabled(false);
 }
 
 QHostAddress CServer::atlasHost() const
@@ -73,12 +150,20 @@ void CServer::deleteToken(const QString &token)
 {
     if (m_clientTokens.contains(token))
         m_clientTokens.removeAll(token);
+    m_http->setTokens(m_clientTokens);
 }
 
 void CServer::addToken(const QString &token)
 {
     if (!m_clientTokens.contains(token))
         m_clientTokens.append(token);
+    m_http->setTokens(m_clientTokens);
+}
+
+void CServer::setReplication(const QStringList &peers, const QString &token)
+{
+    m_replicationPeers = peers;
+    m_replicationToken = token;
 }
 
 void CServer::setServerCert(const QSslCertificate &serverCert)
@@ -109,6 +194,16 @@ QStringList CServer::atlasEnvironments() const
     return res;
 }
 
+CTranslator *CServer::translator() const
+{
+    return m_translator;
+}
+
+CStatistics *CServer::statistics() const
+{
+    return m_stats;
+}
+
 QStringList CServer::clientTokens() const
 {
     return m_clientTokens;
@@ -141,6 +236,41 @@ void CServer::loadSettings()
     m_atlasHost = QHostAddress(settings.value(QSL("host"),
         QHostAddress(CDefaults::atlHost).toIPv4Address()).toUInt());
     m_atlasEnv = settings.value(QSL("atlasEnvironment"),QSL("General")).toString();
+    m_cacheSize = settings.value(QSL("cacheSize"),CDefaults::cacheMaxBytes).toInt();
+    m_contentStoreSize = settings.value(QSL("contentStoreSize"),CDefaults::contentStoreMaxBytes).toInt();
+    m_documentSessionSize = settings.value(QSL("documentSessionSize"),CDefaults::documentSessionMaxBytes).toInt();
+    m_failureCacheTtl = settings.value(QSL("failureCacheTtl"),CDefaults::failureCacheTtl).toInt();
+    m_failureQuarantineCount = settings.value(QSL("failureQuarantineCount"),CDefaults::failureQuarantineCount).toInt();
+    m_failureQuarantineLatency = settings.value(QSL("failureQuarantineLatency"),
+                                                CDefaults::failureQuarantineLatency).toInt();
+    m_batchMaxItems = settings.value(QSL("batchMaxItems"),CDefaults::batchMaxItems).toInt();
+    m_batchMaxBytes = settings.value(QSL("batchMaxBytes"),CDefaults::batchMaxBytes).toInt();
+    m_compressionThreshold = settings.value(QSL("compressionThreshold"),CDefaults::compressionThreshold).toInt();
+    m_cachePolicy = CResultCache::policyFromString(settings.value(QSL("cachePolicy"),QSL("tinylfu")).toString());
+    m_cacheTrace = settings.value(QSL("cacheTrace"),QString()).toString();
+    m_cacheCompression = settings.value(QSL("cacheCompression"),false).toBool();
+    m_persistentCacheEnabled = settings.value(QSL("persistentCache"),true).toBool();
+    m_persistentCacheDir = settings.value(QSL("persistentCacheDirectory"),
+                                          QDir(QCoreApplication::applicationDirPath()).filePath(QSL("cache"))).toString();
+    m_persistentCacheSize = settings.value(QSL("persistentCacheSize"),CDefaults::persistentCacheMaxSize).toInt();
+    m_bundlesDir = settings.value(QSL("bundlesDirectory"),
+                                  QDir(QCoreApplication::applicationDirPath()).filePath(QSL("bundles"))).toString();
+    m_sharedCacheEnabled = settings.value(QSL("sharedCache"),false).toBool();
+    m_sharedCacheName = settings.value(QSL("sharedCacheName"),QString::fromLatin1(CDefaults::sharedCacheName)).toString();
+    m_sharedCacheSize = settings.value(QSL("sharedCacheSize"),CDefaults::sharedCacheSize).toInt();
+    m_warmupEnabled = settings.value(QSL("warmup"),true).toBool();
+    m_warmupSnapshot = settings.value(QSL("warmupSnapshot"),
+                                      QDir(QCoreApplication::applicationDirPath()).filePath(QSL("cache/hotkeys.txt"))).toString();
+    m_warmupAccessLog = settings.value(QSL("warmupAccessLog"),QString()).toString();
+    m_warmupEntries = settings.value(QSL("warmupEntries"),CDefaults::warmupMaxEntries).toInt();
+    m_replicationPeers = settings.value(QSL("replicationPeers"),QStringList()).toStringList();
+    m_replicationToken = settings.value(QSL("replicationToken"),QString()).toString();
+    m_httpEnabled = settings.value(QSL("http"),false).toBool();
+    m_httpHost = QHostAddress(settings.value(QSL("httpHost"),
+        QHostAddress(CDefaults::httpHost).toIPv4Address()).toUInt());
+    m_httpPort = settings.value(QSL("httpPort"),CDefaults::httpPort).toInt();
+    m_localEnabled = settings.value(QSL("localSocket"),false).toBool();
+    m_localName = settings.value(QSL("localSocketName"),QString::fromLatin1(CDefaults::localSocketName)).toString();
 
     QByteArray buf;
     buf = settings.value(QSL("privateKey"),QByteArray()).toByteArray();
@@ -168,18 +298,21 @@ void CServer::incomingConnection(qintptr socket)
     if (m_disabled)
         return;
 
-    auto* s = new CAtlasSocket(this);
-    if (s->setSocketDescriptor(socket))
+    auto* s = new QSslSocket(this);
+    if (s->setSocketDescriptor(socket)) {
         addPendingConnection(s);
+    } else {
+        s->deleteLater();
+    }
 }
 
 void CServer::acceptConnections()
 {
     while (hasPendingConnections()) {
         QTcpSocket* ts = nextPendingConnection();
-        auto* s = qobject_cast<CAtlasSocket *>(ts);
+        auto* ssl = qobject_cast<QSslSocket *>(ts);
         // Accept only our sockets, close others.
-        if (s == nullptr) {
+        if (ssl == nullptr) {
             if (ts) {
                 ts->close();
                 ts->deleteLater();
@@ -187,25 +320,50 @@ void CServer::acceptConnections()
             return;
         }
 
-        connect(s, &CAtlasSocket::disconnected, this, &CServer::discardClient);
-        connect(s, &CAtlasSocket::readyRead, this, &CServer::readClient);
+        addClient(new CAtlasSocket(ssl,this));
+        ssl->setPrivateKey(m_privateKey);
+        ssl->setLocalCertificate(m_serverCert);
+        ssl->startServerEncryption();
+    }
+}
+
+void CServer::acceptLocalConnections()
+{
+    // Local clients skip TLS, token is still required by INIT:.
+    while (m_local->hasPendingConnections()) {
+        QLocalSocket* ls = m_local->nextPendingConnection();
+        if (ls == nullptr) return;
+        if (m_disabled) {
+            ls->close();
+            ls->deleteLater();
+            continue;
+        }
 
-        s->setPrivateKey(m_privateKey);
-        s->setLocalCertificate(m_serverCert);
-        s->startServerEncryption();
+        auto* s = new CAtlasSocket(ls,this);
+        addClient(s);
+        if (s->bytesAvailable() > 0)
+            processClient(s);
     }
 }
 
-void CServer::readClient()
+void CServer::addClient(CAtlasSocket *socket)
 {
-    static const QString cmdInit(QSL("INIT:"));
-    static const QString cmdDir(QSL("DIR:"));
-    static const QString cmdTr(QSL("TR:"));
-    static const QString cmdFin(QSL("FIN:"));
+    connect(socket, &CAtlasSocket::disconnected, this, &CServer::discardClient);
+    connect(socket, &CAtlasSocket::readyRead, this, &CServer::readClient);
 
+    socket->documents().setMaxBytes(m_documentSessionSize);
+}
+
+void CServer::readClient()
+{
     auto* socket = qobject_cast<CAtlasSocket *>(sender());
-    if (socket == nullptr) return;
-    if (!socket->isEncrypted()) return;
+    if (socket)
+        processClient(socket);
+}
+
+void CServer::processClient(CAtlasSocket *socket)
+{
+    if (!socket->isReady()) return;
 
     if (m_disabled || m_atlas.isNull()) {
         socket->setAuthenticated(false);
@@ -213,72 +371,591 @@ void CServer::readClient()
         return;
     }
 
-    bool needCloseSocket = false;
-    bool handled = false;
-    if (socket->canReadLine()) {
-        QString cmd = QString::fromLatin1(socket->readLine().simplified());
-        if (cmd.startsWith(cmdInit)) {
-            QString token = cmd;
-            token.remove(0,cmdInit.length());
-            if (m_clientTokens.contains(token)) {
-                socket->setAuthenticated(true);
-                socket->setDirection(CAtlas::Atlas_JE);
-                socket->write("OK\r\n");
-            } else {
-                socket->write("ERR:NOT_AUTHORIZED\r\n");
-                needCloseSocket = true;
-            }
-            handled = true;
-
-        } else if (socket->authenticated()) {
-            if (cmd.startsWith(cmdDir)) {
-                QString dir = cmd.toUpper();
-                dir.remove(0,cmdDir.length());
-                if (dir.startsWith(QSL("JE"))) {
-                    socket->setDirection(CAtlas::Atlas_JE);
-                } else if (dir.startsWith(QSL("EJ"))) {
-                    socket->setDirection(CAtlas::Atlas_EJ);
-                } else {
-                    socket->setDirection(CAtlas::Atlas_Auto);
-                }
-                socket->write("OK\r\n");
-                handled = true;
-
-            } else if (cmd.startsWith(cmdFin)) {
-                socket->write("OK\r\n");
-                needCloseSocket = true;
-                handled = true;
-
-            } else if (cmd.startsWith(cmdTr)) {
-                QString s = cmd;
-                s.remove(0,cmdTr.length());
-                s = QUrl::fromPercentEncoding(s.toLatin1()).trimmed();
-                if (s.isEmpty()) {
-                    socket->write("ERR:NULL_STR_DECODED\r\n");
-                } else {
-                    s = m_atlas->translate(socket->direction(),s);
-                    if (s.startsWith(QSL("ERR"))) {
-                        socket->write("ERR:TRANS_FAILED\r\n");
-                    } else {
-                        s = QSL("RES:%1\r\n").arg(QString::fromLatin1(QUrl::toPercentEncoding(s)).trimmed());
-                        socket->write(s.toLatin1());
-                    }
-                }
-                handled = true;
+    // All buffered requests are handled. Plain commands are answered in order, the next one is
+    // read after background request finishes. Tagged ones and v2 frames run concurrently up to the limit.
+    while (!socket->busy() && socket->pendingRequests() < CDefaults::pipelineMaxRequests) {
+        CProtocol::CRequest request;
+        QString error;
+        if (socket->protocolVersion() >= 2) {
+            if (!CProtocol::readFrame(socket->device(),request,&error,socket->decompressor()) && error.isEmpty())
+                return;
+        } else {
+            if (!socket->canReadLine()) return;
+            QByteArray line = socket->readLine();
+            if (socket->compression() && line.startsWith("Z:")) {
+                QByteArray raw;
+                if (!socket->decompress(QByteArray::fromBase64(line.mid(2).trimmed()),raw))
+                    error = QSL("Unable to decompress line");
+                line = raw;
             }
+            request = CProtocol::parseLine(line);
         }
-        if (!handled) {
-            socket->write("ERR:NOT_RECOGNIZED\r\n");
-            needCloseSocket = true;
+        if (socket->compression())
+            updateCompressionStats(socket);
+
+        if (!error.isEmpty()) {
+            qWarning() << "Client protocol error:" << error;
+            socket->setAuthenticated(false);
+            socket->close();
+            return;
         }
 
+        const bool keepOpen = dispatch(socket,request);
         socket->flush();
 
-        if (needCloseSocket) {
+        if (!keepOpen) {
             socket->setAuthenticated(false);
             socket->close();
+            return;
+        }
+    }
+}
+
+bool CServer::dispatch(CAtlasSocket *socket, const CProtocol::CRequest &request)
+{
+    // Shared by both protocol versions, returns false when connection must be closed.
+    const QString &id = request.id;
+    if (request.command == CProtocol::Command_Init && request.version == 1 && id.isEmpty()) {
+        // INIT:<token>[:V2][:DEFLATE], capability flags switch connection to binary frames
+        // and compressed payloads after OK:<accepted flags>.
+        QString token = request.argument;
+        QStringList capabilities;
+        for (;;) {
+            const int sep = token.lastIndexOf(QChar(':'));
+            const QString flag = token.mid(sep + 1);
+            if (sep < 0 || (flag != QSL("V2") && flag != QSL("DEFLATE")) || capabilities.contains(flag)) break;
+            capabilities.prepend(flag);
+            token.truncate(sep);
+        }
+        // Dedicated replication token marks peer connections, only they may send REPL:.
+        const bool peer = (!m_replicationToken.isEmpty() && token == m_replicationToken);
+        if (!peer && !m_clientTokens.contains(token)) {
+            sendReply(socket,CProtocol::Reply_Error,QString(),QSL("NOT_AUTHORIZED"));
+            return false;
+        }
+        socket->setAuthenticated(true);
+        socket->setReplicationPeer(peer);
+        socket->setDirection(CAtlas::Atlas_JE);
+        sendReply(socket,CProtocol::Reply_Ok,QString(),capabilities.join(QChar(':')));
+        if (capabilities.contains(QSL("V2")))
+            socket->setProtocolVersion(2);
+        if (capabilities.contains(QSL("DEFLATE")) && !socket->compression())
+            socket->enableCompression();
+        return true;
+    }
+
+    if (!socket->authenticated()) {
+        sendReply(socket,CProtocol::Reply_Error,QString(),QSL("NOT_RECOGNIZED"));
+        return false;
+    }
+
+    if (!id.isEmpty())
+        m_stats->add(QSL("pipeline.requests"));
+
+    // Text protocol tags only translation requests.
+    const bool taggable = (request.command == CProtocol::Command_Translate ||
+                           request.command == CProtocol::Command_TranslateNoCache ||
+                           request.command == CProtocol::Command_TranslateHash ||
+                           request.command == CProtocol::Command_Markup ||
+                           request.command == CProtocol::Command_Batch);
+    if (request.version == 1 && !id.isEmpty() && !taggable) {
+        sendReply(socket,CProtocol::Reply_Error,id,QSL("NOT_RECOGNIZED"));
+        return true;
+    }
+
+    const CAtlas::AtlasDirection direction = (request.direction >= 0)
+                                             ? static_cast<CAtlas::AtlasDirection>(request.direction)
+                                             : socket->direction();
+
+    switch (request.command) {
+        case CProtocol::Command_Direction:
+            socket->setDirection(CAtlas::directionFromString(request.argument));
+            sendReply(socket,CProtocol::Reply_Ok,id);
+            break;
+
+        case CProtocol::Command_Finish:
+            sendReply(socket,CProtocol::Reply_Ok,id);
+            return false;
+
+        case CProtocol::Command_Statistics:
+            m_translator->updateStatistics();
+            sendReply(socket,CProtocol::Reply_Result,id,m_stats->report().join(QChar('\n')));
+            break;
+
+        case CProtocol::Command_Quarantine:
+            // QRN: lists quarantined inputs, QRN:<hash> releases one, QRN:* releases all.
+            if (request.argument.isEmpty()) {
+                sendReply(socket,CProtocol::Reply_Result,id,m_translator->quarantine().join(QChar('\n')));
+            } else if (m_translator->releaseQuarantine(request.argument)) {
+                sendReply(socket,CProtocol::Reply_Ok,id);
+            } else {
+                sendReply(socket,CProtocol::Reply_Error,id,QSL("NOT_FOUND"));
+            }
+            break;
+
+        case CProtocol::Command_Markup: {
+            const QString s = CProtocol::decode(request,request.argument).trimmed();
+            if (s.isEmpty()) {
+                sendReply(socket,CProtocol::Reply_Error,id,QSL("NULL_STR_DECODED"));
+            } else {
+                startMarkup(socket,direction,s,id);
+            }
+            break;
+        }
+
+        case CProtocol::Command_Bulk: {
+            // BULK:<format>:<document>
+            const int sep = request.argument.indexOf(QChar(':'));
+            const QString format = request.argument.left(sep);
+            const QString s = CProtocol::decode(request,request.argument.mid(sep + 1));
+            if (sep < 0 || s.trimmed().isEmpty()) {
+                sendReply(socket,CProtocol::Reply_Error,id,QSL("NULL_STR_DECODED"));
+            } else {
+                startBulk(socket,direction,CBulkTranslator::formatFromName(format),s,id);
+            }
+            break;
+        }
+
+        case CProtocol::Command_Replicate:
+            // REPL:<key>:<value>,... from replication primary, both parts percent-encoded.
+            // Entries go to all cache tiers, so client tokens are not enough.
+            if (!socket->replicationPeer()) {
+                sendReply(socket,CProtocol::Reply_Error,id,QSL("NOT_AUTHORIZED"));
+                break;
+            }
+            m_replicator->applyBatch(request.argument.toLatin1());
+            sendReply(socket,CProtocol::Reply_Ok,id);
+            break;
+
+        case CProtocol::Command_Translate:
+            writeTranslation(socket,direction,CProtocol::decode(request,request.argument),
+                             CTranslator::Flag_None,id);
+            break;
+
+        case CProtocol::Command_TranslateNoCache:
+            writeTranslation(socket,direction,CProtocol::decode(request,request.argument),
+                             CTranslator::Flag_NoCache,id);
+            break;
+
+        case CProtocol::Command_TranslateHash: {
+            // TRH:<sha256 hex of UTF-8 text>, client resends full TR: after ERR:UNKNOWN_HASH.
+            const QString &hash = request.argument;
+            socket->setHashReplies(true);
+            QString s;
+            if (m_translator->lookupContent(hash,s)) {
+                startTranslation(socket,direction,s,CTranslator::Flag_None,hash.toLower(),id);
+            } else {
+                sendReply(socket,CProtocol::Reply_Error,id,QSL("UNKNOWN_HASH"));
+            }
+            break;
+        }
+
+        case CProtocol::Command_Batch:
+            startBatch(socket,direction,request);
+            break;
+
+        case CProtocol::Command_Document: {
+            // DOC:<id>[:DELTA] selects document for TRD: revisions, empty ID leaves document mode.
+            QString document = request.argument;
+            const bool delta = document.endsWith(QSL(":DELTA"),Qt::CaseInsensitive);
+            if (delta)
+                document.chop(6);
+            if (document.isEmpty()) {
+                socket->documents().close();
+            } else {
+                socket->documents().open(document);
+                socket->documents().setDeltaReplies(delta);
+            }
+            sendReply(socket,CProtocol::Reply_Ok,id);
+            break;
+        }
+
+        case CProtocol::Command_TranslateDocument: {
+            const QString s = CProtocol::decode(request,request.argument);
+            if (socket->documents().current().isNull()) {
+                sendReply(socket,CProtocol::Reply_Error,id,QSL("NO_DOCUMENT"));
+            } else if (s.trimmed().isEmpty()) {
+                sendReply(socket,CProtocol::Reply_Error,id,QSL("NULL_STR_DECODED"));
+            } else {
+                startDocument(socket,direction,s,id);
+            }
+            break;
+        }
+
+        case CProtocol::Command_Init:
+        case CProtocol::Command_Unknown:
+            sendReply(socket,CProtocol::Reply_Error,id,QSL("NOT_RECOGNIZED"));
+            // Binary framing stays in sync after unknown frame, text line may be garbage.
+            return (request.version >= 2);
+    }
+    return true;
+}
+
+void CServer::sendReply(CAtlasSocket *socket, CProtocol::Reply reply, const QString &id,
+                        const QString &text, const QString &hash)
+{
+    // Compression state is shared by all messages of connection, so the decision depends
+    // only on size, compressed output is sent even when it is not smaller.
+    const bool compress = socket->compression();
+    if (socket->protocolVersion() >= 2) {
+        QByteArray meta;
+        if (!hash.isEmpty())
+            meta = QSL("hash=%1\n").arg(hash).toLatin1();
+        QByteArray body = text.toUtf8();
+        bool compressed = false;
+        if (compress && body.size() >= m_compressionThreshold) {
+            QByteArray packed;
+            if (!socket->compress(body,packed)) {
+                qWarning() << "Unable to compress reply";
+                socket->close();
+                return;
+            }
+            body = packed;
+            compressed = true;
+        }
+        CProtocol::writeFrame(socket->device(),reply,id.toUInt(),meta,body,compressed);
+    } else {
+        QByteArray line = CProtocol::line(reply,id,text,socket->hashReplies() ? hash : QString());
+        if (compress && line.size() >= m_compressionThreshold) {
+            QByteArray packed;
+            line.chop(2);
+            if (!socket->compress(line,packed)) {
+                qWarning() << "Unable to compress reply";
+                socket->close();
+                return;
+            }
+            line = "Z:" + packed.toBase64() + "\r\n";
+        }
+        socket->write(line);
+    }
+
+    if (compress)
+        updateCompressionStats(socket);
+}
+
+void CServer::updateCompressionStats(CAtlasSocket *socket)
+{
+    qint64 rawBytes = 0;
+    qint64 packedBytes = 0;
+    qint64 nsecs = 0;
+    socket->takeCompressionCounters(rawBytes,packedBytes,nsecs);
+    if (rawBytes == 0 && packedBytes == 0) return;
+
+    m_stats->add(QSL("compression.rawBytes"),rawBytes);
+    m_stats->add(QSL("compression.wireBytes"),packedBytes);
+    m_stats->add(QSL("compression.cpuUs"),nsecs / 1000);
+}
+
+void CServer::writeTranslation(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &text,
+                               CTranslator::TranslateFlags flags, const QString &id)
+{
+    const QString s = text.trimmed();
+    if (s.isEmpty()) {
+        sendReply(socket,CProtocol::Reply_Error,id,QSL("NULL_STR_DECODED"));
+        return;
+    }
+
+    startTranslation(socket,direction,s,flags,m_translator->rememberContent(s),id);
+}
+
+void CServer::startTranslation(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &text,
+                               CTranslator::TranslateFlags flags, const QString &hash, const QString &id)
+{
+    // Engine calls run off the event loop, so concurrent identical requests can be coalesced.
+    const QPointer<CAtlasSocket> client(socket);
+    const QPointer<CTranslator> translator(m_translator);
+    const QSharedPointer<std::atomic<bool> > closed = socket->closedFlag();
+    if (id.isEmpty()) {
+        socket->setBusy(true);
+    } else {
+        socket->addPendingRequests(1);
+    }
+
+    auto *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this,watcher,client,hash,id](){
+        const QString res = watcher->result();
+        watcher->deleteLater();
+        if (client.isNull()) return;
+
+        if (id.isEmpty()) {
+            client->setBusy(false);
+        } else {
+            client->addPendingRequests(-1);
+        }
+        if (!client->isOpen()) return;
+
+        if (res.startsWith(QSL("ERR"))) {
+            sendReply(client,CProtocol::Reply_Error,id,QSL("TRANS_FAILED"));
+        } else {
+            sendReply(client,CProtocol::Reply_Result,id,res,hash);
+        }
+        client->flush();
+
+        if (client->bytesAvailable() > 0)
+            processClient(client);
+    });
+
+    watcher->setFuture(QtConcurrent::run([translator,closed,direction,text,flags](){
+        if (translator.isNull()) return QSL("ERR");
+        return translator->translate(direction,text,flags,[closed]{
+            return closed->load();
+        });
+    }));
+}
+
+void CServer::startMarkup(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &html,
+                          const QString &id)
+{
+    // Pages can be large, so markup runs off the event loop like single translations.
+    const QPointer<CAtlasSocket> client(socket);
+    const QPointer<CTranslator> translator(m_translator);
+    const QSharedPointer<std::atomic<bool> > closed = socket->closedFlag();
+    if (id.isEmpty()) {
+        socket->setBusy(true);
+    } else {
+        socket->addPendingRequests(1);
+    }
+
+    auto *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this,watcher,client,id](){
+        const QString res = watcher->result();
+        watcher->deleteLater();
+        if (client.isNull()) return;
+
+        if (id.isEmpty()) {
+            client->setBusy(false);
+        } else {
+            client->addPendingRequests(-1);
+        }
+        if (!client->isOpen()) return;
+
+        if (res.startsWith(QSL("ERR"))) {
+            sendReply(client,CProtocol::Reply_Error,id,QSL("TRANS_FAILED"));
+        } else {
+            sendReply(client,CProtocol::Reply_Result,id,res);
+        }
+        client->flush();
+
+        if (client->bytesAvailable() > 0)
+            processClient(client);
+    });
+
+    watcher->setFuture(QtConcurrent::run([translator,closed,direction,html](){
+        if (translator.isNull()) return QSL("ERR");
+        return translator->translateMarkup(direction,html,[closed]{
+            return closed->load();
+        });
+    }));
+}
+
+void CServer::startBatch(CAtlasSocket *socket, CAtlas::AtlasDirection direction,
+                         const CProtocol::CRequest &request)
+{
+    // TRB:[dir:]<text>,[dir:]<text>,... with percent-encoded texts, dir is JE, EJ or AUTO.
+    // Reply is RES:OK:<result>,ERR:<code>,... in request order.
+    // Binary protocol uses raw texts, record separator between items and unit separator after dir.
+    const int version = request.version;
+    const QString &id = request.id;
+    const QChar itemSeparator = (version >= 2) ? QChar(CProtocol::recordSeparator) : QChar(',');
+    const QChar dirSeparator = (version >= 2) ? QChar(CProtocol::unitSeparator) : QChar(':');
+    // Limit is in payload bytes, like for HTTP. Encoded size is never below character count,
+    // so oversized payloads are refused without encoding them.
+    const QString &payload = request.argument;
+    if (payload.length() > m_batchMaxBytes || payload.toUtf8().size() > m_batchMaxBytes) {
+        sendReply(socket,CProtocol::Reply_Error,id,QSL("BATCH_TOO_LARGE"));
+        return;
+    }
+    const QStringList parts = payload.split(itemSeparator);
+    if (parts.count() > m_batchMaxItems) {
+        sendReply(socket,CProtocol::Reply_Error,id,QSL("BATCH_TOO_LARGE"));
+        return;
+    }
+
+    QVector<CAtlas::AtlasDirection> directions;
+    QStringList items;
+    QVector<int> itemIndex(parts.count(),-1);
+    directions.reserve(parts.count());
+    items.reserve(parts.count());
+    for (int i = 0; i < parts.count(); i++) {
+        const QString &part = parts.at(i);
+        const int sep = part.indexOf(dirSeparator);
+        const QString text = CProtocol::decode(request,part.mid(sep + 1)).trimmed();
+        if (text.isEmpty()) continue;
+
+        itemIndex[i] = items.count();
+        directions.append((sep > 0) ? CAtlas::directionFromString(part.left(sep)) : direction);
+        items.append(text);
+    }
+
+    const QPointer<CAtlasSocket> client(socket);
+    const QPointer<CTranslator> translator(m_translator);
+    const QPointer<CStatistics> stats(m_stats);
+    if (id.isEmpty()) {
+        socket->setBusy(true);
+    } else {
+        socket->addPendingRequests(1);
+    }
+
+    auto *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this,watcher,client,id](){
+        const QString res = watcher->result();
+        watcher->deleteLater();
+        if (client.isNull()) return;
+
+        if (id.isEmpty()) {
+            client->setBusy(false);
+        } else {
+            client->addPendingRequests(-1);
         }
+        if (!client->isOpen()) return;
+
+        sendReply(client,CProtocol::Reply_Batch,id,res);
+        client->flush();
+
+        if (client->bytesAvailable() > 0)
+            processClient(client);
+    });
+
+    watcher->setFuture(QtConcurrent::run([translator,stats,directions,items,itemIndex,version,
+                                         itemSeparator,dirSeparator](){
+        QStringList results;
+        if (translator) {
+            CBulkTranslator bulk(translator,stats);
+            bulk.translateItems(directions,items,results);
+        }
+
+        QStringList replies;
+        replies.reserve(itemIndex.count());
+        for (const int idx : itemIndex) {
+            if (idx < 0) {
+                replies.append(QSL("ERR") + dirSeparator + QSL("NULL_STR_DECODED"));
+            } else if (results.value(idx).isNull()) {
+                replies.append(QSL("ERR") + dirSeparator + QSL("TRANS_FAILED"));
+            } else {
+                replies.append(QSL("OK") + dirSeparator + CProtocol::encode(version,results.at(idx)));
+            }
+        }
+        return replies.join(itemSeparator);
+    }));
+}
+
+void CServer::startDocument(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &text,
+                            const QString &id)
+{
+    // Reply is RES:<full result>, or with DELTA mode DLT:<revision>:<prefix>:<removed>:<inserted,...>
+    // to replace [prefix, prefix + removed) segments of previous result with inserted ones.
+    // Revisions of one connection are never translated concurrently, even when tagged.
+    using CDocumentReply = QPair<CProtocol::Reply,QString>;
+    const QPointer<CAtlasSocket> client(socket);
+    const QPointer<CTranslator> translator(m_translator);
+    const QPointer<CStatistics> stats(m_stats);
+    const QSharedPointer<std::atomic<bool> > closed = socket->closedFlag();
+    const QSharedPointer<CDocument> document = socket->documents().current();
+    const bool delta = socket->documents().deltaReplies();
+    const int version = socket->protocolVersion();
+    socket->setBusy(true);
+
+    auto *watcher = new QFutureWatcher<CDocumentReply>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this,watcher,client,stats,id](){
+        const CDocumentReply res = watcher->result();
+        watcher->deleteLater();
+        if (client.isNull()) return;
+
+        client->setBusy(false);
+        const int evicted = client->documents().trim();
+        if (evicted > 0 && stats)
+            stats->add(QSL("document.evictions"),evicted);
+        if (!client->isOpen()) return;
+
+        sendReply(client,res.first,id,res.second);
+        client->flush();
+
+        if (client->bytesAvailable() > 0)
+            processClient(client);
+    });
+
+    watcher->setFuture(QtConcurrent::run([translator,stats,closed,document,direction,delta,version,text](){
+        if (translator.isNull() || !document->update(translator,direction,text,[closed]{ return closed->load(); }))
+            return CDocumentReply(CProtocol::Reply_Error,QSL("TRANS_FAILED"));
+
+        if (stats) {
+            stats->add(QSL("document.revisions"));
+            stats->add(QSL("document.reused"),document->reused());
+            stats->add(QSL("document.translated"),document->translated());
+        }
+
+        if (!delta || !document->hasDelta())
+            return CDocumentReply(CProtocol::Reply_Result,document->result());
+
+        // Binary protocol: <revision>US<prefix>US<removed> followed by RS<output> for each inserted one.
+        const QChar separator = (version >= 2) ? QChar(CProtocol::unitSeparator) : QChar(':');
+        QString res = QSL("%1%4%2%4%3").arg(document->revision()).arg(document->deltaPrefix())
+                      .arg(document->deltaRemoved()).arg(separator);
+        if (version >= 2) {
+            for (const QString &output : document->deltaInserted()) {
+                res.append(QChar(CProtocol::recordSeparator));
+                res.append(output);
+            }
+        } else {
+            QStringList inserted;
+            for (const QString &output : document->deltaInserted())
+                inserted.append(CProtocol::encode(version,output));
+            res.append(separator);
+            res.append(inserted.join(QChar(',')));
+        }
+        return CDocumentReply(CProtocol::Reply_Delta,res);
+    }));
+}
+
+void CServer::startBulk(CAtlasSocket *socket, CAtlas::AtlasDirection direction, CBulkTranslator::Format format,
+                        const QString &content, const QString &id)
+{
+    // Bulk jobs run off the event loop, reply is sent when finished.
+    // Job is stopped when client disconnects.
+    const QPointer<CAtlasSocket> client(socket);
+    const QPointer<CTranslator> translator(m_translator);
+    const QPointer<CStatistics> stats(m_stats);
+    const QSharedPointer<std::atomic<bool> > closed = socket->closedFlag();
+    if (id.isEmpty()) {
+        socket->setBusy(true);
+    } else {
+        socket->addPendingRequests(1);
     }
+
+    auto *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this,watcher,client,id](){
+        const QString res = watcher->result();
+        watcher->deleteLater();
+        if (client.isNull()) return;
+
+        if (id.isEmpty()) {
+            client->setBusy(false);
+        } else {
+            client->addPendingRequests(-1);
+        }
+        if (!client->isOpen()) return;
+
+        if (res.isNull()) {
+            sendReply(client,CProtocol::Reply_Error,id,QSL("TRANS_FAILED"));
+        } else {
+            sendReply(client,CProtocol::Reply_Result,id,res);
+        }
+        client->flush();
+
+        if (client->bytesAvailable() > 0)
+            processClient(client);
+    });
+
+    watcher->setFuture(QtConcurrent::run([translator,stats,closed,direction,format,content](){
+        CBulkTranslator bulk(translator,stats);
+        bulk.setCancelCheck([closed]{ return closed->load(); });
+        QString res;
+        if (!bulk.translate(direction,content,format,res)) {
+            qWarning() << "Bulk translation failed:" << bulk.errorString();
+            return QString();
+        }
+        return res;
+    }));
 }
 
 void CServer::discardClient()
@@ -292,10 +969,17 @@ void CServer::closeSocket()
 {
     if (isListening())
         close();
+    if (m_http->isListening())
+        m_http->close();
+    if (m_local->isListening())
+        m_local->close();
 }
 
 bool CServer::saveSettings()
 {
+    // Tool mode overrides must not reach service settings.
+    if (m_toolMode) return false;
+
     QSettings settings;
     if (!settings.isWritable() || (settings.status() != QSettings::NoError))
         return false;
@@ -305,6 +989,37 @@ bool CServer::saveSettings()
     settings.setValue(QSL("port"),m_atlasPort);
     settings.setValue(QSL("host"),m_atlasHost.toIPv4Address());
     settings.setValue(QSL("atlasEnvironment"),m_atlasEnv);
+    settings.setValue(QSL("cacheSize"),m_cacheSize);
+    settings.setValue(QSL("contentStoreSize"),m_contentStoreSize);
+    settings.setValue(QSL("documentSessionSize"),m_documentSessionSize);
+    settings.setValue(QSL("failureCacheTtl"),m_failureCacheTtl);
+    settings.setValue(QSL("failureQuarantineCount"),m_failureQuarantineCount);
+    settings.setValue(QSL("failureQuarantineLatency"),m_failureQuarantineLatency);
+    settings.setValue(QSL("batchMaxItems"),m_batchMaxItems);
+    settings.setValue(QSL("batchMaxBytes"),m_batchMaxBytes);
+    settings.setValue(QSL("compressionThreshold"),m_compressionThreshold);
+    settings.setValue(QSL("cachePolicy"),
+                      (m_cachePolicy == CResultCache::Policy_LRU) ? QSL("lru") : QSL("tinylfu"));
+    settings.setValue(QSL("cacheTrace"),m_cacheTrace);
+    settings.setValue(QSL("cacheCompression"),m_cacheCompression);
+    settings.setValue(QSL("persistentCache"),m_persistentCacheEnabled);
+    settings.setValue(QSL("persistentCacheDirectory"),m_persistentCacheDir);
+    settings.setValue(QSL("persistentCacheSize"),m_persistentCacheSize);
+    settings.setValue(QSL("bundlesDirectory"),m_bundlesDir);
+    settings.setValue(QSL("sharedCache"),m_sharedCacheEnabled);
+    settings.setValue(QSL("sharedCacheName"),m_sharedCacheName);
+    settings.setValue(QSL("sharedCacheSize"),m_sharedCacheSize);
+    settings.setValue(QSL("warmup"),m_warmupEnabled);
+    settings.setValue(QSL("warmupSnapshot"),m_warmupSnapshot);
+    settings.setValue(QSL("warmupAccessLog"),m_warmupAccessLog);
+    settings.setValue(QSL("warmupEntries"),m_warmupEntries);
+    settings.setValue(QSL("replicationPeers"),m_replicationPeers);
+    settings.setValue(QSL("replicationToken"),m_replicationToken);
+    settings.setValue(QSL("http"),m_httpEnabled);
+    settings.setValue(QSL("httpHost"),m_httpHost.toIPv4Address());
+    settings.setValue(QSL("httpPort"),m_httpPort);
+    settings.setValue(QSL("localSocket"),m_localEnabled);
+    settings.setValue(QSL("localSocketName"),m_localName);
     settings.setValue(QSL("privateKey"),QVariant::fromValue(m_privateKey.toPem()));
     settings.setValue(QSL("serverCert"),QVariant::fromValue(m_serverCert.toPem()));
     settings.setValue(QSL("clientTokens"),QVariant::fromValue(m_clientTokens));
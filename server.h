@@ -3,20 +3,36 @@
 
 #include <QPointer>
 #include <QTcpServer>
+#include <QLocalServer>
 #include <QSslKey>
 #include <QSslCertificate>
 #include "atlas.h"
+#include "atlassocket.h"
+#include "protocol.h"
+#include "stats.h"
+#include "translator.h"
+#include "bulk.h"
+#include "persistentcache.h"
+#include "bundle.h"
+#include "sharedcache.h"
+#include "warmup.h"
+#include "replicator.h"
+#include "httpserver.h"
 
 namespace CDefaults {
 const int atlPort = 18000;
 const QHostAddress::SpecialAddress atlHost = QHostAddress::AnyIPv4;
+const int pipelineMaxRequests = 64;
+const char localSocketName[] = "atlastcpsvc-ng";
 }
 
 class CServer : public QTcpServer
 {
     Q_OBJECT
 public:
-    explicit CServer(QObject *parent = nullptr);
+    // Tool mode (offline command-line modes) keeps caches in memory only and skips
+    // warm-up and extra listeners, nothing used by running service is opened.
+    explicit CServer(QObject *parent = nullptr, bool toolMode = false);
     ~CServer() override;
 
     bool start();
@@ -28,15 +44,74 @@ private:
 
     int m_atlasPort { CDefaults::atlPort };
     bool m_disabled { false };
+    bool m_toolMode { false };
     QHostAddress m_atlasHost;
     QSslKey m_privateKey;
     QSslCertificate m_serverCert;
     QStringList m_clientTokens;
     QString m_atlasEnv;
+    int m_cacheSize { CDefaults::cacheMaxBytes };
+    int m_contentStoreSize { CDefaults::contentStoreMaxBytes };
+    int m_documentSessionSize { CDefaults::documentSessionMaxBytes };
+    int m_failureCacheTtl { CDefaults::failureCacheTtl };
+    int m_failureQuarantineCount { CDefaults::failureQuarantineCount };
+    int m_failureQuarantineLatency { CDefaults::failureQuarantineLatency };
+    int m_batchMaxItems { CDefaults::batchMaxItems };
+    int m_batchMaxBytes { CDefaults::batchMaxBytes };
+    int m_compressionThreshold { CDefaults::compressionThreshold };
+    CResultCache::Policy m_cachePolicy { CResultCache::Policy_TinyLFU };
+    QString m_cacheTrace;
+    bool m_cacheCompression { false };
+    bool m_persistentCacheEnabled { true };
+    QString m_persistentCacheDir;
+    int m_persistentCacheSize { CDefaults::persistentCacheMaxSize };
+    QString m_bundlesDir;
+    bool m_sharedCacheEnabled { false };
+    QString m_sharedCacheName;
+    int m_sharedCacheSize { CDefaults::sharedCacheSize };
+    bool m_warmupEnabled { true };
+    QString m_warmupSnapshot;
+    QString m_warmupAccessLog;
+    int m_warmupEntries { CDefaults::warmupMaxEntries };
+    bool m_started { false };
+    QStringList m_replicationPeers;
+    QString m_replicationToken;
+    bool m_httpEnabled { false };
+    QHostAddress m_httpHost { CDefaults::httpHost };
+    int m_httpPort { CDefaults::httpPort };
+    bool m_localEnabled { false };
+    QString m_localName;
 
     QPointer<CAtlas> m_atlas;
+    QPointer<CStatistics> m_stats;
+    QPointer<CTranslator> m_translator;
+    QPointer<CPersistentCache> m_persistentCache;
+    QPointer<CBundleSet> m_bundles;
+    QPointer<CSharedCache> m_sharedCache;
+    QPointer<CWarmup> m_warmup;
+    QPointer<CReplicator> m_replicator;
+    QPointer<CHttpServer> m_http;
+    QPointer<QLocalServer> m_local;
 
     void loadSettings();
+    void saveCacheSnapshot();
+    void startBulk(CAtlasSocket *socket, CAtlas::AtlasDirection direction, CBulkTranslator::Format format,
+                   const QString &content, const QString &id);
+    void writeTranslation(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &text,
+                          CTranslator::TranslateFlags flags, const QString &id);
+    void startTranslation(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &text,
+                          CTranslator::TranslateFlags flags, const QString &hash, const QString &id);
+    void startMarkup(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &html,
+                     const QString &id);
+    void startBatch(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const CProtocol::CRequest &request);
+    void startDocument(CAtlasSocket *socket, CAtlas::AtlasDirection direction, const QString &text,
+                       const QString &id);
+    void sendReply(CAtlasSocket *socket, CProtocol::Reply reply, const QString &id,
+                   const QString &text = QString(), const QString &hash = QString());
+    void updateCompressionStats(CAtlasSocket *socket);
+    bool dispatch(CAtlasSocket *socket, const CProtocol::CRequest &request);
+    void addClient(CAtlasSocket *socket);
+    void processClient(CAtlasSocket *socket);
 
 public:
     bool isAtlasLoaded() const;
@@ -47,6 +122,8 @@ public:
     QStringList clientTokens() const;
     QString atlasEnv() const;
     QStringList atlasEnvironments() const;
+    CTranslator *translator() const;
+    CStatistics *statistics() const;
 
     void setAtlasPort(int port);
     void setAtlasHost(const QHostAddress &host);
@@ -55,6 +132,8 @@ public:
     void setAtlasEnv(const QString &atlasEnv);
     void deleteToken(const QString &token);
     void addToken(const QString &token);
+    // Peers in "host:port" form, used by next start().
+    void setReplication(const QStringList &peers, const QString &token);
 
 protected:
     void incomingConnection(qintptr socket) override;
@@ -63,6 +142,7 @@ private Q_SLOTS:
     void readClient();
     void discardClient();
     void acceptConnections();
+    void acceptLocalConnections();
 
 public Q_SLOTS:
     bool saveSettings();
@@ -1,4 +1,24 @@
+#include <QDir>
 #include <QFileInfo>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QBuffer>
+#include <QUrl>
+#include <QSslSocket>
+#include <QLocalSocket>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QProcess>
+#include <QUuid>
+#include <QThread>
+#include <QEventLoop>
+#include <QTimer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QSet>
+#include <algorithm>
+#include <functional>
 #include <QScopeGuard>
 #include <windows.h>
 #include <lmcons.h>
@@ -6,6 +26,13 @@
 #include <array>
 
 #include "service.h"
+#include "bulk.h"
+#include "bundle.h"
+#include "resultcache.h"
+#include "persistentcache.h"
+#include "cachearchive.h"
+#include "protocol.h"
+#include "deflate.h"
 #include "qsl.h"
 
 void CService::logMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
@@ -156,12 +183,12 @@ CService::CService(int argc, char **argv)
 
 CService::~CService() = default;
 
-void CService::initializeServer(QCoreApplication* app)
+void CService::initializeServer(QCoreApplication* app, bool toolMode)
 {
     if (m_daemon) return;
     if (app == nullptr) return;
 
-    m_daemon = new CServer(app);
+    m_daemon = new CServer(app,toolMode);
 }
 
 void CService::start()
@@ -194,3 +221,1014 @@ QPointer<CServer> CService::daemon() const
 {
     return m_daemon;
 }
+
+bool CService::isToolCommand(const QString &arg)
+{
+    // Short aliases must not shadow service control options (-i, -u, -t, -p, -r, -h).
+    static const QStringList commands({ QSL("-b"), QSL("-bulk"), QSL("-c"), QSL("-compile"),
+                                              QSL("-replay"), QSL("-export"), QSL("-import"),
+                                              QSL("-merge"), QSL("-filter"), QSL("-benchbatch"),
+                                              QSL("-benchproto"), QSL("-benchcompress"),
+                                              QSL("-benchhttp"), QSL("-benchlocal"),
+                                              QSL("-checkrepl"), QSL("-replnode") });
+    return commands.contains(arg);
+}
+
+int CService::execTool(QCoreApplication *app)
+{
+    const QStringList args = QCoreApplication::arguments();
+    if (args.count() < 2) return -1;
+
+    const QString cmd = args.at(1);
+    if (cmd == QSL("-c") || cmd == QSL("-compile"))
+        return execCompileBundle(args);
+    if (cmd == QSL("-replay"))
+        return execReplay(args);
+    if (cmd == QSL("-export"))
+        return execExportCache(args);
+    if (cmd == QSL("-import"))
+        return execImportCache(args);
+    if (cmd == QSL("-merge"))
+        return execMergeCache(args);
+    if (cmd == QSL("-filter"))
+        return execFilterCache(args);
+    if (cmd == QSL("-benchproto"))
+        return execBenchProtocol(args);
+    if (cmd == QSL("-benchcompress"))
+        return execBenchCompression(args);
+    if (cmd == QSL("-benchhttp"))
+        return execBenchHttp(args);
+    if (cmd == QSL("-benchlocal"))
+        return execBenchLocal(args);
+
+    // Tools may run next to the service, so their server keeps caches in memory.
+    initializeServer(app,true);
+    if (m_daemon.isNull() || !m_daemon->isAtlasLoaded()) {
+        qCritical() << "ATLAS engine not loaded";
+        return -1;
+    }
+
+    if (cmd == QSL("-b") || cmd == QSL("-bulk"))
+        return execBulk(args);
+    if (cmd == QSL("-benchbatch"))
+        return execBenchBatch(args);
+    if (cmd == QSL("-checkrepl"))
+        return execCheckReplication(args);
+    if (cmd == QSL("-replnode"))
+        return execReplicationNode(app,args);
+
+    return -1;
+}
+
+int CService::execBulk(const QStringList &args)
+{
+    if (args.count() < 4) {
+        qInfo() << QSL("  %1 -b(ulk) <input> <output> [JE|EJ|AUTO]").arg(args.at(0));
+        qInfo() << "    Translate subtitles (.srt, .ass, .ssa) or plain text script line by line.";
+        qInfo() << "    Interrupted job is resumed from <output>.ckpt file.";
+        return -1;
+    }
+
+    CAtlas::AtlasDirection direction = CAtlas::Atlas_JE;
+    if (args.count() > 4)
+        direction = CAtlas::directionFromString(args.at(4));
+
+    CBulkTranslator bulk(m_daemon->translator(),m_daemon->statistics());
+    if (!bulk.translateFile(direction,args.at(2),args.at(3))) {
+        qCritical() << "Bulk translation failed:" << bulk.errorString();
+        return -1;
+    }
+
+    for (const auto &line : m_daemon->statistics()->report())
+        qInfo() << line;
+
+    return 0;
+}
+
+int CService::execBenchBatch(const QStringList &args)
+{
+    if (args.count() < 3) {
+        qInfo() << QSL("  %1 -benchbatch <input> [JE|EJ]").arg(args.at(0));
+        qInfo() << "    Compare sequential TR: translation of UTF-8 lines with one TRB: batch, caches bypassed.";
+        return -1;
+    }
+
+    CAtlas::AtlasDirection direction = CAtlas::Atlas_JE;
+    if (args.count() > 3)
+        direction = CAtlas::directionFromString(args.at(3));
+
+    QStringList lines;
+    if (!readInputLines(args.at(2),lines)) return -1;
+
+    CTranslator *translator = m_daemon->translator();
+    QElapsedTimer timer;
+    timer.start();
+    int failures = 0;
+    for (const auto &line : qAsConst(lines)) {
+        if (translator->translate(direction,line,CTranslator::Flag_NoCache).startsWith(QSL("ERR")))
+            failures++;
+    }
+    const qint64 sequentialMs = qMax<qint64>(1,timer.elapsed());
+    qInfo() << "Sequential TR:" << lines.count() << "items in" << sequentialMs << "ms,"
+            << (lines.count() * 1000 / sequentialMs) << "items/s," << failures << "failed";
+
+    timer.start();
+    CBulkTranslator bulk(translator,m_daemon->statistics());
+    QStringList results;
+    const QVector<CAtlas::AtlasDirection> directions(lines.count(),direction);
+    if (!bulk.translateItems(directions,lines,results,CTranslator::Flag_NoCache))
+        qWarning() << "Batch translation:" << bulk.errorString();
+    const qint64 batchMs = qMax<qint64>(1,timer.elapsed());
+    qInfo() << "Batch TRB:     " << lines.count() << "items in" << batchMs << "ms,"
+            << (lines.count() * 1000 / batchMs) << "items/s, speedup"
+            << QString::number(static_cast<double>(sequentialMs) / batchMs,'f',2);
+
+    return 0;
+}
+
+int CService::execCompileBundle(const QStringList &args)
+{
+    if (args.count() < 4) {
+        qInfo() << QSL("  %1 -c(ompile) <input> <output.atb> [JE|EJ]").arg(args.at(0));
+        qInfo() << "    Compile UTF-8 \"source<TAB>translation\" lines into translation bundle.";
+        return -1;
+    }
+
+    CAtlas::AtlasDirection direction = CAtlas::Atlas_JE;
+    if (args.count() > 4)
+        direction = CAtlas::directionFromString(args.at(4));
+    if (direction == CAtlas::Atlas_Auto) {
+        qCritical() << "Bundle direction must be JE or EJ";
+        return -1;
+    }
+
+    QString error;
+    if (!CBundle::compile(args.at(2),args.at(3),direction,&error)) {
+        qCritical() << "Bundle compilation failed:" << error;
+        return -1;
+    }
+
+    CBundle bundle;
+    if (!bundle.open(args.at(3))) {
+        qCritical() << "Compiled bundle is not readable";
+        return -1;
+    }
+    qInfo() << "Bundle compiled:" << bundle.count() << "entries";
+    return 0;
+}
+
+int CService::execReplay(const QStringList &args)
+{
+    if (args.count() < 3) {
+        qInfo() << QSL("  %1 -replay <trace> [cacheBytes]").arg(args.at(0));
+        qInfo() << "    Replay recorded cache trace (Server/cacheTrace) with LRU and TinyLFU policies.";
+        return -1;
+    }
+
+    int maxBytes = CDefaults::cacheMaxBytes;
+    if (args.count() > 3)
+        maxBytes = args.at(3).toInt();
+
+    struct CTraceRecord {
+        bool store;
+        QString key;
+        int valueSize;
+    };
+    QVector<CTraceRecord> trace;
+
+    QFile file(args.at(2));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Unable to open trace file" << args.at(2);
+        return -1;
+    }
+    while (!file.atEnd()) {
+        const QList<QByteArray> fields = file.readLine().trimmed().split(' ');
+        if (fields.count() < 2 || fields.first().size() != 1) continue;
+
+        const char operation = fields.first().at(0);
+        if (operation != 'L' && operation != 'S') continue;
+        trace.append({ operation == 'S', QString::fromUtf8(QByteArray::fromPercentEncoding(fields.at(1))),
+                       fields.value(2).toInt() });
+    }
+    qInfo() << "Trace loaded:" << trace.count() << "operations," << maxBytes << "bytes cache";
+
+    for (const auto policy : { CResultCache::Policy_LRU, CResultCache::Policy_TinyLFU }) {
+        CResultCache cache(maxBytes,policy);
+        QString value;
+        qint64 lookupNsecs = 0;
+        QElapsedTimer timer;
+        for (const auto &rec : trace) {
+            if (rec.store) {
+                cache.insert(rec.key,QString(rec.valueSize,QChar(' ')));
+            } else {
+                timer.start();
+                cache.lookup(rec.key,value);
+                lookupNsecs += timer.nsecsElapsed();
+            }
+        }
+
+        const qint64 lookups = cache.hits() + cache.misses();
+        const double hitRatio = (lookups > 0) ? static_cast<double>(cache.hits()) / lookups : 0.0;
+        qInfo() << (policy == CResultCache::Policy_LRU ? "LRU:    " : "TinyLFU:")
+                << "hit ratio" << QString::number(hitRatio,'f',4)
+                << "hits" << cache.hits() << "misses" << cache.misses()
+                << "evictions" << cache.evictions() << "rejections" << cache.rejections()
+                << "entries" << cache.count()
+                << "lookup ns" << ((lookups > 0) ? lookupNsecs / lookups : 0);
+    }
+
+    return 0;
+}
+
+qint64 CService::persistentCacheSize()
+{
+    // Same size cap as the service, so offline tools do not resize the store.
+    QSettings settings;
+    settings.beginGroup(QSL("Server"));
+    return settings.value(QSL("persistentCacheSize"),CDefaults::persistentCacheMaxSize).toInt();
+}
+
+bool CService::readInputLines(const QString &fileName, QStringList &lines, bool unique)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Unable to open input file" << fileName;
+        return false;
+    }
+    QSet<QString> seen;
+    while (!file.atEnd()) {
+        const QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (line.isEmpty()) continue;
+        if (unique) {
+            if (seen.contains(line)) continue;
+            seen.insert(line);
+        }
+        lines.append(line);
+    }
+    if (lines.isEmpty()) {
+        qCritical() << "No lines in input file" << fileName;
+        return false;
+    }
+    return true;
+}
+
+int CService::execExportCache(const QStringList &args)
+{
+    if (args.count() < 4) {
+        qInfo() << QSL("  %1 -export <cacheDir> <output>").arg(args.at(0));
+        qInfo() << "    Write persistent cache entries to cache archive, service must be stopped.";
+        return -1;
+    }
+
+    CPersistentCache cache;
+    if (!QFileInfo(args.at(2)).isDir() || !cache.open(args.at(2),persistentCacheSize())) {
+        qCritical() << "Unable to open persistent cache" << args.at(2) << "(is the service running?)";
+        return -1;
+    }
+
+    CCacheArchiveWriter writer;
+    if (!writer.open(args.at(3))) {
+        qCritical() << "Unable to create cache archive" << args.at(3) << writer.errorString();
+        return -1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = true;
+    cache.forEach([&writer,&ok](const QByteArray &key, const QByteArray &value){
+        ok = writer.write(key,value);
+        return ok;
+    });
+
+    if (!ok || !writer.commit()) {
+        qCritical() << "Unable to write cache archive" << args.at(3) << writer.errorString();
+        return -1;
+    }
+
+    qInfo() << "Cache exported:" << writer.count() << "entries in" << timer.elapsed() << "ms";
+    return 0;
+}
+
+int CService::execImportCache(const QStringList &args)
+{
+    if (args.count() < 4) {
+        qInfo() << QSL("  %1 -import <input> <cacheDir> [keep|replace]").arg(args.at(0));
+        qInfo() << "    Load cache archive into persistent cache, service must be stopped.";
+        qInfo() << "    Existing entries are kept by default, \"replace\" overwrites them.";
+        return -1;
+    }
+
+    const bool replace = (args.value(4).compare(QSL("replace"),Qt::CaseInsensitive) == 0);
+
+    CCacheArchiveReader reader;
+    if (!reader.open(args.at(2))) {
+        qCritical() << "Unable to open cache archive:" << reader.errorString();
+        return -1;
+    }
+
+    CPersistentCache cache;
+    if (!cache.open(args.at(3),persistentCacheSize())) {
+        qCritical() << "Unable to open persistent cache" << args.at(3) << "(is the service running?)";
+        return -1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 imported = 0;
+    qint64 kept = 0;
+    qint64 rejected = 0;
+    QByteArray key;
+    QByteArray value;
+    QString existing;
+    while (reader.next(key,value)) {
+        // Remaining entries are only counted once the store is full.
+        if (rejected > 0) {
+            rejected++;
+            continue;
+        }
+
+        const QString k = QString::fromUtf8(key);
+        if (!replace && cache.lookup(k,existing)) {
+            kept++;
+            continue;
+        }
+
+        const QString v = QString::fromUtf8(value);
+        if (!cache.insert(k,v)) {
+            // Store is full, wait for compaction to make room and retry once.
+            cache.waitForCompaction();
+            if (!cache.insert(k,v)) {
+                rejected++;
+                continue;
+            }
+        }
+        imported++;
+    }
+    cache.waitForCompaction();
+
+    if (reader.hasError()) {
+        qCritical() << "Cache import failed:" << reader.errorString();
+        return -1;
+    }
+    if (rejected > 0) {
+        qCritical() << "Persistent cache is full:" << imported << "entries imported," << rejected
+                    << "not imported";
+        return -1;
+    }
+
+    qInfo() << "Cache imported:" << imported << "entries," << kept << "existing kept in"
+            << timer.elapsed() << "ms";
+    return 0;
+}
+
+int CService::execMergeCache(const QStringList &args)
+{
+    if (args.count() < 4) {
+        qInfo() << QSL("  %1 -merge <output> <input>... [-first]").arg(args.at(0));
+        qInfo() << "    Merge cache archives, entry from later input wins unless -first is given.";
+        return -1;
+    }
+
+    QStringList inputs = args.mid(3);
+    CCacheArchive::ConflictRule rule = CCacheArchive::Conflict_KeepLast;
+    if (inputs.removeAll(QSL("-first")) > 0)
+        rule = CCacheArchive::Conflict_KeepFirst;
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 written = 0;
+    QString error;
+    if (!CCacheArchive::merge(inputs,args.at(2),rule,&written,&error)) {
+        qCritical() << "Cache merge failed:" << error;
+        return -1;
+    }
+
+    qInfo() << "Cache archives merged:" << written << "entries in" << timer.elapsed() << "ms";
+    return 0;
+}
+
+int CService::execFilterCache(const QStringList &args)
+{
+    if (args.count() < 4) {
+        qInfo() << QSL("  %1 -filter <input> <output> [dir=JE|EJ] [version=N] [env=NAME]").arg(args.at(0));
+        qInfo() << "    Copy cache archive entries matching translation direction, ATLAS version and environment.";
+        return -1;
+    }
+
+    CCacheFilter filter;
+    for (int i = 4; i < args.count(); i++) {
+        const QString name = args.at(i).section(QChar('='),0,0).toLower();
+        const QString value = args.at(i).section(QChar('='),1);
+        if (name == QSL("dir")) {
+            // Auto direction matches every entry, so unknown values must not fall back to it.
+            const QString dir = value.trimmed().toUpper();
+            if (dir != QSL("JE") && dir != QSL("EJ")) {
+                qCritical() << "Unknown direction" << value << "(expected JE or EJ)";
+                return -1;
+            }
+            filter.direction = CAtlas::directionFromString(dir);
+        } else if (name == QSL("version")) {
+            filter.version = value.toInt();
+        } else if (name == QSL("env")) {
+            filter.environment = value;
+        } else {
+            qCritical() << "Unknown filter" << args.at(i);
+            return -1;
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 written = 0;
+    QString error;
+    if (!CCacheArchive::filter(args.at(2),args.at(3),filter,&written,&error)) {
+        qCritical() << "Cache filter failed:" << error;
+        return -1;
+    }
+
+    qInfo() << "Cache archive filtered:" << written << "entries in" << timer.elapsed() << "ms";
+    return 0;
+}
+
+int CService::execBenchProtocol(const QStringList &args)
+{
+    if (args.count() < 3) {
+        qInfo() << QSL("  %1 -benchproto <input>").arg(args.at(0));
+        qInfo() << "    Compare wire size and codec CPU time of text and binary protocols on UTF-8 lines,";
+        qInfo() << "    each line is sent as tagged translation request and echoed back as result.";
+        return -1;
+    }
+
+    QStringList lines;
+    if (!readInputLines(args.at(2),lines)) return -1;
+
+    const int rounds = 20;
+    const qint64 requests = static_cast<qint64>(rounds) * lines.count();
+    qint64 checksum = 0;
+    QElapsedTimer timer;
+
+    // v1: client encodes, server scans lines, decodes and encodes reply, client decodes reply.
+    qint64 textBytes = 0;
+    timer.start();
+    for (int round = 0; round < rounds; round++) {
+        QByteArray wire;
+        QBuffer requestBuffer(&wire);
+        requestBuffer.open(QIODevice::WriteOnly);
+        for (int i = 0; i < lines.count(); i++) {
+            requestBuffer.write("ID:" + QByteArray::number(i) + ":TR:" +
+                                QUrl::toPercentEncoding(lines.at(i)) + "\r\n");
+        }
+        requestBuffer.close();
+
+        QByteArray replies;
+        QBuffer replyBuffer(&replies);
+        replyBuffer.open(QIODevice::WriteOnly);
+        requestBuffer.open(QIODevice::ReadOnly);
+        while (requestBuffer.canReadLine()) {
+            const CProtocol::CRequest request = CProtocol::parseLine(requestBuffer.readLine());
+            const QString text = CProtocol::decode(request,request.argument).trimmed();
+            replyBuffer.write(CProtocol::line(CProtocol::Reply_Result,request.id,text));
+        }
+        replyBuffer.close();
+
+        replyBuffer.open(QIODevice::ReadOnly);
+        while (replyBuffer.canReadLine()) {
+            const QByteArray reply = replyBuffer.readLine();
+            const int sep = reply.indexOf(':',4);
+            checksum += QUrl::fromPercentEncoding(reply.mid(sep + 1).trimmed()).length();
+        }
+        textBytes = wire.size() + replies.size();
+    }
+    const qint64 textNs = timer.nsecsElapsed();
+
+    // v2: same exchange with binary frames.
+    qint64 binaryBytes = 0;
+    timer.start();
+    for (int round = 0; round < rounds; round++) {
+        QByteArray wire;
+        QBuffer requestBuffer(&wire);
+        requestBuffer.open(QIODevice::WriteOnly);
+        for (int i = 0; i < lines.count(); i++) {
+            CProtocol::writeRequestFrame(&requestBuffer,CProtocol::Command_Translate,static_cast<quint32>(i),
+                                         -1,lines.at(i).toUtf8());
+        }
+        requestBuffer.close();
+
+        QByteArray replies;
+        QBuffer replyBuffer(&replies);
+        replyBuffer.open(QIODevice::WriteOnly);
+        requestBuffer.open(QIODevice::ReadOnly);
+        CProtocol::CRequest request;
+        while (CProtocol::readFrame(&requestBuffer,request,nullptr)) {
+            const QString text = CProtocol::decode(request,request.argument).trimmed();
+            CProtocol::writeFrame(&replyBuffer,CProtocol::Reply_Result,request.id.toUInt(),QByteArray(),
+                                  text.toUtf8());
+        }
+        replyBuffer.close();
+
+        replyBuffer.open(QIODevice::ReadOnly);
+        while (CProtocol::readFrame(&replyBuffer,request,nullptr))
+            checksum += request.argument.length();
+        binaryBytes = wire.size() + replies.size();
+    }
+    const qint64 binaryNs = timer.nsecsElapsed();
+
+    qInfo() << "Requests:" << lines.count() << "x" << rounds << "rounds, checksum" << checksum;
+    qInfo() << "Text v1:  " << (textBytes / lines.count()) << "bytes/request,"
+            << (textNs / requests) << "ns/request";
+    qInfo() << "Binary v2:" << (binaryBytes / lines.count()) << "bytes/request,"
+            << (binaryNs / requests) << "ns/request";
+    qInfo() << "Binary saves" << QString::number(100.0 - 100.0 * binaryBytes / qMax<qint64>(1,textBytes),'f',1)
+            << "% bytes, CPU speedup"
+            << QString::number(static_cast<double>(textNs) / qMax<qint64>(1,binaryNs),'f',2);
+
+    return 0;
+}
+
+int CService::execBenchCompression(const QStringList &args)
+{
+    if (args.count() < 3) {
+        qInfo() << QSL("  %1 -benchcompress <input>").arg(args.at(0));
+        qInfo() << "    Send UTF-8 text of growing sizes through connection deflate streams both ways,";
+        qInfo() << "    report wire size of plain and compressed TR: lines and compression CPU time.";
+        return -1;
+    }
+
+    QFile file(args.at(2));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Unable to open input file" << args.at(2);
+        return -1;
+    }
+    const QString source = QString::fromUtf8(file.readAll()).simplified();
+    if (source.isEmpty()) {
+        qCritical() << "No text to compress";
+        return -1;
+    }
+
+    const QVector<int> sizes({ 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 });
+    const int messages = 50;
+    for (const int size : sizes) {
+        QString text;
+        while (text.length() < size)
+            text.append(source);
+        text.truncate(size);
+
+        // Client and server ends, as in one connection.
+        CDeflateStream clientCompressor(CDeflateStream::Mode_Compress);
+        CDeflateStream serverDecompressor(CDeflateStream::Mode_Decompress);
+        CDeflateStream serverCompressor(CDeflateStream::Mode_Compress);
+        CDeflateStream clientDecompressor(CDeflateStream::Mode_Decompress);
+
+        qint64 plainBytes = 0;
+        qint64 wireBytes = 0;
+        bool ok = true;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; ok && i < messages; i++) {
+            // Different tags keep streams from seeing identical messages only.
+            const QByteArray line = "ID:" + QByteArray::number(i) + ":TR:" + QUrl::toPercentEncoding(text);
+            QByteArray packed;
+            QByteArray raw;
+            ok = clientCompressor.process(line,packed,0) &&
+                 serverDecompressor.process(packed,raw,CDefaults::protocolMaxFrameSize) && raw == line &&
+                 serverCompressor.process(raw,packed,0) &&
+                 clientDecompressor.process(packed,raw,CDefaults::protocolMaxFrameSize) && raw == line;
+            plainBytes += line.size() + 2;
+            wireBytes += packed.toBase64().size() + 4;
+        }
+        const qint64 ns = timer.nsecsElapsed();
+        if (!ok) {
+            qCritical() << "Compression round trip failed for size" << size;
+            return -1;
+        }
+
+        qint64 rawBytes = 0;
+        qint64 packedBytes = 0;
+        qint64 nsecs = 0;
+        clientCompressor.takeCounters(rawBytes,packedBytes,nsecs);
+        serverDecompressor.takeCounters(rawBytes,packedBytes,nsecs);
+        serverCompressor.takeCounters(rawBytes,packedBytes,nsecs);
+        clientDecompressor.takeCounters(rawBytes,packedBytes,nsecs);
+
+        qInfo() << QSL("%1 chars:").arg(size,8)
+                << (plainBytes / messages) << "plain bytes," << (wireBytes / messages) << "Z: bytes, ratio"
+                << QString::number(static_cast<double>(packedBytes) / qMax<qint64>(1,rawBytes),'f',3)
+                << "," << (nsecs / (messages * 4000)) << "us per compress/decompress,"
+                << (ns / (messages * 1000)) << "us per round trip";
+    }
+
+    return 0;
+}
+
+namespace {
+const int benchTimeout = 30000;
+
+bool readBenchLine(QIODevice *socket, QByteArray &line)
+{
+    while (!socket->canReadLine()) {
+        if (!socket->waitForReadyRead(benchTimeout)) return false;
+    }
+    line = socket->readLine();
+    return true;
+}
+
+bool readBenchHttpResponse(QIODevice *socket, QByteArray &buffer, QByteArray &body)
+{
+    int headerEnd = -1;
+    while ((headerEnd = buffer.indexOf("\r\n\r\n")) < 0) {
+        if (!socket->waitForReadyRead(benchTimeout)) return false;
+        buffer.append(socket->readAll());
+    }
+
+    int contentLength = 0;
+    for (const QByteArray &line : buffer.left(headerEnd).split('\n')) {
+        if (line.toLower().startsWith("content-length:"))
+            contentLength = line.mid(15).trimmed().toInt();
+    }
+    while (buffer.size() < headerEnd + 4 + contentLength) {
+        if (!socket->waitForReadyRead(benchTimeout)) return false;
+        buffer.append(socket->readAll());
+    }
+
+    const bool ok = buffer.startsWith("HTTP/1.1 200");
+    body = buffer.mid(headerEnd + 4,contentLength);
+    buffer.remove(0,headerEnd + 4 + contentLength);
+    return ok;
+}
+
+QString latencyReport(QVector<qint64> &samples)
+{
+    if (samples.isEmpty()) return QString();
+
+    std::sort(samples.begin(),samples.end());
+    qint64 total = 0;
+    for (const qint64 sample : qAsConst(samples))
+        total += sample;
+    return QSL("avg %1 us, p50 %2 us, p99 %3 us").arg(total / samples.count() / 1000)
+            .arg(samples.at(samples.count() / 2) / 1000)
+            .arg(samples.at(qMin(samples.count() - 1,samples.count() * 99 / 100)) / 1000);
+}
+}
+
+int CService::execBenchHttp(const QStringList &args)
+{
+    if (args.count() < 7) {
+        qInfo() << QSL("  %1 -benchhttp <input> <host> <port> <httpPort> <token>").arg(args.at(0));
+        qInfo() << "    Compare TR: latency over TLS line protocol with POST /translate over HTTP keep-alive";
+        qInfo() << "    on running service, sequential and pipelined.";
+        return -1;
+    }
+
+    QStringList lines;
+    if (!readInputLines(args.at(2),lines)) return -1;
+
+    const QString host = args.at(3);
+    const QByteArray token = args.at(6).toLatin1();
+
+    QSslSocket tls;
+    tls.setPeerVerifyMode(QSslSocket::VerifyNone);
+    tls.connectToHostEncrypted(host,static_cast<quint16>(args.at(4).toUInt()));
+    QByteArray line;
+    if (!tls.waitForEncrypted(benchTimeout)) {
+        qCritical() << "Unable to connect to TLS port:" << tls.errorString();
+        return -1;
+    }
+    tls.write("INIT:" + token + "\r\n");
+    if (!readBenchLine(&tls,line) || !line.startsWith("OK")) {
+        qCritical() << "TLS client not authorized";
+        return -1;
+    }
+
+    QTcpSocket http;
+    http.connectToHost(host,static_cast<quint16>(args.at(5).toUInt()));
+    if (!http.waitForConnected(benchTimeout)) {
+        qCritical() << "Unable to connect to HTTP port:" << http.errorString();
+        return -1;
+    }
+    QByteArray httpBuffer;
+    QByteArray body;
+    auto httpRequest = [&token](const QString &text){
+        const QByteArray json = QJsonDocument(QJsonObject({ { QSL("text"), text } })).toJson(QJsonDocument::Compact);
+        return "POST /translate HTTP/1.1\r\nHost: bench\r\nAuthorization: Bearer " + token +
+                "\r\nContent-Type: application/json\r\nContent-Length: " + QByteArray::number(json.size()) +
+                "\r\n\r\n" + json;
+    };
+
+    // Warm pass fills caches, so both protocols are measured on the same cached results.
+    for (const QString &text : qAsConst(lines)) {
+        tls.write("TR:" + QUrl::toPercentEncoding(text) + "\r\n");
+        if (!readBenchLine(&tls,line)) {
+            qCritical() << "TLS request failed";
+            return -1;
+        }
+    }
+
+    QElapsedTimer timer;
+    QVector<qint64> tlsSamples;
+    QVector<qint64> httpSamples;
+    int failures = 0;
+    for (const QString &text : qAsConst(lines)) {
+        timer.start();
+        tls.write("TR:" + QUrl::toPercentEncoding(text) + "\r\n");
+        if (!readBenchLine(&tls,line) || !line.startsWith("RES:"))
+            failures++;
+        tlsSamples.append(timer.nsecsElapsed());
+
+        timer.start();
+        http.write(httpRequest(text));
+        if (!readBenchHttpResponse(&http,httpBuffer,body))
+            failures++;
+        httpSamples.append(timer.nsecsElapsed());
+    }
+    qInfo() << "Sequential TLS TR: " << latencyReport(tlsSamples);
+    qInfo() << "Sequential HTTP:   " << latencyReport(httpSamples);
+
+    timer.start();
+    for (int i = 0; i < lines.count(); i++)
+        tls.write("ID:" + QByteArray::number(i) + ":TR:" + QUrl::toPercentEncoding(lines.at(i)) + "\r\n");
+    for (int i = 0; i < lines.count(); i++) {
+        if (!readBenchLine(&tls,line) || !line.startsWith("RES:"))
+            failures++;
+    }
+    const qint64 tlsPipelined = qMax<qint64>(1,timer.nsecsElapsed() / 1000);
+
+    timer.start();
+    for (const QString &text : qAsConst(lines))
+        http.write(httpRequest(text));
+    for (int i = 0; i < lines.count(); i++) {
+        if (!readBenchHttpResponse(&http,httpBuffer,body))
+            failures++;
+    }
+    const qint64 httpPipelined = qMax<qint64>(1,timer.nsecsElapsed() / 1000);
+
+    qInfo() << "Pipelined TLS TR: " << lines.count() << "requests in" << tlsPipelined << "us,"
+            << (static_cast<qint64>(lines.count()) * 1000000 / tlsPipelined) << "requests/s";
+    qInfo() << "Pipelined HTTP:   " << lines.count() << "requests in" << httpPipelined << "us,"
+            << (static_cast<qint64>(lines.count()) * 1000000 / httpPipelined) << "requests/s";
+    if (failures > 0)
+        qWarning() << failures << "requests failed";
+
+    tls.write("FIN:\r\n");
+    tls.waitForBytesWritten(benchTimeout);
+    return 0;
+}
+
+int CService::execBenchLocal(const QStringList &args)
+{
+    if (args.count() < 6) {
+        qInfo() << QSL("  %1 -benchlocal <host> <port> <socketName> <token> [count]").arg(args.at(0));
+        qInfo() << "    Compare connect (with INIT:) and DIR: request latency of TLS and local socket";
+        qInfo() << "    transports on running service.";
+        return -1;
+    }
+
+    const QString host = args.at(2);
+    const quint16 port = static_cast<quint16>(args.at(3).toUInt());
+    const QString name = args.at(4);
+    const QByteArray token = args.at(5).toLatin1();
+    const int count = (args.count() > 6) ? qMax(1,args.at(6).toInt()) : 100;
+
+    // Returns connected and authenticated socket, or nullptr.
+    auto connectTls = [&host,port,&token]() -> QIODevice* {
+        auto *socket = new QSslSocket();
+        socket->setPeerVerifyMode(QSslSocket::VerifyNone);
+        socket->connectToHostEncrypted(host,port);
+        QByteArray line;
+        if (!socket->waitForEncrypted(benchTimeout)) {
+            qCritical() << "Unable to connect to TLS port:" << socket->errorString();
+            delete socket;
+            return nullptr;
+        }
+        socket->write("INIT:" + token + "\r\n");
+        if (!readBenchLine(socket,line) || !line.startsWith("OK")) {
+            delete socket;
+            return nullptr;
+        }
+        return socket;
+    };
+    auto connectLocal = [&name,&token]() -> QIODevice* {
+        auto *socket = new QLocalSocket();
+        socket->connectToServer(name);
+        QByteArray line;
+        if (!socket->waitForConnected(benchTimeout)) {
+            qCritical() << "Unable to connect to local socket:" << socket->errorString();
+            delete socket;
+            return nullptr;
+        }
+        socket->write("INIT:" + token + "\r\n");
+        if (!readBenchLine(socket,line) || !line.startsWith("OK")) {
+            delete socket;
+            return nullptr;
+        }
+        return socket;
+    };
+
+    const QVector<QPair<QString,std::function<QIODevice*()> > > transports({
+        { QSL("TLS:  "), connectTls },
+        { QSL("Local:"), connectLocal } });
+
+    for (const auto &transport : transports) {
+        QElapsedTimer timer;
+        QVector<qint64> connectSamples;
+        for (int i = 0; i < count; i++) {
+            timer.start();
+            QScopedPointer<QIODevice> socket(transport.second());
+            if (socket.isNull()) {
+                qCritical() << "Connection failed";
+                return -1;
+            }
+            connectSamples.append(timer.nsecsElapsed());
+            socket->write("FIN:\r\n");
+            socket->waitForBytesWritten(benchTimeout);
+        }
+
+        // DIR: is answered without engine call, so it measures transport and dispatch only.
+        QScopedPointer<QIODevice> socket(transport.second());
+        if (socket.isNull()) {
+            qCritical() << "Connection failed";
+            return -1;
+        }
+        QVector<qint64> requestSamples;
+        QByteArray line;
+        for (int i = 0; i < count; i++) {
+            timer.start();
+            socket->write("DIR:JE\r\n");
+            if (!readBenchLine(socket.data(),line) || !line.startsWith("OK")) {
+                qCritical() << "Request failed";
+                return -1;
+            }
+            requestSamples.append(timer.nsecsElapsed());
+        }
+        socket->write("FIN:\r\n");
+        socket->waitForBytesWritten(benchTimeout);
+
+        qInfo() << transport.first << "connect" << latencyReport(connectSamples);
+        qInfo() << transport.first << "request" << latencyReport(requestSamples);
+    }
+
+    return 0;
+}
+
+int CService::execReplicationNode(QCoreApplication *app, const QStringList &args)
+{
+    // Standby node started by -checkrepl, runs until killed.
+    if (args.count() < 5) {
+        qInfo() << QSL("  %1 -replnode <port> <clientToken> <replicationToken>").arg(args.at(0));
+        return -1;
+    }
+
+    m_daemon->setAtlasHost(QHostAddress(QHostAddress::LocalHost));
+    m_daemon->setAtlasPort(args.at(2).toInt());
+    m_daemon->addToken(args.at(3));
+    m_daemon->setReplication(QStringList(),args.at(4));
+    if (!m_daemon->start()) {
+        qCritical() << "Unable to start replication node";
+        return -1;
+    }
+    return app->exec();
+}
+
+int CService::execCheckReplication(const QStringList &args)
+{
+    if (args.count() < 3) {
+        qInfo() << QSL("  %1 -checkrepl <input> [JE|EJ]").arg(args.at(0));
+        qInfo() << "    Start primary and standby nodes on localhost with in-memory caches, translate UTF-8 lines";
+        qInfo() << "    on primary and check that standby answers all of them from replicated entries.";
+        return -1;
+    }
+
+    CAtlas::AtlasDirection direction = CAtlas::Atlas_JE;
+    if (args.count() > 3)
+        direction = CAtlas::directionFromString(args.at(3));
+
+    QStringList lines;
+    if (!readInputLines(args.at(2),lines,true)) return -1;
+
+    auto freePort = []{
+        QTcpServer probe;
+        probe.listen(QHostAddress::LocalHost,0);
+        return probe.serverPort();
+    };
+    const QString clientToken = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    const QString replicationToken = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    const quint16 standbyPort = freePort();
+
+    // Standby runs in its own process, ATLAS engine is one per process.
+    QProcess standby;
+    standby.setProcessChannelMode(QProcess::ForwardedChannels);
+    standby.start(QCoreApplication::applicationFilePath(),
+                  { QSL("-replnode"), QString::number(standbyPort), clientToken, replicationToken });
+    auto cleanup = qScopeGuard([&standby]{
+        standby.kill();
+        standby.waitForFinished(benchTimeout);
+    });
+    if (!standby.waitForStarted(benchTimeout)) {
+        qCritical() << "Unable to start standby node:" << standby.errorString();
+        return -1;
+    }
+
+    // Engine loading takes a while.
+    QElapsedTimer timer;
+    timer.start();
+    bool standbyReady = false;
+    while (!standbyReady && timer.elapsed() < benchTimeout && standby.state() == QProcess::Running) {
+        QTcpSocket probe;
+        probe.connectToHost(QHostAddress::LocalHost,standbyPort);
+        standbyReady = probe.waitForConnected(1000);
+        if (!standbyReady)
+            QThread::msleep(500);
+    }
+    if (!standbyReady) {
+        qCritical() << "Standby node is not listening";
+        return -1;
+    }
+
+    m_daemon->setAtlasHost(QHostAddress(QHostAddress::LocalHost));
+    m_daemon->setAtlasPort(freePort());
+    m_daemon->setReplication({ QSL("127.0.0.1:%1").arg(standbyPort) },replicationToken);
+    if (!m_daemon->start()) {
+        qCritical() << "Unable to start primary node";
+        return -1;
+    }
+
+    CTranslator *translator = m_daemon->translator();
+    QHash<QString,QString> expected;
+    for (const auto &line : qAsConst(lines)) {
+        const QString res = translator->translate(direction,line);
+        if (!res.startsWith(QSL("ERR")))
+            expected.insert(line,res);
+    }
+    qInfo() << "Primary translated" << expected.count() << "of" << lines.count() << "lines";
+
+    // Replication queue is flushed by primary event loop.
+    CStatistics *stats = m_daemon->statistics();
+    timer.start();
+    QEventLoop loop;
+    do {
+        QTimer::singleShot(CDefaults::replicationFlushInterval,&loop,&QEventLoop::quit);
+        loop.exec();
+    } while ((stats->value(QSL("repl.peersReady")) == 0 || stats->value(QSL("repl.queued")) > 0) &&
+             timer.elapsed() < benchTimeout);
+    if (stats->value(QSL("repl.queued")) > 0) {
+        qCritical() << "Replication queue was not drained," << stats->value(QSL("repl.queued")) << "entries left";
+        return -1;
+    }
+    qInfo() << "Replication drained in" << timer.elapsed() << "ms," << stats->value(QSL("repl.sent")) << "entries sent";
+
+    QSslSocket client;
+    client.setPeerVerifyMode(QSslSocket::VerifyNone);
+    client.connectToHostEncrypted(QSL("127.0.0.1"),standbyPort);
+    QByteArray line;
+    if (!client.waitForEncrypted(benchTimeout)) {
+        qCritical() << "Unable to connect to standby node:" << client.errorString();
+        return -1;
+    }
+    client.write("INIT:" + clientToken.toLatin1() + "\r\n");
+    if (!readBenchLine(&client,line) || !line.startsWith("OK")) {
+        qCritical() << "Standby node refused client token";
+        return -1;
+    }
+
+    // Client token must not be able to write replicated entries.
+    client.write("REPL:x:y\r\n");
+    if (!readBenchLine(&client,line) || line.trimmed() != "ERR:NOT_AUTHORIZED") {
+        qCritical() << "Standby node accepted REPL: from client connection";
+        return -1;
+    }
+
+    int mismatches = 0;
+    for (auto it = expected.constBegin(), end = expected.constEnd(); it != end; ++it) {
+        client.write("TR:" + QUrl::toPercentEncoding(it.key()) + "\r\n");
+        if (!readBenchLine(&client,line)) {
+            qCritical() << "Standby node does not answer";
+            return -1;
+        }
+        line = line.trimmed();
+        if (!line.startsWith("RES:") || QUrl::fromPercentEncoding(line.mid(4)) != it.value())
+            mismatches++;
+    }
+
+    // Standby must answer everything from replicated cache, without own engine calls.
+    qint64 engineCalls = -1;
+    client.write("STAT:\r\n");
+    if (readBenchLine(&client,line) && line.startsWith("RES:")) {
+        const QStringList report = QUrl::fromPercentEncoding(line.trimmed().mid(4)).split(QChar('\n'));
+        engineCalls = 0;
+        for (const QString &counter : report) {
+            if (counter.startsWith(QSL("engine.calls=")))
+                engineCalls = counter.mid(13).toLongLong();
+        }
+    }
+    client.write("FIN:\r\n");
+    client.waitForBytesWritten(benchTimeout);
+
+    qInfo() << "Standby answered" << (expected.count() - mismatches) << "of" << expected.count()
+            << "lines as primary," << engineCalls << "own engine calls";
+    if (mismatches > 0 || engineCalls != 0) {
+        qCritical() << "Nodes did not converge";
+        return -1;
+    }
+
+    qInfo() << "Nodes converged";
+    return 0;
+}
@@ -20,9 +20,13 @@ public:
     static int runAs(const QString& app, const QString& arguments,
                      bool waitToFinish = false);
     static QString getCurrentUserName();
-    void initializeServer(QCoreApplication *app);
+    void initializeServer(QCoreApplication *app, bool toolMode = false);
     QPointer<CServer> daemon() const;
 
+    // Offline command-line modes, run without service infrastructure.
+    static bool isToolCommand(const QString &arg);
+    int execTool(QCoreApplication *app);
+
 protected:
     void start() override;
     void pause() override;
@@ -33,6 +37,23 @@ private:
     Q_DISABLE_MOVE(CService)
 
     QPointer<CServer> m_daemon;
+    int execBulk(const QStringList &args);
+    int execBenchBatch(const QStringList &args);
+    int execCheckReplication(const QStringList &args);
+    int execReplicationNode(QCoreApplication *app, const QStringList &args);
+    static int execCompileBundle(const QStringList &args);
+    static int execReplay(const QStringList &args);
+    static int execExportCache(const QStringList &args);
+    static int execImportCache(const QStringList &args);
+    static int execMergeCache(const QStringList &args);
+    static int execFilterCache(const QStringList &args);
+    static int execBenchProtocol(const QStringList &args);
+    static int execBenchCompression(const QStringList &args);
+    static int execBenchHttp(const QStringList &args);
+    static int execBenchLocal(const QStringList &args);
+    static qint64 persistentCacheSize();
+    // Non-empty trimmed UTF-8 lines, false (with message) if file is missing or has none.
+    static bool readInputLines(const QString &fileName, QStringList &lines, bool unique = false);
     static void logMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg);
 };
 
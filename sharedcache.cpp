@@ -0,0 +1,312 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QScopeGuard>
+#include <QThread>
+#include <QDebug>
+#include <cstring>
+#include <limits>
+#include "sharedcache.h"
+#include "hashutils.h"
+#include "qsl.h"
+
+namespace {
+const quint32 sharedMagic = 0x43485341; // ASHC
+const quint32 sharedVersion = 1;
+const quint32 sharedWays = 4;
+const quint32 sharedSlotSize = 512;
+const quint32 sharedStripeCount = 1024;
+const quint32 leaseSeconds = 2;
+const int stripeSpins = 4096;
+const int initSpins = 1000000;
+const int readRetries = 3;
+
+constexpr quint32 alignedSize(quint32 size)
+{
+    return (size + 63) / 64 * 64;
+}
+}
+
+CSharedCache::CSharedCache(QObject *parent)
+    : QObject(parent)
+{
+}
+
+CSharedCache::~CSharedCache()
+{
+    close();
+}
+
+bool CSharedCache::open(const QString &name, int size)
+{
+    close();
+    m_pid = static_cast<quint32>(QCoreApplication::applicationPid());
+
+    m_memory.setKey(name);
+    const bool created = m_memory.create(size);
+    if (!created && (m_memory.error() != QSharedMemory::AlreadyExists || !m_memory.attach())) {
+        qWarning() << "Unable to attach shared cache" << name << m_memory.errorString();
+        return false;
+    }
+
+    m_header = static_cast<CHeader *>(m_memory.data());
+    if (!initialize(m_memory.size())) {
+        qWarning() << "Shared cache" << name << "has incompatible layout";
+        close();
+        return false;
+    }
+
+    qInfo() << "Shared cache" << (created ? "created:" : "attached:") << name
+            << m_header->bucketCount * m_header->ways << "slots";
+    return true;
+}
+
+bool CSharedCache::initialize(int size)
+{
+    const quint32 stripesOffset = alignedSize(sizeof(CHeader));
+    const quint32 tableOffset = stripesOffset + sharedStripeCount * sizeof(CStripe);
+    uchar *data = static_cast<uchar *>(m_memory.data());
+
+    // New segment is zero-filled. Whoever comes first formats it, other
+    // processes wait for the magic. Initializer crash is covered by lease.
+    if (m_header->magic.load(std::memory_order_acquire) != sharedMagic) {
+        const quint64 owner = lock(m_header->initLock,initSpins);
+        if (owner == 0) return false;
+        auto unlocker = qScopeGuard([this,owner]{ unlock(m_header->initLock,owner); });
+
+        if (m_header->magic.load(std::memory_order_relaxed) != sharedMagic) {
+            if (size < static_cast<int>(tableOffset + sharedWays * sharedSlotSize)) return false;
+
+            std::memset(data + stripesOffset,0,static_cast<size_t>(size) - stripesOffset);
+            m_header->version = sharedVersion;
+            m_header->ways = sharedWays;
+            m_header->slotSize = sharedSlotSize;
+            m_header->stripeCount = sharedStripeCount;
+            m_header->bucketCount = (static_cast<quint32>(size) - tableOffset) / (sharedWays * sharedSlotSize);
+            m_header->clock.store(1,std::memory_order_relaxed);
+            m_header->inserts.store(0,std::memory_order_relaxed);
+            m_header->magic.store(sharedMagic,std::memory_order_release);
+        }
+    }
+
+    // Segment may be created by other build or with other size.
+    if (m_header->version != sharedVersion || m_header->ways != sharedWays ||
+            m_header->slotSize != sharedSlotSize || m_header->stripeCount != sharedStripeCount ||
+            m_header->bucketCount == 0 ||
+            static_cast<qint64>(tableOffset) + static_cast<qint64>(m_header->bucketCount) *
+            sharedWays * sharedSlotSize > size)
+        return false;
+
+    m_stripes = reinterpret_cast<CStripe *>(data + stripesOffset);
+    m_table = data + tableOffset;
+    return true;
+}
+
+void CSharedCache::close()
+{
+    m_header = nullptr;
+    m_stripes = nullptr;
+    m_table = nullptr;
+    if (m_memory.isAttached())
+        m_memory.detach();
+}
+
+bool CSharedCache::isOpen() const
+{
+    return (m_table != nullptr);
+}
+
+quint32 CSharedCache::now()
+{
+    // Monotonic clock reference is common for all processes on the host.
+    QElapsedTimer timer;
+    timer.start();
+    return static_cast<quint32>(timer.msecsSinceReference() / 1000);
+}
+
+quint64 CSharedCache::keyHash(const QByteArray &key)
+{
+    const quint64 res = fnvHash64(key.constData(),key.size());
+    return (res == 0) ? 1 : res;
+}
+
+quint64 CSharedCache::lock(std::atomic<quint64> &word, int maxSpins)
+{
+    for (int spin = 0; spin < maxSpins; spin++) {
+        const quint64 mine = (static_cast<quint64>(m_pid) << 32) | now();
+        quint64 current = 0;
+        if (word.compare_exchange_strong(current,mine,std::memory_order_acquire))
+            return mine;
+
+        // Owner did not release the lock in time, assume it is dead.
+        const quint32 started = static_cast<quint32>(current);
+        if (now() - started > leaseSeconds &&
+                word.compare_exchange_strong(current,mine,std::memory_order_acquire)) {
+            m_lockSteals++;
+            qWarning() << "Shared cache lock of process" << (current >> 32) << "expired";
+            return mine;
+        }
+
+        if (spin > 16)
+            QThread::yieldCurrentThread();
+    }
+
+    m_lockTimeouts++;
+    return 0;
+}
+
+void CSharedCache::unlock(std::atomic<quint64> &word, quint64 value)
+{
+    // Lock may be taken over already, if we were stalled for too long.
+    word.compare_exchange_strong(value,0,std::memory_order_release);
+}
+
+CSharedCache::CSlot *CSharedCache::slotAt(quint32 bucket, quint32 way) const
+{
+    return reinterpret_cast<CSlot *>(m_table + (static_cast<qint64>(bucket) * sharedWays + way) * sharedSlotSize);
+}
+
+bool CSharedCache::lookup(const QString &key, QString &value)
+{
+    if (!isOpen()) return false;
+
+    const QByteArray k = key.toUtf8();
+    const quint64 hash = keyHash(k);
+    const quint32 bucket = static_cast<quint32>(hash % m_header->bucketCount);
+    const int payloadSize = sharedSlotSize - sizeof(CSlot);
+    char buf[sharedSlotSize];
+
+    for (quint32 way = 0; way < sharedWays; way++) {
+        CSlot *slot = slotAt(bucket,way);
+        for (int attempt = 0; attempt < readRetries; attempt++) {
+            // Odd counter: slot is being written, or writer died in the middle.
+            const quint32 seq = slot->seq.load(std::memory_order_acquire);
+            if (seq == 0) break;
+            if ((seq & 1) != 0) continue;
+
+            const quint64 slotHash = slot->hash;
+            const quint32 writer = slot->writer;
+            const int keySize = slot->keySize;
+            const int valueSize = slot->valueSize;
+            const quint16 crc = slot->crc;
+            const bool candidate = (slotHash == hash) && (keySize == k.size()) &&
+                                   (keySize + valueSize <= payloadSize);
+            if (candidate) {
+                std::memcpy(buf,reinterpret_cast<const char *>(slot) + sizeof(CSlot),
+                            static_cast<size_t>(keySize + valueSize));
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) != seq) continue;
+            if (!candidate) break;
+
+            if (std::memcmp(buf,k.constData(),static_cast<size_t>(keySize)) != 0 ||
+                    qChecksum(buf,static_cast<uint>(keySize + valueSize)) != crc)
+                break;
+
+            value = QString::fromUtf8(buf + keySize,valueSize);
+            slot->tick.store(m_header->clock.load(std::memory_order_relaxed),std::memory_order_relaxed);
+            m_hits++;
+            if (writer != m_pid)
+                m_foreignHits++;
+            return true;
+        }
+    }
+
+    m_misses++;
+    return false;
+}
+
+void CSharedCache::insert(const QString &key, const QString &value)
+{
+    if (!isOpen()) return;
+
+    const QByteArray k = key.toUtf8();
+    const QByteArray v = value.toUtf8();
+    const int payloadSize = sharedSlotSize - sizeof(CSlot);
+    if (k.size() + v.size() > payloadSize) {
+        m_skipped++;
+        return;
+    }
+
+    const quint64 hash = keyHash(k);
+    const quint32 bucket = static_cast<quint32>(hash % m_header->bucketCount);
+    CStripe &stripe = m_stripes[bucket % sharedStripeCount];
+    const quint64 owner = lock(stripe.lock,stripeSpins);
+    if (owner == 0) return;
+    auto unlocker = qScopeGuard([this,&stripe,owner]{ unlock(stripe.lock,owner); });
+
+    // Same key, then free or torn slot, then least recently used one.
+    CSlot *victim = nullptr;
+    quint64 oldest = std::numeric_limits<quint64>::max();
+    for (quint32 way = 0; way < sharedWays; way++) {
+        CSlot *slot = slotAt(bucket,way);
+        const quint32 seq = slot->seq.load(std::memory_order_relaxed);
+        if (seq != 0 && (seq & 1) == 0 && slot->hash == hash && slot->keySize == k.size() &&
+                std::memcmp(reinterpret_cast<const char *>(slot) + sizeof(CSlot),
+                            k.constData(),static_cast<size_t>(k.size())) == 0) {
+            victim = slot;
+            break;
+        }
+
+        const quint64 tick = (seq == 0 || (seq & 1) != 0) ? 0 : slot->tick.load(std::memory_order_relaxed);
+        if (tick < oldest) {
+            oldest = tick;
+            victim = slot;
+        }
+    }
+
+    const quint32 seq = victim->seq.load(std::memory_order_relaxed) | 1;
+    victim->seq.store(seq,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    char *payload = reinterpret_cast<char *>(victim) + sizeof(CSlot);
+    std::memcpy(payload,k.constData(),static_cast<size_t>(k.size()));
+    std::memcpy(payload + k.size(),v.constData(),static_cast<size_t>(v.size()));
+    victim->writer = m_pid;
+    victim->hash = hash;
+    victim->keySize = static_cast<quint16>(k.size());
+    victim->valueSize = static_cast<quint16>(v.size());
+    victim->crc = qChecksum(payload,static_cast<uint>(k.size() + v.size()));
+    victim->reserved = 0;
+    victim->tick.store(m_header->clock.fetch_add(1,std::memory_order_relaxed),std::memory_order_relaxed);
+
+    const quint32 next = (seq + 1 == 0) ? 2 : seq + 1;
+    victim->seq.store(next,std::memory_order_release);
+    m_header->inserts.fetch_add(1,std::memory_order_relaxed);
+}
+
+qint64 CSharedCache::hits() const
+{
+    return m_hits;
+}
+
+qint64 CSharedCache::foreignHits() const
+{
+    return m_foreignHits;
+}
+
+qint64 CSharedCache::misses() const
+{
+    return m_misses;
+}
+
+qint64 CSharedCache::skipped() const
+{
+    return m_skipped;
+}
+
+qint64 CSharedCache::lockSteals() const
+{
+    return m_lockSteals;
+}
+
+qint64 CSharedCache::lockTimeouts() const
+{
+    return m_lockTimeouts;
+}
+
+qint64 CSharedCache::inserts() const
+{
+    if (!isOpen()) return 0;
+    return static_cast<qint64>(m_header->inserts.load(std::memory_order_relaxed));
+}
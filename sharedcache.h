@@ -0,0 +1,94 @@
+#ifndef CSHAREDCACHE_H
+#define CSHAREDCACHE_H
+
+#include <QObject>
+#include <QSharedMemory>
+#include <QString>
+#include <atomic>
+
+namespace CDefaults {
+const int sharedCacheSize = 16 * 1024 * 1024;
+const char sharedCacheName[] = "atlastcpsvc-ng-cache";
+}
+
+// Translation cache in named shared memory, attached by all service instances
+// on the host. Set-associative table of fixed-size slots. Readers are
+// lock-free (per-slot sequence counter), writers take one of many striped
+// spinlocks. Locks are leases: lock of crashed process expires and is taken
+// over, torn slots are detected by sequence counter and checksum.
+class CSharedCache : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CSharedCache)
+public:
+    explicit CSharedCache(QObject *parent = nullptr);
+    ~CSharedCache() override;
+
+    bool open(const QString &name = QString::fromLatin1(CDefaults::sharedCacheName),
+              int size = CDefaults::sharedCacheSize);
+    void close();
+    bool isOpen() const;
+
+    bool lookup(const QString &key, QString &value);
+    void insert(const QString &key, const QString &value);
+
+    // Process-local counters
+    qint64 hits() const;
+    qint64 foreignHits() const;
+    qint64 misses() const;
+    qint64 skipped() const;
+    qint64 lockSteals() const;
+    qint64 lockTimeouts() const;
+    // Shared counter of all attached processes
+    qint64 inserts() const;
+
+private:
+    struct CHeader {
+        std::atomic<quint32> magic;
+        quint32 version;
+        quint32 bucketCount;
+        quint32 ways;
+        quint32 slotSize;
+        quint32 stripeCount;
+        std::atomic<quint64> initLock;
+        std::atomic<quint64> clock;
+        std::atomic<quint64> inserts;
+    };
+    struct alignas(64) CStripe {
+        std::atomic<quint64> lock; // owner pid << 32 | lease start
+    };
+    struct CSlot {
+        std::atomic<quint32> seq; // odd while slot is written
+        quint32 writer;
+        quint64 hash;
+        std::atomic<quint64> tick;
+        quint16 keySize;
+        quint16 valueSize;
+        quint16 crc;
+        quint16 reserved;
+    };
+
+    QSharedMemory m_memory;
+    CHeader *m_header { nullptr };
+    CStripe *m_stripes { nullptr };
+    uchar *m_table { nullptr };
+    quint32 m_pid { 0 };
+
+    std::atomic<qint64> m_hits { 0 };
+    std::atomic<qint64> m_foreignHits { 0 };
+    std::atomic<qint64> m_misses { 0 };
+    std::atomic<qint64> m_skipped { 0 };
+    std::atomic<qint64> m_lockSteals { 0 };
+    std::atomic<qint64> m_lockTimeouts { 0 };
+
+    bool initialize(int size);
+    CSlot *slotAt(quint32 bucket, quint32 way) const;
+    // Returns lock value to pass to unlock(), or 0 on timeout.
+    quint64 lock(std::atomic<quint64> &word, int maxSpins);
+    void unlock(std::atomic<quint64> &word, quint64 value);
+
+    static quint64 keyHash(const QByteArray &key);
+    static quint32 now();
+};
+
+#endif // CSHAREDCACHE_H
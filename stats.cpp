@@ -0,0 +1,56 @@
+#include <QMutexLocker>
+#include "stats.h"
+#include "qsl.h"
+
+CStatistics::CStatistics(QObject *parent)
+    : QObject(parent)
+{
+}
+
+CStatistics::~CStatistics() = default;
+
+void CStatistics::add(const QString &counter, qint64 delta)
+{
+    QMutexLocker locker(&m_mutex);
+    m_counters[counter] += delta;
+}
+
+void CStatistics::set(const QString &counter, qint64 value)
+{
+    QMutexLocker locker(&m_mutex);
+    m_counters[counter] = value;
+}
+
+qint64 CStatistics::value(const QString &counter) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_counters.value(counter,0);
+}
+
+void CStatistics::addRatio(const QString &name, const QString &numerator, const QString &denominator)
+{
+    QMutexLocker locker(&m_mutex);
+    m_ratios.insert(name,qMakePair(numerator,denominator));
+}
+
+QStringList CStatistics::report() const
+{
+    QStringList res;
+
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_counters.constBegin(), end = m_counters.constEnd(); it != end; ++it)
+        res.append(QSL("%1=%2").arg(it.key()).arg(it.value()));
+
+    for (auto it = m_ratios.constBegin(), end = m_ratios.constEnd(); it != end; ++it) {
+        const qint64 num = m_counters.value(it.value().first,0);
+        const qint64 denom = m_counters.value(it.value().second,0);
+        double ratio = 0.0;
+        if (denom > 0)
+            ratio = static_cast<double>(num) / static_cast<double>(denom);
+        res.append(QSL("%1=%2").arg(it.key()).arg(ratio,0,'f',4));
+    }
+    locker.unlock();
+
+    res.sort();
+    return res;
+}
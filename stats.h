@@ -0,0 +1,34 @@
+#ifndef CSTATISTICS_H
+#define CSTATISTICS_H
+
+#include <QObject>
+#include <QHash>
+#include <QPair>
+#include <QMutex>
+#include <QStringList>
+
+class CStatistics : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CStatistics)
+public:
+    explicit CStatistics(QObject *parent = nullptr);
+    ~CStatistics() override;
+
+    void add(const QString &counter, qint64 delta = 1);
+    void set(const QString &counter, qint64 value);
+    qint64 value(const QString &counter) const;
+
+    // Derived value, reported as numerator/denominator.
+    void addRatio(const QString &name, const QString &numerator, const QString &denominator);
+
+    // Sorted "name=value" lines for all counters and ratios.
+    QStringList report() const;
+
+private:
+    mutable QMutex m_mutex;
+    QHash<QString,qint64> m_counters;
+    QHash<QString,QPair<QString,QString> > m_ratios;
+};
+
+#endif // CSTATISTICS_H
@@ -0,0 +1,222 @@
+#include <QSettings>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <algorithm>
+#include "templater.h"
+#include "qsl.h"
+
+CTemplater::CTemplater() = default;
+
+void CTemplater::loadSettings()
+{
+    QSettings settings;
+    settings.beginGroup(QSL("Templating"));
+    m_enabled = settings.value(QSL("enabled"),false).toBool();
+    m_verifyInterval = settings.value(QSL("verifyInterval"),0).toInt();
+    const QStringList names = settings.value(QSL("names"),QStringList()).toStringList();
+    settings.endGroup();
+
+    setNames(names);
+}
+
+bool CTemplater::isEnabled() const
+{
+    return m_enabled;
+}
+
+int CTemplater::verifyInterval() const
+{
+    return m_verifyInterval;
+}
+
+void CTemplater::setNames(const QStringList &names)
+{
+    // Entry format: "name" or "name=replacement".
+    QHash<QChar,QVector<QPair<QString,QString> > > index;
+    for (const auto &entry : names) {
+        const int sep = entry.indexOf(QChar('='));
+        const QString name = entry.left(sep).trimmed();
+        if (name.isEmpty()) continue;
+        QString value = name;
+        if (sep >= 0)
+            value = entry.mid(sep + 1).trimmed();
+        index[name.at(0)].append(qMakePair(name,value));
+    }
+    for (auto &list : index) {
+        std::sort(list.begin(),list.end(),[](const QPair<QString,QString> &a, const QPair<QString,QString> &b){
+            return a.first.length() > b.first.length();
+        });
+    }
+
+    QWriteLocker locker(&m_namesLock);
+    m_names = index;
+}
+
+QString CTemplater::wordPlaceholder(int index)
+{
+    return QSL("ZQX%1").arg(QChar('A' + index));
+}
+
+QString CTemplater::numberPlaceholder(int index)
+{
+    return QString::number(CDefaults::templateNumberBase + index + 1);
+}
+
+bool CTemplater::isDigit(QChar c)
+{
+    const ushort u = c.unicode();
+    return (u >= '0' && u <= '9') || (u >= 0xff10 && u <= 0xff19);
+}
+
+bool CTemplater::isLatin(QChar c)
+{
+    const ushort u = c.unicode();
+    return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z');
+}
+
+CTemplate CTemplater::make(const QString &str, const QVector<CGlossaryMatch> &matches,
+                           const CGlossary *glossary, bool templateValues) const
+{
+    CTemplate res;
+    res.text.reserve(str.length());
+
+    QReadLocker locker(&m_namesLock);
+
+    const int len = str.length();
+    int matchIdx = 0;
+    int pos = 0;
+    while (pos < len) {
+        const QChar c = str.at(pos);
+
+        while (matchIdx < matches.count() && matches.at(matchIdx).start < pos)
+            matchIdx++;
+        if (matchIdx < matches.count() && matches.at(matchIdx).start == pos &&
+                (glossary == nullptr || res.words.count() >= CDefaults::templateMaxWords)) {
+            matchIdx++; // no room for placeholder, keep term as is
+        }
+        const int nextMatch = (matchIdx < matches.count()) ? matches.at(matchIdx).start : len;
+
+        if (nextMatch == pos) {
+            const CGlossaryMatch &match = matches.at(matchIdx);
+            QString value = glossary->replacement(match.entry);
+            if (value.isEmpty())
+                value = str.mid(match.start,match.length);
+            res.text.append(wordPlaceholder(res.words.count()));
+            res.words.append(value);
+            res.glossaryMatches++;
+            pos += match.length;
+            continue;
+        }
+
+        if (!templateValues) {
+            res.text.append(c);
+            pos++;
+            continue;
+        }
+
+        const auto names = m_names.constFind(c);
+        if (names != m_names.constEnd()) {
+            const auto name = std::find_if(names.value().constBegin(),names.value().constEnd(),
+                                           [&str,pos,nextMatch](const QPair<QString,QString> &item){
+                return (pos + item.first.length() <= nextMatch) &&
+                        (str.midRef(pos,item.first.length()) == item.first);
+            });
+            if (name != names.value().constEnd() && res.words.count() < CDefaults::templateMaxWords) {
+                res.text.append(wordPlaceholder(res.words.count()));
+                res.words.append(name->second);
+                pos += name->first.length();
+                continue;
+            }
+        }
+
+        if (isDigit(c) && res.numbers.count() < CDefaults::templateMaxNumbers) {
+            QString number;
+            int end = pos;
+            while (end < nextMatch) {
+                const QChar d = str.at(end);
+                if (isDigit(d)) {
+                    if (d.unicode() >= 0xff10) {
+                        number.append(QChar('0' + (d.unicode() - 0xff10)));
+                    } else {
+                        number.append(d);
+                    }
+                } else if ((d == QChar(',') || d == QChar('.')) && (end + 1 < nextMatch) && isDigit(str.at(end + 1))) {
+                    number.append(d);
+                } else {
+                    break;
+                }
+                end++;
+            }
+            res.text.append(numberPlaceholder(res.numbers.count()));
+            res.numbers.append(number);
+            pos = end;
+            continue;
+        }
+
+        if (isLatin(c) && res.words.count() < CDefaults::templateMaxWords) {
+            int end = pos;
+            while (end < nextMatch && isLatin(str.at(end)))
+                end++;
+            res.text.append(wordPlaceholder(res.words.count()));
+            res.words.append(str.mid(pos,end - pos));
+            pos = end;
+            continue;
+        }
+
+        res.text.append(c);
+        pos++;
+    }
+
+    return res;
+}
+
+bool CTemplater::restore(const CTemplate &tpl, const QString &translated, QString &result)
+{
+    QVector<int> numbersSeen(tpl.numbers.count(),0);
+    QVector<int> wordsSeen(tpl.words.count(),0);
+
+    QString res;
+    res.reserve(translated.length());
+
+    const int len = translated.length();
+    int pos = 0;
+    while (pos < len) {
+        const QChar c = translated.at(pos);
+        int end = pos;
+        if (c.unicode() >= '0' && c.unicode() <= '9') {
+            while (end < len && translated.at(end).unicode() >= '0' && translated.at(end).unicode() <= '9')
+                end++;
+            const int idx = QStringRef(&translated,pos,end - pos).toInt() - CDefaults::templateNumberBase - 1;
+            if ((end - pos) == 3 && idx >= 0 && idx < tpl.numbers.count()) {
+                res.append(tpl.numbers.at(idx));
+                numbersSeen[idx]++;
+            } else {
+                res.append(QStringRef(&translated,pos,end - pos));
+            }
+            pos = end;
+
+        } else if (isLatin(c)) {
+            while (end < len && isLatin(translated.at(end)))
+                end++;
+            const QStringRef word(&translated,pos,end - pos);
+            const int idx = (word.length() == 4 && word.startsWith(QSL("ZQX"))) ? word.at(3).unicode() - 'A' : -1;
+            if (idx >= 0 && idx < tpl.words.count()) {
+                res.append(tpl.words.at(idx));
+                wordsSeen[idx]++;
+            } else {
+                res.append(word);
+            }
+            pos = end;
+
+        } else {
+            res.append(c);
+            pos++;
+        }
+    }
+
+    if (numbersSeen.contains(0) || wordsSeen.contains(0))
+        return false;
+
+    result = res;
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef CTEMPLATER_H
+#define CTEMPLATER_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QReadWriteLock>
+#include "glossary.h"
+
+namespace CDefaults {
+const int templateNumberBase = 700;
+const int templateMaxNumbers = 99;
+const int templateMaxWords = 26;
+}
+
+struct CTemplate {
+    QString text;
+    QStringList numbers;
+    QStringList words;
+    int glossaryMatches { 0 };
+
+    bool isEmpty() const { return numbers.isEmpty() && words.isEmpty(); }
+};
+
+class CTemplater
+{
+public:
+    CTemplater();
+
+    void loadSettings();
+    bool isEnabled() const;
+    int verifyInterval() const;
+    void setNames(const QStringList &names);
+
+    // Replaces glossary matches, and with templateValues also numbers, Latin
+    // words and known names, with placeholders that ATLAS passes through
+    // untouched in JE direction.
+    CTemplate make(const QString &str, const QVector<CGlossaryMatch> &matches,
+                   const CGlossary *glossary, bool templateValues) const;
+    // Substitutes template values back. Fails if any placeholder was lost by engine.
+    static bool restore(const CTemplate &tpl, const QString &translated, QString &result);
+
+private:
+    Q_DISABLE_COPY(CTemplater)
+
+    bool m_enabled { false };
+    int m_verifyInterval { 0 };
+    mutable QReadWriteLock m_namesLock;
+    QHash<QChar,QVector<QPair<QString,QString> > > m_names; // by first char, longest first
+
+    static QString wordPlaceholder(int index);
+    static QString numberPlaceholder(int index);
+    static bool isDigit(QChar c);
+    static bool isLatin(QChar c);
+};
+
+#endif // CTEMPLATER_H
@@ -0,0 +1,843 @@
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <QElapsedTimer>
+#include <QScopeGuard>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <algorithm>
+#include "translator.h"
+#include "segmenter.h"
+#include "markup.h"
+#include "qsl.h"
+
+CTranslator::CTranslator(CAtlas *atlas, CStatistics *stats, QObject *parent)
+    : QObject(parent),
+      m_atlas(atlas),
+      m_stats(stats)
+{
+    m_stats->addRatio(QSL("tm.hitRate"),QSL("tm.hits"),QSL("tm.segments"));
+    m_stats->addRatio(QSL("template.verifyAccuracy"),QSL("template.verifyMatches"),QSL("template.verified"));
+    m_stats->addRatio(QSL("canon.changedHitRate"),QSL("canon.changedFullHits"),QSL("canon.changedRequests"));
+
+    // Editors usually rewrite files in several steps, reload after they finish.
+    const int glossaryReloadDelay = 500;
+    m_glossaryReloadTimer.setSingleShot(true);
+    m_glossaryReloadTimer.setInterval(glossaryReloadDelay);
+    connect(&m_glossaryReloadTimer,&QTimer::timeout,this,&CTranslator::reloadGlossary);
+    connect(&m_glossaryWatcher,&QFileSystemWatcher::fileChanged,
+            &m_glossaryReloadTimer,qOverload<>(&QTimer::start));
+    connect(&m_glossaryWatcher,&QFileSystemWatcher::directoryChanged,
+            &m_glossaryReloadTimer,qOverload<>(&QTimer::start));
+}
+
+CTranslator::~CTranslator() = default;
+
+void CTranslator::loadSettings()
+{
+    m_templater.loadSettings();
+    m_canonicalizer.loadSettings();
+
+    QSettings settings;
+    settings.beginGroup(QSL("Glossary"));
+    m_glossaryDir = settings.value(QSL("directory"),
+                                   QDir(QCoreApplication::applicationDirPath()).filePath(QSL("glossary"))).toString();
+    settings.endGroup();
+
+    reloadGlossary();
+}
+
+QString CTranslator::glossaryFileName() const
+{
+    QString env = QSL("General");
+    if (m_atlas)
+        env = m_atlas->environment();
+
+    return QDir(m_glossaryDir).filePath(QSL("%1.txt").arg(env));
+}
+
+void CTranslator::reloadGlossary()
+{
+    const QString fileName = glossaryFileName();
+
+    if (!m_glossaryWatcher.files().isEmpty())
+        m_glossaryWatcher.removePaths(m_glossaryWatcher.files());
+    if (!m_glossaryWatcher.directories().isEmpty())
+        m_glossaryWatcher.removePaths(m_glossaryWatcher.directories());
+    if (QFileInfo::exists(m_glossaryDir))
+        m_glossaryWatcher.addPath(m_glossaryDir);
+
+    QSharedPointer<CGlossary> glossary(new CGlossary());
+    if (QFileInfo::exists(fileName)) {
+        m_glossaryWatcher.addPath(fileName);
+
+        QElapsedTimer timer;
+        timer.start();
+        if (!glossary->load(fileName))
+            qWarning() << "Unable to load glossary" << fileName;
+        qInfo() << "Glossary loaded:" << glossary->count() << "entries in" << timer.elapsed() << "ms";
+    }
+
+    m_stats->set(QSL("glossary.entries"),glossary->count());
+    m_stats->add(QSL("glossary.reloads"));
+
+    QMutexLocker locker(&m_glossaryMutex);
+    m_glossary = glossary;
+}
+
+QSharedPointer<const CGlossary> CTranslator::glossary()
+{
+    QMutexLocker locker(&m_glossaryMutex);
+    return m_glossary;
+}
+
+void CTranslator::setCacheSize(int maxBytes)
+{
+    m_cache.setMaxBytes(maxBytes);
+}
+
+void CTranslator::setCachePolicy(CResultCache::Policy policy)
+{
+    m_cache.setPolicy(policy);
+}
+
+void CTranslator::setCacheCompression(bool enabled)
+{
+    m_cache.setCompression(enabled);
+}
+
+bool CTranslator::setCacheTrace(const QString &fileName)
+{
+    QMutexLocker locker(&m_traceMutex);
+    m_traceFile.close();
+    if (fileName.isEmpty()) return true;
+
+    m_traceFile.setFileName(fileName);
+    if (!m_traceFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Unable to open cache trace file" << fileName;
+        return false;
+    }
+    return true;
+}
+
+void CTranslator::traceCache(char operation, const QString &key, int valueSize)
+{
+    QMutexLocker locker(&m_traceMutex);
+    if (!m_traceFile.isOpen()) return;
+
+    QByteArray line(1,operation);
+    line.append(' ');
+    line.append(key.toUtf8().toPercentEncoding());
+    if (operation == 'S') {
+        line.append(' ');
+        line.append(QByteArray::number(valueSize));
+    }
+    line.append('\n');
+    m_traceFile.write(line);
+}
+
+void CTranslator::setPersistentCache(CPersistentCache *cache)
+{
+    m_persistentCache = cache;
+}
+
+void CTranslator::setBundles(CBundleSet *bundles)
+{
+    m_bundles = bundles;
+}
+
+void CTranslator::setSharedCache(CSharedCache *cache)
+{
+    m_sharedCache = cache;
+}
+
+bool CTranslator::lookupBundle(CAtlas::AtlasDirection direction, const QString &text, QString &value)
+{
+    if (m_bundles.isNull() || m_bundles->isEmpty()) return false;
+
+    if (!m_bundles->lookup(direction,text,value)) return false;
+
+    m_stats->add(QSL("bundle.hits"));
+    return true;
+}
+
+bool CTranslator::lookupCache(const QString &key, QString &value)
+{
+    traceCache('L',key);
+    if (m_cache.lookup(key,value))
+        return true;
+
+    if (m_sharedCache && m_sharedCache->lookup(key,value)) {
+        traceCache('S',key,value.size());
+        m_cache.insert(key,value);
+        return true;
+    }
+
+    if (m_persistentCache && m_persistentCache->lookup(key,value)) {
+        traceCache('S',key,value.size());
+        m_cache.insert(key,value);
+        if (m_sharedCache)
+            m_sharedCache->insert(key,value);
+        m_stats->add(QSL("persistent.hits"));
+        return true;
+    }
+
+    return false;
+}
+
+void CTranslator::storeResult(const QString &key, const QString &value)
+{
+    traceCache('S',key,value.size());
+    m_cache.insert(key,value);
+    if (m_sharedCache)
+        m_sharedCache->insert(key,value);
+    if (m_persistentCache && !m_persistentCache->insert(key,value))
+        m_stats->add(QSL("persistent.dropped"));
+    Q_EMIT resultStored(key,value);
+}
+
+bool CTranslator::applyReplicated(const QString &key, const QString &value)
+{
+    // Primary may run other ATLAS version or environment.
+    CAtlas::AtlasDirection direction = CAtlas::Atlas_Auto;
+    QString text;
+    if (value.isEmpty() || !parseKey(key,direction,text)) return false;
+
+    checkEngineStamp(m_atlas->environment(),m_atlas->getVersion());
+    m_cache.insert(key,value);
+    if (m_sharedCache)
+        m_sharedCache->insert(key,value);
+    if (m_persistentCache && !m_persistentCache->insert(key,value))
+        m_stats->add(QSL("persistent.dropped"));
+    return true;
+}
+
+QString CTranslator::contentHash(const QString &text)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(text.toUtf8(),QCryptographicHash::Sha256).toHex());
+}
+
+QString CTranslator::rememberContent(const QString &text)
+{
+    const QString hash = contentHash(text);
+    m_contents.insert(hash,text);
+    return hash;
+}
+
+bool CTranslator::lookupContent(const QString &hash, QString &text)
+{
+    if (m_contents.lookup(hash.toLower(),text)) {
+        m_stats->add(QSL("content.hits"));
+        return true;
+    }
+
+    m_stats->add(QSL("content.misses"));
+    return false;
+}
+
+void CTranslator::setContentStoreSize(int maxBytes)
+{
+    m_contents.setMaxBytes(maxBytes);
+}
+
+void CTranslator::configureFailureCache(int ttlSecs, int quarantineCount, int quarantineLatencyMs)
+{
+    m_failures.configure(ttlSecs,quarantineCount,quarantineLatencyMs);
+}
+
+QStringList CTranslator::quarantine() const
+{
+    return m_failures.quarantine();
+}
+
+bool CTranslator::releaseQuarantine(const QString &hash)
+{
+    if (hash == QSL("*")) {
+        m_failures.clear();
+        return true;
+    }
+    return m_failures.release(hash);
+}
+
+void CTranslator::clearCache()
+{
+    m_cache.clear();
+}
+
+void CTranslator::updateStatistics()
+{
+    m_stats->set(QSL("cache.hits"),m_cache.hits());
+    m_stats->set(QSL("cache.misses"),m_cache.misses());
+    m_stats->set(QSL("cache.evictions"),m_cache.evictions());
+    m_stats->set(QSL("cache.rejections"),m_cache.rejections());
+    m_stats->set(QSL("cache.compressed"),m_cache.compressed());
+    m_stats->set(QSL("cache.bytes"),m_cache.bytes());
+    m_stats->set(QSL("cache.entries"),m_cache.count());
+    m_stats->set(QSL("content.entries"),m_contents.count());
+    m_stats->set(QSL("quarantine.entries"),m_failures.quarantined());
+    if (m_sharedCache) {
+        m_stats->set(QSL("shared.hits"),m_sharedCache->hits());
+        m_stats->set(QSL("shared.foreignHits"),m_sharedCache->foreignHits());
+        m_stats->set(QSL("shared.misses"),m_sharedCache->misses());
+        m_stats->set(QSL("shared.skipped"),m_sharedCache->skipped());
+        m_stats->set(QSL("shared.lockSteals"),m_sharedCache->lockSteals());
+        m_stats->set(QSL("shared.lockTimeouts"),m_sharedCache->lockTimeouts());
+        m_stats->set(QSL("shared.inserts"),m_sharedCache->inserts());
+    }
+    if (m_persistentCache) {
+        m_stats->set(QSL("persistent.bytes"),m_persistentCache->usedBytes());
+        m_stats->set(QSL("persistent.entries"),m_persistentCache->count());
+    }
+}
+
+QVector<CResultCache::CHotEntry> CTranslator::hotEntries(int limit) const
+{
+    return m_cache.hotEntries(limit);
+}
+
+int CTranslator::activeRequests() const
+{
+    return m_activeRequests;
+}
+
+bool CTranslator::parseKey(const QString &key, CAtlas::AtlasDirection &direction, QString &text) const
+{
+    // Key format is made by CResultCache::makeKey: direction|version|environment|text
+    if (m_atlas.isNull() || !m_atlas->isLoaded()) return false;
+
+    const QStringList fields = key.split(QChar('|'));
+    if (fields.count() < 4) return false;
+
+    bool ok = false;
+    const int dir = fields.at(0).toInt(&ok);
+    if (!ok || (dir != CAtlas::Atlas_JE && dir != CAtlas::Atlas_EJ)) return false;
+    if (fields.at(1).toInt() != m_atlas->getVersion() || fields.at(2) != m_atlas->environment())
+        return false;
+
+    direction = static_cast<CAtlas::AtlasDirection>(dir);
+    text = key.mid(fields.at(0).length() + fields.at(1).length() + fields.at(2).length() + 3);
+    return !text.isEmpty();
+}
+
+bool CTranslator::warmEntry(const QString &key, const QString &value)
+{
+    CAtlas::AtlasDirection direction = CAtlas::Atlas_Auto;
+    QString text;
+    if (!parseKey(key,direction,text)) return false;
+
+    checkEngineStamp(m_atlas->environment(),m_atlas->getVersion());
+    m_cache.insert(key,value);
+    return true;
+}
+
+bool CTranslator::warmKey(const QString &key)
+{
+    CAtlas::AtlasDirection direction = CAtlas::Atlas_Auto;
+    QString text;
+    if (!parseKey(key,direction,text)) return false;
+
+    checkEngineStamp(m_atlas->environment(),m_atlas->getVersion());
+    QString value;
+    if (lookupCache(key,value)) return true;
+    if (m_failures.isBlocked(key)) return false;
+
+    value = m_atlas->translateBatch(direction,{ text }).value(0);
+    m_stats->add(QSL("engine.calls"));
+    m_stats->add(QSL("engine.chars"),text.length());
+    if (value.isEmpty() || value.startsWith(QSL("ERR"))) return false;
+
+    storeResult(key,value);
+    return true;
+}
+
+void CTranslator::checkEngineStamp(const QString &environment, int version)
+{
+    // Results of other ATLAS version or environment are useless, drop them.
+    const QString stamp = QSL("%1|%2").arg(version).arg(environment);
+
+    QMutexLocker locker(&m_engineStampMutex);
+    if (stamp == m_engineStamp) return;
+
+    if (!m_engineStamp.isEmpty()) {
+        qInfo() << "ATLAS engine changed, cache invalidated";
+        m_cache.clear();
+        m_stats->add(QSL("cache.invalidations"));
+    }
+    m_engineStamp = stamp;
+}
+
+CAtlas::AtlasDirection CTranslator::resolveDirection(CAtlas::AtlasDirection direction, const QString &str) const
+{
+    if (direction != CAtlas::Atlas_Auto)
+        return direction;
+
+    if (m_atlas->haveJapanese(str))
+        return CAtlas::Atlas_JE;
+
+    return CAtlas::Atlas_EJ;
+}
+
+void CTranslator::addPending(CPendingMap &pending, QHash<QString,int> &pendingIndex,
+                             CAtlas::AtlasDirection direction, const QString &key,
+                             const QString &text, int position) const
+{
+    QVector<CPendingSegment> &list = pending[direction];
+    const auto it = pendingIndex.constFind(key);
+    if (it != pendingIndex.constEnd()) {
+        list[it.value()].positions.append(position);
+    } else {
+        pendingIndex.insert(key,list.count());
+        list.append({ key, text, { position } });
+    }
+}
+
+bool CTranslator::translatePending(const CPendingMap &pending, QVector<QString> &results,
+                                   const CancelCheck &canceled)
+{
+    // Recently failed or quarantined inputs are refused without engine call.
+    for (const auto &list : pending) {
+        for (const auto &item : list) {
+            if (m_failures.isBlocked(item.key)) {
+                m_stats->add(QSL("failure.blocked"));
+                return false;
+            }
+        }
+    }
+
+    CPendingMap retry;
+    for (auto it = pending.constBegin(), end = pending.constEnd(); it != end; ++it) {
+        const auto direction = static_cast<CAtlas::AtlasDirection>(it.key());
+
+        // Segments already being translated by other requests are joined, others are led by us.
+        QVector<CPendingSegment> leading;
+        QVector<CFlightPtr> leadingFlights;
+        QVector<QPair<const CPendingSegment *,CFlightPtr> > joined;
+        {
+            QMutexLocker locker(&m_flightMutex);
+            for (const auto &item : it.value()) {
+                const CFlightPtr flight = m_flights.value(item.key);
+                if (flight) {
+                    flight->waiters++;
+                    joined.append(qMakePair(&item,flight));
+                } else {
+                    leadingFlights.append(CFlightPtr::create());
+                    m_flights.insert(item.key,leadingFlights.last());
+                    leading.append(item);
+                }
+            }
+        }
+        if (!joined.isEmpty())
+            m_stats->add(QSL("engine.coalesced"),joined.count());
+
+        if (!leading.isEmpty()) {
+            // Abandoned request skips engine call, unless somebody waits for its results.
+            bool abandon = false;
+            if (canceled && canceled()) {
+                QMutexLocker locker(&m_flightMutex);
+                abandon = std::none_of(leadingFlights.constBegin(),leadingFlights.constEnd(),
+                                       [](const CFlightPtr &flight){ return flight->waiters > 0; });
+            }
+
+            QStringList translated;
+            if (abandon) {
+                m_stats->add(QSL("engine.abandoned"));
+            } else {
+                translated = translateSegments(direction,leading);
+            }
+
+            bool failed = (translated.count() != leading.count());
+            for (int i = 0; i < translated.count(); i++) {
+                if (translated.at(i).isNull()) {
+                    failed = true;
+                    continue;
+                }
+                const CPendingSegment &item = leading.at(i);
+                storeResult(item.key,translated.at(i));
+                for (const int pos : item.positions)
+                    results[pos] = translated.at(i);
+            }
+            finishFlights(leading,leadingFlights,translated);
+
+            if (failed) {
+                // Joined flights must be released before bailing out.
+                QMutexLocker locker(&m_flightMutex);
+                for (const auto &join : qAsConst(joined))
+                    join.second->waiters--;
+                return false;
+            }
+        }
+
+        // Leader that failed or gave up hands segment back, it is retried by us.
+        QMutexLocker locker(&m_flightMutex);
+        for (const auto &join : qAsConst(joined)) {
+            const CFlightPtr &flight = join.second;
+            while (!flight->finished)
+                m_flightFinished.wait(&m_flightMutex);
+            flight->waiters--;
+
+            if (flight->failed) {
+                retry[direction].append(*join.first);
+            } else {
+                for (const int pos : join.first->positions)
+                    results[pos] = flight->value;
+            }
+        }
+    }
+
+    if (retry.isEmpty()) return true;
+    return translatePending(retry,results,canceled);
+}
+
+QStringList CTranslator::translateSegments(CAtlas::AtlasDirection direction, const QVector<CPendingSegment> &items)
+{
+    QStringList texts;
+    texts.reserve(items.count());
+    qint64 chars = 0;
+    for (const auto &item : items) {
+        texts.append(item.text);
+        chars += item.text.length();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QStringList res = m_atlas->translateBatch(direction,texts);
+    m_stats->add(QSL("engine.calls"));
+    m_stats->add(QSL("engine.chars"),chars);
+    if (res.count() == texts.count()) {
+        // Slow batches are attributed only when there is one segment to blame.
+        if (items.count() == 1)
+            m_failures.recordLatency(items.first().key,items.first().text,timer.elapsed());
+        return res;
+    }
+
+    m_stats->add(QSL("engine.failures"));
+    if (items.count() == 1) {
+        m_failures.recordFailure(items.first().key,items.first().text);
+        return { QString() };
+    }
+
+    // Find failing segments one by one, so others are not refused with them.
+    res.clear();
+    for (const auto &item : items) {
+        timer.start();
+        const QStringList one = m_atlas->translateBatch(direction,{ item.text });
+        m_stats->add(QSL("engine.calls"));
+        m_stats->add(QSL("engine.chars"),item.text.length());
+        if (one.count() == 1) {
+            m_failures.recordLatency(item.key,item.text,timer.elapsed());
+            res.append(one.first().isNull() ? QSL("") : one.first());
+        } else {
+            m_stats->add(QSL("engine.failures"));
+            m_failures.recordFailure(item.key,item.text);
+            res.append(QString());
+        }
+    }
+    return res;
+}
+
+void CTranslator::finishFlights(const QVector<CPendingSegment> &segments, const QVector<CFlightPtr> &flights,
+                                const QStringList &values)
+{
+    QMutexLocker locker(&m_flightMutex);
+    for (int i = 0; i < flights.count(); i++) {
+        const CFlightPtr &flight = flights.at(i);
+        flight->finished = true;
+        flight->failed = values.value(i).isNull();
+        if (!flight->failed)
+            flight->value = values.at(i);
+        m_flights.remove(segments.at(i).key);
+    }
+    m_flightFinished.wakeAll();
+}
+
+bool CTranslator::needVerification()
+{
+    const int interval = m_templater.verifyInterval();
+    if (interval <= 0) return false;
+
+    return ((m_verifyCounter.fetch_add(1) % interval) == 0);
+}
+
+QString CTranslator::translate(CAtlas::AtlasDirection direction, const QString &str, TranslateFlags flags,
+                               const CancelCheck &canceled)
+{
+    const QString error = QSL("ERR");
+    if (m_atlas.isNull() || !m_atlas->isLoaded()) return error;
+
+    m_activeRequests++;
+    auto activeGuard = qScopeGuard([this]{ m_activeRequests--; });
+
+    QString input = str;
+    const CCanonicalizer::Rules canonRules = m_canonicalizer.canonicalize(input);
+    m_stats->add(QSL("canon.requests"));
+    if (canonRules) {
+        m_stats->add(QSL("canon.changedRequests"));
+        if (canonRules.testFlag(CCanonicalizer::Rule_Width))
+            m_stats->add(QSL("canon.width"));
+        if (canonRules.testFlag(CCanonicalizer::Rule_Whitespace))
+            m_stats->add(QSL("canon.whitespace"));
+        if (canonRules.testFlag(CCanonicalizer::Rule_Ellipsis))
+            m_stats->add(QSL("canon.ellipsis"));
+    }
+
+    // Known script lines are answered from compiled bundles as a whole.
+    QString bundled;
+    if (lookupBundle(resolveDirection(direction,input),input.trimmed(),bundled))
+        return bundled;
+
+    const QVector<CTextSegment> segments = CSegmenter::split(input);
+    const QString environment = m_atlas->environment();
+    const int version = m_atlas->getVersion();
+    checkEngineStamp(environment,version);
+    const bool useCache = !flags.testFlag(Flag_NoCache);
+
+    QVector<QString> results(segments.count());
+    QVector<CAtlas::AtlasDirection> directions(segments.count(),CAtlas::Atlas_Auto);
+    QVector<CTemplate> templates(segments.count());
+    QVector<QString> texts(segments.count());
+    QVector<QPair<QChar,QChar> > wrappers(segments.count());
+    bool wrapped = false;
+    CPendingMap pending;
+    QHash<QString,int> pendingIndex;
+    qint64 hits = 0;
+    qint64 misses = 0;
+    qint64 charsSaved = 0;
+
+    const QSharedPointer<const CGlossary> glossary = this->glossary();
+    QElapsedTimer glossaryTimer;
+    qint64 glossaryNsecs = 0;
+    qint64 glossaryMatches = 0;
+
+    for (int i = 0; i < segments.count(); i++) {
+        const CTextSegment &segment = segments.at(i);
+        if (!segment.translatable) {
+            results[i] = segment.text;
+            continue;
+        }
+
+        const CAtlas::AtlasDirection dir = resolveDirection(direction,segment.text);
+        directions[i] = dir;
+
+        QString text = segment.text;
+        if (m_canonicalizer.stripWrapper(text,wrappers[i].first,wrappers[i].second)) {
+            m_stats->add(QSL("canon.brackets"));
+            wrapped = true;
+        }
+        texts[i] = text;
+
+        if (lookupBundle(dir,text,results[i])) {
+            hits++;
+            charsSaved += text.length();
+            continue;
+        }
+
+        QVector<CGlossaryMatch> matches;
+        if (glossary && glossary->count() > 0) {
+            glossaryTimer.start();
+            matches = glossary->match(text);
+            glossaryNsecs += glossaryTimer.nsecsElapsed();
+            glossaryMatches += matches.count();
+        }
+
+        if (dir == CAtlas::Atlas_JE) {
+            if (m_templater.isEnabled() || !matches.isEmpty()) {
+                glossaryTimer.start();
+                templates[i] = m_templater.make(text,matches,glossary.data(),m_templater.isEnabled());
+                glossaryNsecs += glossaryTimer.nsecsElapsed();
+                if (!templates.at(i).isEmpty()) {
+                    text = templates.at(i).text;
+                    m_stats->add(QSL("template.segments"));
+                }
+            }
+        } else if (!matches.isEmpty()) {
+            // Target language is Japanese, substitute terms in place.
+            for (int m = matches.count() - 1; m >= 0; m--) {
+                const CGlossaryMatch &match = matches.at(m);
+                const QString replacement = glossary->replacement(match.entry);
+                if (!replacement.isEmpty())
+                    text.replace(match.start,match.length,replacement);
+            }
+        }
+
+        const QString key = CResultCache::makeKey(dir,environment,version,text);
+        if (useCache && lookupCache(key,results[i])) {
+            hits++;
+            charsSaved += texts.at(i).length();
+            continue;
+        }
+
+        misses++;
+        addPending(pending,pendingIndex,dir,key,text,i);
+    }
+
+    m_stats->add(QSL("tm.segments"),hits + misses);
+    m_stats->add(QSL("tm.hits"),hits);
+    m_stats->add(QSL("tm.misses"),misses);
+    m_stats->add(QSL("tm.charsSaved"),charsSaved);
+    if (misses == 0 && (canonRules || wrapped))
+        m_stats->add(QSL("canon.changedFullHits"));
+    if (glossary && glossary->count() > 0) {
+        m_stats->add(QSL("glossary.nsecs"),glossaryNsecs);
+        m_stats->add(QSL("glossary.matches"),glossaryMatches);
+    }
+
+    if (!translatePending(pending,results,canceled))
+        return error;
+
+    // Substitute template values back, segments with lost placeholders are translated directly.
+    // Sampled segments are translated directly too, to verify the template result.
+    pending.clear();
+    pendingIndex.clear();
+    CPendingMap verify;
+    QHash<QString,int> verifyIndex;
+    QVector<int> verified;
+    for (int i = 0; i < segments.count(); i++) {
+        const CTemplate &tpl = templates.at(i);
+        if (tpl.isEmpty()) continue;
+
+        const CAtlas::AtlasDirection dir = directions.at(i);
+        const QString &text = texts.at(i);
+        const QString translated = results.at(i);
+        if (CTemplater::restore(tpl,translated,results[i])) {
+            if (tpl.glossaryMatches > 0 || !needVerification()) continue;
+
+            addPending(verify,verifyIndex,dir,CResultCache::makeKey(dir,environment,version,text),
+                       text,verified.count());
+            verified.append(i);
+            continue;
+        }
+
+        m_stats->add(QSL("template.fallbacks"));
+        const QString key = CResultCache::makeKey(dir,environment,version,text);
+        if (!useCache || !lookupCache(key,results[i]))
+            addPending(pending,pendingIndex,dir,key,text,i);
+    }
+
+    if (!translatePending(pending,results,canceled))
+        return error;
+
+    // Verification goes through failure cache and coalescing, refused one keeps template result.
+    if (!verified.isEmpty()) {
+        QVector<QString> direct(verified.count());
+        m_stats->add(QSL("template.verified"),verified.count());
+        if (translatePending(verify,direct,canceled)) {
+            for (int v = 0; v < verified.count(); v++) {
+                const int i = verified.at(v);
+                if (direct.at(v).isEmpty()) continue;
+
+                if (direct.at(v) == results.at(i)) {
+                    m_stats->add(QSL("template.verifyMatches"));
+                } else {
+                    m_stats->add(QSL("template.verifyMismatches"));
+                    results[i] = direct.at(v);
+                }
+            }
+        }
+    }
+
+    if (wrapped) {
+        for (int i = 0; i < segments.count(); i++) {
+            const QPair<QChar,QChar> &wrapper = wrappers.at(i);
+            if (!wrapper.first.isNull())
+                results[i] = QSL("%1%2%3").arg(wrapper.first,results.at(i),wrapper.second);
+        }
+    }
+
+    // Japanese sentences are not separated by spaces, English ones need it.
+    QString res;
+    bool prevTranslated = false;
+    for (int i = 0; i < segments.count(); i++) {
+        if (segments.at(i).translatable) {
+            if (prevTranslated && directions.at(i) == CAtlas::Atlas_JE)
+                res.append(QChar(' '));
+            prevTranslated = true;
+        } else {
+            prevTranslated = false;
+        }
+        res.append(results.at(i));
+    }
+
+    return res;
+}
+
+QString CTranslator::translateMarkup(CAtlas::AtlasDirection direction, const QString &html,
+                                     const CancelCheck &canceled)
+{
+    const QString error = QSL("ERR");
+    if (m_atlas.isNull() || !m_atlas->isLoaded()) return error;
+
+    QVector<CMarkupToken> tokens = CMarkup::parse(html);
+
+    // Unique text nodes without surrounding whitespace.
+    QStringList nodes;
+    QHash<QString,int> nodeIndex;
+    QVector<int> tokenNodes(tokens.count(),-1);
+    int textNodes = 0;
+    for (int i = 0; i < tokens.count(); i++) {
+        if (!tokens.at(i).isText) continue;
+
+        QString text = tokens.at(i).text.simplified();
+        if (!std::any_of(text.constBegin(),text.constEnd(),[](QChar c){ return c.isLetterOrNumber(); }))
+            continue;
+
+        textNodes++;
+        auto it = nodeIndex.constFind(text);
+        if (it == nodeIndex.constEnd()) {
+            it = nodeIndex.insert(text,nodes.count());
+            nodes.append(text);
+        }
+        tokenNodes[i] = it.value();
+    }
+
+    m_stats->add(QSL("markup.requests"));
+    m_stats->add(QSL("markup.textNodes"),textNodes);
+    m_stats->add(QSL("markup.uniqueNodes"),nodes.count());
+
+    // All nodes go as lines of one text, so the segment memory batches misses in one engine call.
+    QStringList translated;
+    if (!nodes.isEmpty()) {
+        const QString res = translate(direction,nodes.join(QChar('\n')),Flag_None,canceled);
+        if (res.startsWith(error)) return error;
+        translated = res.split(QChar('\n'));
+    }
+    if (translated.count() != nodes.count()) {
+        translated.clear();
+        for (const auto &node : qAsConst(nodes)) {
+            const QString res = translate(direction,node);
+            if (res.startsWith(error)) return error;
+            translated.append(res);
+        }
+    }
+
+    QString res;
+    res.reserve(html.length());
+    for (int i = 0; i < tokens.count(); i++) {
+        const CMarkupToken &token = tokens.at(i);
+        if (!token.isText) {
+            res.append(token.text);
+            continue;
+        }
+
+        const int node = tokenNodes.at(i);
+        if (node < 0) {
+            res.append(CMarkup::escape(token.text));
+            continue;
+        }
+
+        // Keep surrounding whitespace of original node.
+        const QString &text = token.text;
+        int start = 0;
+        while (start < text.length() && text.at(start).isSpace())
+            start++;
+        int end = text.length();
+        while (end > start && text.at(end - 1).isSpace())
+            end--;
+
+        res.append(CMarkup::escape(text.left(start)));
+        res.append(CMarkup::escape(translated.at(node).trimmed()));
+        res.append(CMarkup::escape(text.mid(end)));
+    }
+
+    return res;
+}
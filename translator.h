@@ -0,0 +1,163 @@
+#ifndef CTRANSLATOR_H
+#define CTRANSLATOR_H
+
+#include <QObject>
+#include <QPointer>
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QTimer>
+#include <QSharedPointer>
+#include <QFileSystemWatcher>
+#include <QFile>
+#include <atomic>
+#include <functional>
+#include "atlas.h"
+#include "stats.h"
+#include "glossary.h"
+#include "templater.h"
+#include "canonicalizer.h"
+#include "resultcache.h"
+#include "persistentcache.h"
+#include "bundle.h"
+#include "sharedcache.h"
+#include "failurecache.h"
+
+namespace CDefaults {
+const int contentStoreMaxBytes = 8 * 1024 * 1024;
+}
+
+class CTranslator : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CTranslator)
+public:
+    enum TranslateFlag {
+        Flag_None = 0,
+        Flag_NoCache = 1 // skip cache lookups, fresh results are still stored
+    };
+    Q_DECLARE_FLAGS(TranslateFlags, TranslateFlag)
+    // Returns true when caller is no longer interested in result.
+    using CancelCheck = std::function<bool()>;
+
+    CTranslator(CAtlas *atlas, CStatistics *stats, QObject *parent = nullptr);
+    ~CTranslator() override;
+
+    // Thread-safe. Returns string starting with "ERR" on failure.
+    // Identical segments translated concurrently share one engine call.
+    QString translate(CAtlas::AtlasDirection direction, const QString &str,
+                      TranslateFlags flags = Flag_None, const CancelCheck &canceled = CancelCheck());
+    CAtlas::AtlasDirection resolveDirection(CAtlas::AtlasDirection direction, const QString &str) const;
+    // Translates text nodes of HTML fragment, tags are kept in place. Thread-safe.
+    QString translateMarkup(CAtlas::AtlasDirection direction, const QString &html,
+                            const CancelCheck &canceled = CancelCheck());
+
+    void loadSettings();
+    void setCacheSize(int maxBytes);
+    void setCachePolicy(CResultCache::Policy policy);
+    void setCacheCompression(bool enabled);
+    // Records cache lookups and stores for replay by -replay tool.
+    bool setCacheTrace(const QString &fileName);
+    void setPersistentCache(CPersistentCache *cache);
+    void setBundles(CBundleSet *bundles);
+    void setSharedCache(CSharedCache *cache);
+    void clearCache();
+    // Publishes cache counters to statistics.
+    void updateStatistics();
+
+    // Cache warm-up support
+    QVector<CResultCache::CHotEntry> hotEntries(int limit) const;
+    // Preloads snapshot entry to memory cache, if it was made by current engine.
+    bool warmEntry(const QString &key, const QString &value);
+    // Loads key from lower cache tiers or translates it.
+    bool warmKey(const QString &key);
+    int activeRequests() const;
+
+    // Stores result received from replication primary.
+    bool applyReplicated(const QString &key, const QString &value);
+
+    // Content-addressed requests: clients refer to known input text by hash.
+    static QString contentHash(const QString &text);
+    // Remembers input text, returns its hash.
+    QString rememberContent(const QString &text);
+    bool lookupContent(const QString &hash, QString &text);
+    void setContentStoreSize(int maxBytes);
+
+    // Failing and pathologically slow inputs.
+    void configureFailureCache(int ttlSecs, int quarantineCount, int quarantineLatencyMs);
+    QStringList quarantine() const;
+    // Hash from quarantine() list, or "*" for all entries.
+    bool releaseQuarantine(const QString &hash);
+
+public Q_SLOTS:
+    void reloadGlossary();
+
+Q_SIGNALS:
+    // Emitted from translating thread for every new engine result.
+    void resultStored(const QString &key, const QString &value);
+
+private:
+    struct CPendingSegment {
+        QString key;
+        QString text;
+        QVector<int> positions;
+    };
+    using CPendingMap = QHash<int,QVector<CPendingSegment> >; // by direction
+
+    // Engine call in progress for one cache key, other requests wait for it.
+    struct CFlight {
+        QString value;
+        bool finished { false };
+        bool failed { false };
+        int waiters { 0 };
+    };
+    using CFlightPtr = QSharedPointer<CFlight>;
+
+    QPointer<CAtlas> m_atlas;
+    QPointer<CStatistics> m_stats;
+    CResultCache m_cache;
+    CResultCache m_contents { CDefaults::contentStoreMaxBytes, CResultCache::Policy_LRU };
+    CFailureCache m_failures;
+    CTemplater m_templater;
+    CCanonicalizer m_canonicalizer;
+    std::atomic<int> m_verifyCounter { 0 };
+    std::atomic<int> m_activeRequests { 0 };
+    QMutex m_engineStampMutex;
+    QString m_engineStamp;
+    QPointer<CPersistentCache> m_persistentCache;
+    QPointer<CBundleSet> m_bundles;
+    QPointer<CSharedCache> m_sharedCache;
+    QMutex m_traceMutex;
+    QFile m_traceFile;
+    QMutex m_flightMutex;
+    QWaitCondition m_flightFinished;
+    QHash<QString,CFlightPtr> m_flights;
+
+    QString m_glossaryDir;
+    QMutex m_glossaryMutex;
+    QSharedPointer<const CGlossary> m_glossary;
+    QFileSystemWatcher m_glossaryWatcher;
+    QTimer m_glossaryReloadTimer;
+
+    void addPending(CPendingMap &pending, QHash<QString,int> &pendingIndex, CAtlas::AtlasDirection direction,
+                    const QString &key, const QString &text, int position) const;
+    bool translatePending(const CPendingMap &pending, QVector<QString> &results, const CancelCheck &canceled);
+    // Returns one entry per segment, null string for failed ones.
+    QStringList translateSegments(CAtlas::AtlasDirection direction, const QVector<CPendingSegment> &items);
+    void finishFlights(const QVector<CPendingSegment> &segments, const QVector<CFlightPtr> &flights,
+                       const QStringList &values);
+    bool needVerification();
+    bool lookupBundle(CAtlas::AtlasDirection direction, const QString &text, QString &value);
+    bool lookupCache(const QString &key, QString &value);
+    void storeResult(const QString &key, const QString &value);
+    void traceCache(char operation, const QString &key, int valueSize = 0);
+    void checkEngineStamp(const QString &environment, int version);
+    bool parseKey(const QString &key, CAtlas::AtlasDirection &direction, QString &text) const;
+    QSharedPointer<const CGlossary> glossary();
+    QString glossaryFileName() const;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(CTranslator::TranslateFlags)
+
+#endif // CTRANSLATOR_H
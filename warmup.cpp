@@ -0,0 +1,173 @@
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QThread>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QScopeGuard>
+#include <QtConcurrent>
+#include <QDebug>
+#include <algorithm>
+#include "warmup.h"
+#include "qsl.h"
+
+CWarmup::CWarmup(CTranslator *translator, CStatistics *stats, QObject *parent)
+    : QObject(parent),
+      m_translator(translator),
+      m_stats(stats)
+{
+}
+
+CWarmup::~CWarmup()
+{
+    cancel();
+}
+
+void CWarmup::start(const QString &snapshotFile, const QString &accessLog, int maxEntries)
+{
+    if (isRunning()) return;
+
+    m_canceled = false;
+    m_future = QtConcurrent::run([this,snapshotFile,accessLog,maxEntries]{
+        run(snapshotFile,accessLog,maxEntries);
+    });
+}
+
+void CWarmup::cancel()
+{
+    m_canceled = true;
+    m_future.waitForFinished();
+}
+
+bool CWarmup::isRunning() const
+{
+    return m_future.isRunning();
+}
+
+bool CWarmup::saveSnapshot(const QString &fileName, int maxEntries)
+{
+    if (m_translator.isNull() || fileName.isEmpty()) return false;
+
+    const QVector<CResultCache::CHotEntry> entries = m_translator->hotEntries(maxEntries);
+    if (entries.isEmpty()) return false;
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write cache snapshot" << fileName;
+        return false;
+    }
+
+    for (const auto &entry : entries) {
+        QByteArray line = QByteArray::number(entry.frequency);
+        line.append('\t');
+        line.append(entry.key.toUtf8().toPercentEncoding());
+        line.append('\t');
+        line.append(entry.value.toUtf8().toPercentEncoding());
+        line.append('\n');
+        file.write(line);
+    }
+
+    if (!file.commit()) {
+        qWarning() << "Unable to write cache snapshot" << fileName;
+        return false;
+    }
+
+    qInfo() << "Cache snapshot saved:" << entries.count() << "entries";
+    return true;
+}
+
+QVector<QPair<QString,QString> > CWarmup::readSnapshot(const QString &fileName)
+{
+    QVector<QPair<QString,QString> > res;
+    QFile file(fileName);
+    if (fileName.isEmpty() || !file.open(QIODevice::ReadOnly)) return res;
+
+    while (!file.atEnd()) {
+        const QList<QByteArray> fields = file.readLine().trimmed().split('\t');
+        if (fields.count() < 3) continue;
+
+        res.append(qMakePair(QString::fromUtf8(QByteArray::fromPercentEncoding(fields.at(1))),
+                             QString::fromUtf8(QByteArray::fromPercentEncoding(fields.at(2)))));
+    }
+    return res;
+}
+
+QStringList CWarmup::readAccessLog(const QString &fileName, int maxEntries)
+{
+    QStringList res;
+    QFile file(fileName);
+    if (fileName.isEmpty() || !file.open(QIODevice::ReadOnly)) return res;
+
+    // Cache trace format: "L <key>" for lookups.
+    QHash<QByteArray,int> counts;
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine().trimmed();
+        if (!line.startsWith("L ")) continue;
+        counts[line.mid(2)]++;
+    }
+
+    QVector<QPair<int,QByteArray> > ranked;
+    ranked.reserve(counts.count());
+    for (auto it = counts.constBegin(), end = counts.constEnd(); it != end; ++it)
+        ranked.append(qMakePair(it.value(),it.key()));
+    std::sort(ranked.begin(),ranked.end(),[](const QPair<int,QByteArray> &a, const QPair<int,QByteArray> &b){
+        return a.first > b.first;
+    });
+
+    for (int i = 0; i < ranked.count() && i < maxEntries; i++)
+        res.append(QString::fromUtf8(QByteArray::fromPercentEncoding(ranked.at(i).second)));
+    return res;
+}
+
+void CWarmup::waitForIdle()
+{
+    while (!m_canceled && m_translator && m_translator->activeRequests() > 0) {
+        m_stats->add(QSL("warmup.yields"));
+        QThread::msleep(CDefaults::warmupYieldInterval);
+    }
+}
+
+void CWarmup::run(const QString &snapshotFile, const QString &accessLog, int maxEntries)
+{
+    QThread *thread = QThread::currentThread();
+    const QThread::Priority priority = thread->priority();
+    thread->setPriority(QThread::LowestPriority);
+    auto priorityGuard = qScopeGuard([thread,priority]{ thread->setPriority(priority); });
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QVector<QPair<QString,QString> > snapshot = readSnapshot(snapshotFile);
+    const QStringList keys = readAccessLog(accessLog,maxEntries);
+    m_stats->set(QSL("warmup.total"),snapshot.count() + keys.count());
+    m_stats->set(QSL("warmup.done"),0);
+    if (snapshot.isEmpty() && keys.isEmpty()) return;
+
+    qInfo() << "Cache warm-up started:" << snapshot.count() << "snapshot entries,"
+            << keys.count() << "logged keys";
+
+    // Snapshot already has translations, no engine calls needed.
+    int loaded = 0;
+    for (const auto &entry : snapshot) {
+        if (m_canceled || m_translator.isNull()) return;
+        if (m_translator->warmEntry(entry.first,entry.second))
+            loaded++;
+        m_stats->add(QSL("warmup.done"));
+    }
+    m_stats->set(QSL("warmup.loaded"),loaded);
+
+    int translated = 0;
+    for (const auto &key : keys) {
+        waitForIdle();
+        if (m_canceled || m_translator.isNull()) return;
+        if (m_translator->warmKey(key))
+            translated++;
+        m_stats->add(QSL("warmup.done"));
+    }
+    m_stats->set(QSL("warmup.translated"),translated);
+
+    qInfo() << "Cache warm-up finished:" << loaded << "loaded," << translated << "from access log in"
+            << timer.elapsed() << "ms";
+}
@@ -0,0 +1,49 @@
+#ifndef CWARMUP_H
+#define CWARMUP_H
+
+#include <QObject>
+#include <QPointer>
+#include <QFuture>
+#include <QVector>
+#include <QPair>
+#include <atomic>
+#include "translator.h"
+#include "stats.h"
+
+namespace CDefaults {
+const int warmupMaxEntries = 10000;
+const int warmupYieldInterval = 50;
+}
+
+// Refills cache after restart: loads hot entries snapshot made on pause or
+// shutdown, then translates most frequent keys of recorded access log
+// (cache trace). Runs in background at lowest priority and waits while
+// live requests are translated. Progress is published as warmup.* counters.
+class CWarmup : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(CWarmup)
+public:
+    CWarmup(CTranslator *translator, CStatistics *stats, QObject *parent = nullptr);
+    ~CWarmup() override;
+
+    void start(const QString &snapshotFile, const QString &accessLog,
+               int maxEntries = CDefaults::warmupMaxEntries);
+    void cancel();
+    bool isRunning() const;
+
+    bool saveSnapshot(const QString &fileName, int maxEntries = CDefaults::warmupMaxEntries);
+
+private:
+    QPointer<CTranslator> m_translator;
+    QPointer<CStatistics> m_stats;
+    QFuture<void> m_future;
+    std::atomic<bool> m_canceled { false };
+
+    void run(const QString &snapshotFile, const QString &accessLog, int maxEntries);
+    void waitForIdle();
+    static QVector<QPair<QString,QString> > readSnapshot(const QString &fileName);
+    static QStringList readAccessLog(const QString &fileName, int maxEntries);
+};
+
+#endif // CWARMUP_H